@@ -0,0 +1,483 @@
+/*
+*  Synthetic.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <sstream>
+
+#include <geos/geom/CoordinateSequence.h>
+
+// App headers
+#include "Synthetic.h"
+
+using geos::geom::CoordinateSequence;
+
+// Most a cell corner can move, as a fraction of a cell, and
+// still leave room for a hole in the middle
+static const double kMaxJitter = 0.2;
+
+// Half the size of a hole, and of an overlay, as fractions
+// of a cell, and how rough the edges of a hole are
+static const double kHoleSize = 0.08;
+static const double kOverlaySize = 0.75;
+static const double kHoleRoughness = 0.05;
+
+// Clusters, and their spread as a fraction of the extent
+static const std::size_t kClusters = 8;
+static const double kClusterSpread = 0.01;
+
+// How far off a vertex a boundary query lands, as a
+// fraction of the size of the feature
+static const double kBoundarySpread = 0.001;
+
+
+/*************************************************************************
+ * Coverage
+ */
+
+/**
+ * A seed for one piece of the coverage, so each comes out the
+ * same whatever order the pieces are made in (splitmix64).
+ */
+static uint64_t
+piece_seed(uint64_t seed, uint64_t kind, uint64_t i, uint64_t j)
+{
+    uint64_t z = seed ^ (kind << 60) ^ (i << 30) ^ j;
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Append the points after a, up to and including b, of the
+ * edge between them, bending the middle of each segment off
+ * the line by up to roughness of its length, depth times over.
+ */
+static void
+displace(const Coordinate& a, const Coordinate& b, std::size_t depth, double roughness,
+         std::mt19937_64& rng, std::vector<Coordinate>& out)
+{
+    if (depth == 0) {
+        out.push_back(b);
+        return;
+    }
+    std::uniform_real_distribution<double> u(-roughness, roughness);
+    double k = u(rng);
+    Coordinate m((a.x + b.x) / 2 - (b.y - a.y) * k,
+                 (a.y + b.y) / 2 + (b.x - a.x) * k);
+    displace(a, m, depth - 1, roughness, rng, out);
+    displace(m, b, depth - 1, roughness, rng, out);
+}
+
+static std::vector<Coordinate>
+make_edge(const Coordinate& a, const Coordinate& b, std::size_t depth, double roughness,
+          uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::vector<Coordinate> edge(1, a);
+    displace(a, b, depth, roughness, rng, edge);
+    return edge;
+}
+
+/**
+ * A closed counter-clockwise ring around a rectangle,
+ * roughened like the cell edges.
+ */
+static std::vector<Coordinate>
+box_ring(const Coordinate& centre, double halfWidth, double halfHeight,
+         std::size_t depth, double roughness, uint64_t seed)
+{
+    Coordinate c[4] = {
+        {centre.x - halfWidth, centre.y - halfHeight},
+        {centre.x + halfWidth, centre.y - halfHeight},
+        {centre.x + halfWidth, centre.y + halfHeight},
+        {centre.x - halfWidth, centre.y + halfHeight}
+    };
+    std::vector<Coordinate> ring(1, c[0]);
+    for (std::size_t k = 0; k < 4; k++) {
+        std::mt19937_64 rng(seed + k);
+        displace(c[k], c[(k + 1) % 4], depth, roughness, rng, ring);
+    }
+    return ring;
+}
+
+static double
+unit(std::mt19937_64& rng)
+{
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+
+std::vector<SyntheticFeature>
+synthetic_features(const SyntheticOptions& opts)
+{
+    std::size_t nx = opts.columns;
+    std::size_t ny = opts.rows;
+    double cw = (opts.bbox[2] - opts.bbox[0]) / nx;
+    double ch = (opts.bbox[3] - opts.bbox[1]) / ny;
+    double jitter = std::min(std::max(opts.jitter, 0.0), kMaxJitter);
+
+    // Corners move about inside their cells, except that
+    // those on the outside stay on the outside
+    std::vector<Coordinate> corners((nx + 1) * (ny + 1));
+    for (std::size_t j = 0; j <= ny; j++) {
+        for (std::size_t i = 0; i <= nx; i++) {
+            std::mt19937_64 rng(piece_seed(opts.seed, 0, i, j));
+            double jx = (i == 0 || i == nx) ? 0.0 : (unit(rng) * 2 - 1) * jitter;
+            double jy = (j == 0 || j == ny) ? 0.0 : (unit(rng) * 2 - 1) * jitter;
+            corners[j * (nx + 1) + i] = Coordinate(opts.bbox[0] + (i + jx) * cw,
+                                                   opts.bbox[1] + (j + jy) * ch);
+        }
+    }
+    auto corner = [&](std::size_t i, std::size_t j) -> const Coordinate& {
+        return corners[j * (nx + 1) + i];
+    };
+
+    // Every edge is made once and used by the cells on
+    // both sides of it, so the cells meet exactly
+    std::vector<std::vector<Coordinate>> horizontal((ny + 1) * nx);
+    std::vector<std::vector<Coordinate>> vertical((nx + 1) * ny);
+    for (std::size_t j = 0; j <= ny; j++)
+        for (std::size_t i = 0; i < nx; i++)
+            horizontal[j * nx + i] = make_edge(corner(i, j), corner(i + 1, j), opts.depth,
+                                               opts.roughness, piece_seed(opts.seed, 1, i, j));
+    for (std::size_t i = 0; i <= nx; i++)
+        for (std::size_t j = 0; j < ny; j++)
+            vertical[i * ny + j] = make_edge(corner(i, j), corner(i, j + 1), opts.depth,
+                                             opts.roughness, piece_seed(opts.seed, 2, i, j));
+
+    std::vector<SyntheticFeature> features(nx * ny);
+    std::vector<SyntheticFeature> extras;
+    std::size_t holeDepth = opts.depth > 2 ? opts.depth - 2 : 0;
+    double holeRoughness = std::min(opts.roughness, kHoleRoughness);
+    char name[64];
+    for (std::size_t j = 0; j < ny; j++) {
+        for (std::size_t i = 0; i < nx; i++) {
+            // Counter-clockwise: bottom, right, top, left,
+            // leaving out the corner each edge starts on
+            const auto& bottom = horizontal[j * nx + i];
+            const auto& right = vertical[(i + 1) * ny + j];
+            const auto& top = horizontal[(j + 1) * nx + i];
+            const auto& left = vertical[i * ny + j];
+            std::vector<Coordinate> shell(bottom.begin(), bottom.end());
+            shell.insert(shell.end(), right.begin() + 1, right.end());
+            shell.insert(shell.end(), top.rbegin() + 1, top.rend());
+            shell.insert(shell.end(), left.rbegin() + 1, left.rend());
+
+            SyntheticFeature& f = features[j * nx + i];
+            snprintf(name, sizeof(name), "cell_%zu_%zu", i, j);
+            f.name = name;
+            // An exclave from the cell before may be here
+            // already, but the cell's own shell goes first
+            f.polygons.insert(f.polygons.begin(), {std::move(shell)});
+
+            std::mt19937_64 rng(piece_seed(opts.seed, 3, i, j));
+            bool hole = unit(rng) < opts.holes;
+            bool exclave = unit(rng) < opts.multipart && nx > 1;
+            bool overlay = unit(rng) < opts.overlap;
+            Coordinate centre((corner(i, j).x + corner(i + 1, j).x + corner(i, j + 1).x + corner(i + 1, j + 1).x) / 4,
+                              (corner(i, j).y + corner(i + 1, j).y + corner(i, j + 1).y + corner(i + 1, j + 1).y) / 4);
+
+            if (hole) {
+                // The island goes in the hole, clockwise
+                double half = kHoleSize * std::min(cw, ch);
+                std::vector<Coordinate> island = box_ring(centre, half, half, holeDepth, holeRoughness,
+                                                          piece_seed(opts.seed, 4, i, j));
+                f.polygons[0].emplace_back(island.rbegin(), island.rend());
+                if (exclave) {
+                    std::size_t next = i + 1 < nx ? i + 1 : i - 1;
+                    features[j * nx + next].polygons.push_back({std::move(island)});
+                }
+                else {
+                    snprintf(name, sizeof(name), "enclave_%zu_%zu", i, j);
+                    extras.push_back({name, {{std::move(island)}}});
+                }
+            }
+            if (overlay) {
+                snprintf(name, sizeof(name), "overlay_%zu_%zu", i, j);
+                extras.push_back({name, {{box_ring(centre, kOverlaySize * cw, kOverlaySize * ch,
+                                                   opts.depth, opts.roughness,
+                                                   piece_seed(opts.seed, 5, i, j))}}});
+            }
+        }
+    }
+    features.insert(features.end(), std::make_move_iterator(extras.begin()),
+                    std::make_move_iterator(extras.end()));
+
+    // Pull everything in towards the middle, r to r^skew
+    // with r running from 0 in the middle to 1 at the corners
+    if (opts.skew != 1.0) {
+        double cx = (opts.bbox[0] + opts.bbox[2]) / 2;
+        double cy = (opts.bbox[1] + opts.bbox[3]) / 2;
+        double radius = std::hypot(opts.bbox[2] - cx, opts.bbox[3] - cy);
+        for (auto& f : features) {
+            for (auto& polygon : f.polygons) {
+                for (auto& ring : polygon) {
+                    for (auto& c : ring) {
+                        double r = std::hypot(c.x - cx, c.y - cy) / radius;
+                        if (r > 0) {
+                            double k = std::pow(r, opts.skew) / r;
+                            c.x = cx + (c.x - cx) * k;
+                            c.y = cy + (c.y - cy) * k;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return features;
+}
+
+
+static void
+append_ring(std::string& out, const std::vector<Coordinate>& ring)
+{
+    char buf[64];
+    out += '[';
+    for (std::size_t i = 0; i < ring.size(); i++) {
+        snprintf(buf, sizeof(buf), "%s[%.10g,%.10g]", i ? "," : "", ring[i].x, ring[i].y);
+        out += buf;
+    }
+    out += ']';
+}
+
+static void
+append_polygon(std::string& out, const std::vector<std::vector<Coordinate>>& polygon)
+{
+    out += '[';
+    for (std::size_t r = 0; r < polygon.size(); r++) {
+        if (r)
+            out += ',';
+        append_ring(out, polygon[r]);
+    }
+    out += ']';
+}
+
+
+void
+write_geojson(std::ostream& out, const std::vector<SyntheticFeature>& features)
+{
+    out << "{\"type\":\"FeatureCollection\",\"features\":[\n";
+    std::string line;
+    for (std::size_t i = 0; i < features.size(); i++) {
+        const SyntheticFeature& f = features[i];
+        bool multi = f.polygons.size() > 1;
+        line = i ? ",\n" : "";
+        line += "{\"type\":\"Feature\",\"properties\":{\"name\":\"";
+        line += f.name;
+        line += multi ? "\"},\"geometry\":{\"type\":\"MultiPolygon\",\"coordinates\":"
+                      : "\"},\"geometry\":{\"type\":\"Polygon\",\"coordinates\":";
+        if (multi) {
+            line += '[';
+            for (std::size_t p = 0; p < f.polygons.size(); p++) {
+                if (p)
+                    line += ',';
+                append_polygon(line, f.polygons[p]);
+            }
+            line += ']';
+        }
+        else {
+            append_polygon(line, f.polygons[0]);
+        }
+        line += "}}";
+        out << line;
+    }
+    out << "\n]}\n";
+}
+
+
+std::string
+synthetic_geojson(const SyntheticOptions& opts)
+{
+    std::ostringstream out;
+    write_geojson(out, synthetic_features(opts));
+    return out.str();
+}
+
+
+/*************************************************************************
+ * Queries
+ */
+
+const char*
+distribution_name(QueryDistribution dist)
+{
+    switch (dist) {
+        case QueryDistribution::UNIFORM:   return "uniform";
+        case QueryDistribution::CLUSTERED: return "clustered";
+        case QueryDistribution::BOUNDARY:  return "boundary";
+    }
+    return "unknown";
+}
+
+
+bool
+parse_distribution(const std::string& name, QueryDistribution& dist)
+{
+    for (QueryDistribution d : {QueryDistribution::UNIFORM, QueryDistribution::CLUSTERED,
+                                QueryDistribution::BOUNDARY}) {
+        if (name == distribution_name(d)) {
+            dist = d;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**
+ * What make_queries() needs to know of a data set, whether
+ * loaded into a SpatialLookup or still synthetic features.
+ */
+class LookupData {
+
+public:
+
+    explicit LookupData(const SpatialLookup& splu) : m_splu(splu) {}
+
+    std::size_t size() const { return m_splu.numFeatures(); }
+
+    Envelope
+    envelope(std::size_t i) const
+    {
+        return *m_splu.entry(static_cast<uint32_t>(i)).getEnvelopeInternal();
+    }
+
+    bool
+    randomVertex(std::size_t i, std::mt19937_64& rng, Coordinate& v) const
+    {
+        const Geometry* geom = m_splu.entry(static_cast<uint32_t>(i)).getFeature().getGeometry();
+        std::unique_ptr<CoordinateSequence> coords = geom->getCoordinates();
+        if (coords->isEmpty())
+            return false;
+        v = coords->getAt(std::uniform_int_distribution<std::size_t>(0, coords->size() - 1)(rng));
+        return true;
+    }
+
+private:
+
+    const SpatialLookup& m_splu;
+
+};
+
+class FeatureData {
+
+public:
+
+    explicit FeatureData(const std::vector<SyntheticFeature>& features)
+        : m_features(features)
+    {
+        for (const auto& f : features) {
+            Envelope env;
+            for (const auto& polygon : f.polygons)
+                for (const auto& c : polygon[0])
+                    env.expandToInclude(c);
+            m_envelopes.push_back(env);
+        }
+    }
+
+    std::size_t size() const { return m_features.size(); }
+    Envelope envelope(std::size_t i) const { return m_envelopes[i]; }
+
+    bool
+    randomVertex(std::size_t i, std::mt19937_64& rng, Coordinate& v) const
+    {
+        const auto& polygons = m_features[i].polygons;
+        const auto& polygon = polygons[std::uniform_int_distribution<std::size_t>(0, polygons.size() - 1)(rng)];
+        const auto& ring = polygon[std::uniform_int_distribution<std::size_t>(0, polygon.size() - 1)(rng)];
+        if (ring.empty())
+            return false;
+        v = ring[std::uniform_int_distribution<std::size_t>(0, ring.size() - 1)(rng)];
+        return true;
+    }
+
+private:
+
+    const std::vector<SyntheticFeature>& m_features;
+    std::vector<Envelope> m_envelopes;
+
+};
+
+
+template<typename Data>
+static std::vector<Coordinate>
+make_queries_from(const Data& data, QueryDistribution dist, std::size_t count, uint64_t seed)
+{
+    std::vector<Coordinate> queries;
+    std::size_t n = data.size();
+    if (!n)
+        return queries;
+
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<std::size_t> pickFeature(0, n - 1);
+    Envelope extent;
+    for (std::size_t i = 0; i < n; i++) {
+        Envelope env = data.envelope(i);
+        extent.expandToInclude(&env);
+    }
+
+    queries.reserve(count);
+    switch (dist) {
+        case QueryDistribution::UNIFORM: {
+            std::uniform_real_distribution<double> ux(extent.getMinX(), extent.getMaxX());
+            std::uniform_real_distribution<double> uy(extent.getMinY(), extent.getMaxY());
+            for (std::size_t i = 0; i < count; i++)
+                queries.emplace_back(ux(rng), uy(rng));
+            break;
+        }
+        case QueryDistribution::CLUSTERED: {
+            std::vector<Coordinate> centres;
+            for (std::size_t c = 0; c < kClusters; c++) {
+                Coordinate centre;
+                data.envelope(pickFeature(rng)).centre(centre);
+                centres.push_back(centre);
+            }
+            std::uniform_int_distribution<std::size_t> pickCentre(0, centres.size() - 1);
+            std::normal_distribution<double> dx(0.0, extent.getWidth() * kClusterSpread);
+            std::normal_distribution<double> dy(0.0, extent.getHeight() * kClusterSpread);
+            for (std::size_t i = 0; i < count; i++) {
+                const Coordinate& c = centres[pickCentre(rng)];
+                queries.emplace_back(c.x + dx(rng), c.y + dy(rng));
+            }
+            break;
+        }
+        case QueryDistribution::BOUNDARY: {
+            std::normal_distribution<double> offset(0.0, 1.0);
+            while (queries.size() < count) {
+                std::size_t f = pickFeature(rng);
+                Coordinate v;
+                if (!data.randomVertex(f, rng, v))
+                    continue;
+                Envelope env = data.envelope(f);
+                double spread = (env.getWidth() + env.getHeight()) * kBoundarySpread;
+                queries.emplace_back(v.x + offset(rng) * spread, v.y + offset(rng) * spread);
+            }
+            break;
+        }
+    }
+    return queries;
+}
+
+
+std::vector<Coordinate>
+make_queries(const SpatialLookup& splu, QueryDistribution dist, std::size_t count, uint64_t seed)
+{
+    return make_queries_from(LookupData(splu), dist, count, seed);
+}
+
+
+std::vector<Coordinate>
+make_queries(const std::vector<SyntheticFeature>& features, QueryDistribution dist,
+             std::size_t count, uint64_t seed)
+{
+    return make_queries_from(FeatureData(features), dist, count, seed);
+}
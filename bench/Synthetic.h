@@ -0,0 +1,98 @@
+/*
+*  Synthetic.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// App headers
+#include "SpatialLookup.h"
+
+
+/**
+ * A synthetic coverage: a columns by rows grid of cells over
+ * the bbox, sharing their edges with their neighbours as real
+ * administrative boundaries do. The same options and seed
+ * always give the same data.
+ *
+ * Each cell corner is moved by up to jitter of a cell, so the
+ * cells are irregular, and each edge is roughened by midpoint
+ * displacement, depth times over, so has 2^depth segments.
+ * With skew above 1 the whole grid is pulled in towards the
+ * middle, so cells there are small and those at the edges are
+ * large, as they are around and away from cities.
+ *
+ * A holes fraction of the cells have a hole, filled by an
+ * enclave of its own, or for a multipart fraction of them by
+ * an exclave of the next cell over, which makes that cell a
+ * multipolygon. An overlap fraction of the cells also get an
+ * overlay feature, half as big again, lying over their
+ * neighbours, so that points can hit more than one feature.
+ */
+struct SyntheticOptions {
+    std::size_t columns = 64;
+    std::size_t rows = 64;
+    std::size_t depth = 4;
+    double roughness = 0.1;
+    double jitter = 0.0;
+    double skew = 1.0;
+    double holes = 0.0;
+    double multipart = 0.0;
+    double overlap = 0.0;
+    double bbox[4] = {0.0, 0.0, 100.0, 100.0};
+    uint64_t seed = 1;
+};
+
+/**
+ * One feature of a synthetic coverage: its "name" property,
+ * and its polygons, each a shell and then any holes, with
+ * every ring closed.
+ */
+struct SyntheticFeature {
+    std::string name;
+    std::vector<std::vector<std::vector<Coordinate>>> polygons;
+};
+
+std::vector<SyntheticFeature> synthetic_features(const SyntheticOptions& opts);
+
+/**
+ * Write features as a GeoJSON FeatureCollection.
+ */
+void write_geojson(std::ostream& out, const std::vector<SyntheticFeature>& features);
+
+/**
+ * The whole coverage as a GeoJSON string.
+ */
+std::string synthetic_geojson(const SyntheticOptions& opts);
+
+/**
+ * Where query points fall: uniformly over the data, in a few
+ * tight clusters as real traffic does around cities, or just
+ * off the polygon vertices, where the point in polygon tests
+ * have the most work to do.
+ */
+enum class QueryDistribution {
+    UNIFORM,
+    CLUSTERED,
+    BOUNDARY
+};
+
+const char* distribution_name(QueryDistribution dist);
+bool parse_distribution(const std::string& name, QueryDistribution& dist);
+
+/**
+ * Make count query points over the data in splu, or over
+ * synthetic features before they are loaded.
+ */
+std::vector<Coordinate> make_queries(const SpatialLookup& splu, QueryDistribution dist,
+                                     std::size_t count, uint64_t seed = 1);
+std::vector<Coordinate> make_queries(const std::vector<SyntheticFeature>& features,
+                                     QueryDistribution dist, std::size_t count, uint64_t seed = 1);
@@ -0,0 +1,531 @@
+/*
+*  lookup_bench.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+/*
+ * Microbenchmarks of the lookup engine: the whole lookup, and
+ * on their own the index query, the point in polygon test, the
+ * copying out of property values and the JSON rendering, each
+ * over every data set and query distribution.
+ *
+ * The synthetic coverages are always run. To add a real data
+ * set, give its file and property after any benchmark flags:
+ *
+ *   spatial_lookup_bench --benchmark_filter=lookup/ zips.json ZCTA5CE10
+ *
+ * Results can be saved as a baseline, and later runs checked
+ * against it, failing if time per query, load time or memory
+ * has grown by more than a threshold:
+ *
+ *   spatial_lookup_bench --save-baseline=baseline.json
+ *   spatial_lookup_bench --baseline=baseline.json --max-regression=10
+ */
+
+// System headers
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+// App headers
+#include "SpatialLookup.h"
+#include "Synthetic.h"
+
+// Query points made for each data set and distribution,
+// cycled through by every benchmark
+static const std::size_t kQueries = 4096;
+
+// Points per call in the lookupBatch() benchmark
+static const std::size_t kBatch = 256;
+
+
+/**
+ * A loaded data set, and the query points for it along with
+ * what they find, worked out up front so each benchmark can
+ * time just its own part of the lookup.
+ */
+struct BenchData {
+    std::string name;
+    std::string path;
+    std::string property;
+    std::unique_ptr<SpatialLookup> splu;
+};
+
+struct QuerySet {
+    std::vector<Coordinate> points;
+    // Each point paired with each entry the index offers for it
+    std::vector<std::pair<Coordinate, uint32_t>> tests;
+    // The entries that really hold each point
+    std::vector<std::vector<uint32_t>> hitEntries;
+    // The values found for each point
+    std::vector<std::vector<std::string>> hits;
+};
+
+static QuerySet
+make_query_set(const SpatialLookup& splu, QueryDistribution dist)
+{
+    QuerySet qs;
+    qs.points = make_queries(splu, dist, kQueries);
+    std::vector<uint32_t> ids;
+    for (const Coordinate& c : qs.points) {
+        ids.clear();
+        splu.candidates(c, ids);
+        std::vector<uint32_t> hitEntries;
+        for (uint32_t id : ids) {
+            qs.tests.emplace_back(c, id);
+            if (splu.entry(id).intersects(c))
+                hitEntries.push_back(id);
+        }
+        qs.hitEntries.push_back(std::move(hitEntries));
+        qs.hits.push_back(splu.lookup(c));
+    }
+    return qs;
+}
+
+/**
+ * Write a synthetic data set to a temporary file, since the
+ * engine reads its data from a file, and it is loaded again
+ * by the load benchmark. Returns "" on failure.
+ */
+static std::string
+write_temporary(const std::string& geojson)
+{
+    char path[] = "/tmp/spatial_lookup_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        std::cerr << "spatial_lookup_bench: unable to make a temporary file" << std::endl;
+        return "";
+    }
+    close(fd);
+    std::ofstream ofs(path);
+    ofs << geojson;
+    return path;
+}
+
+
+/*************************************************************************
+ * Baselines
+ */
+
+/**
+ * Console output as usual, while keeping the time per
+ * iteration of each benchmark, in nanoseconds. With
+ * repetitions, the median stands for the benchmark.
+ */
+class RecordingReporter : public benchmark::ConsoleReporter {
+
+public:
+
+    RecordingReporter()
+        : ConsoleReporter(isatty(STDOUT_FILENO) ? OO_Defaults : OO_Tabular)
+    {}
+
+    void
+    ReportRuns(const std::vector<Run>& runs) override
+    {
+        ConsoleReporter::ReportRuns(runs);
+        for (const Run& run : runs) {
+            if (!run.iterations)
+                continue;
+            bool aggregate = run.run_type == Run::RT_Aggregate;
+            if (aggregate && run.aggregate_name != "median")
+                continue;
+            double nanos = run.GetAdjustedRealTime() * 1e9 / benchmark::GetTimeUnitMultiplier(run.time_unit);
+            m_results[run.run_name.str()] = nanos;
+        }
+    }
+
+    std::map<std::string, double>& results() { return m_results; }
+
+private:
+
+    std::map<std::string, double> m_results;
+
+};
+
+/**
+ * Baselines are a flat JSON object of benchmark name to
+ * nanoseconds per iteration, and "memory/" data set name
+ * to bytes.
+ */
+static bool
+write_baseline(const std::string& path, const std::map<std::string, double>& results)
+{
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "spatial_lookup_bench: unable to write '" << path << "'" << std::endl;
+        return false;
+    }
+    out << "{";
+    char buf[64];
+    bool first = true;
+    for (const auto& r : results) {
+        snprintf(buf, sizeof(buf), "%.1f", r.second);
+        out << (first ? "\n" : ",\n") << "  \"" << r.first << "\": " << buf;
+        first = false;
+    }
+    out << "\n}\n";
+    return true;
+}
+
+static bool
+read_baseline(const std::string& path, std::map<std::string, double>& baseline)
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "spatial_lookup_bench: unable to read '" << path << "'" << std::endl;
+        return false;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+
+    // Every "name": number pair, wherever it is
+    std::size_t pos = 0;
+    while ((pos = text.find('"', pos)) != std::string::npos) {
+        std::size_t end = text.find('"', pos + 1);
+        std::size_t colon = end == std::string::npos ? end : text.find_first_not_of(" \t\r\n", end + 1);
+        if (colon == std::string::npos || text[colon] != ':') {
+            std::cerr << "spatial_lookup_bench: bad baseline '" << path << "'" << std::endl;
+            return false;
+        }
+        const char* num = text.c_str() + colon + 1;
+        char* numEnd;
+        double value = std::strtod(num, &numEnd);
+        if (numEnd == num) {
+            std::cerr << "spatial_lookup_bench: bad baseline '" << path << "'" << std::endl;
+            return false;
+        }
+        baseline[text.substr(pos + 1, end - pos - 1)] = value;
+        pos = numEnd - text.c_str();
+    }
+    return true;
+}
+
+static std::string
+format_value(const std::string& name, double value)
+{
+    char buf[32];
+    if (name.compare(0, 7, "memory/") == 0)
+        snprintf(buf, sizeof(buf), "%.1f MB", value / (1024.0 * 1024.0));
+    else if (value >= 1e6)
+        snprintf(buf, sizeof(buf), "%.2f ms", value / 1e6);
+    else
+        snprintf(buf, sizeof(buf), "%.1f ns", value);
+    return buf;
+}
+
+/**
+ * Compare the results against the baseline, printing each
+ * one. Fails if any grew by more than maxRegression percent,
+ * or if nothing in the baseline was run at all, which is a
+ * baseline of some other suite or data set, or a filter that
+ * matches none of it. Those not run this time, say from a
+ * filter, are left out, but listed, so a renamed benchmark
+ * doesn't drop out of the check unnoticed.
+ */
+static bool
+compare_baseline(const std::map<std::string, double>& baseline,
+                 const std::map<std::string, double>& results, double maxRegression)
+{
+    std::size_t regressed = 0;
+    std::size_t compared = 0;
+    std::vector<std::string> missing;
+    printf("\n%-40s %14s %14s %9s\n", "baseline comparison", "baseline", "current", "change");
+    for (const auto& b : baseline) {
+        auto it = results.find(b.first);
+        if (it == results.end()) {
+            missing.push_back(b.first);
+            continue;
+        }
+        compared++;
+        double change = b.second > 0 ? (it->second - b.second) * 100.0 / b.second : 0.0;
+        bool bad = change > maxRegression;
+        regressed += bad;
+        printf("%-40s %14s %14s %+8.1f%%%s\n", b.first.c_str(),
+               format_value(b.first, b.second).c_str(), format_value(b.first, it->second).c_str(),
+               change, bad ? "  REGRESSED" : "");
+    }
+    if (!missing.empty()) {
+        printf("\nWARNING: %zu of %zu baseline results were not run, and are not checked:\n",
+               missing.size(), baseline.size());
+        for (const std::string& name : missing)
+            printf("  %s\n", name.c_str());
+    }
+    if (!compared) {
+        printf("FAILED: none of the %zu baseline results were run\n", baseline.size());
+        return false;
+    }
+    printf("%zu of %zu regressed by more than %.1f%%\n", regressed, compared, maxRegression);
+    return regressed == 0;
+}
+
+
+/*************************************************************************
+ * Benchmarks
+ */
+
+static void
+bench_load(benchmark::State& state, const BenchData* d)
+{
+    for (auto _ : state) {
+        SpatialLookup splu(d->path, d->property);
+        benchmark::DoNotOptimize(splu.numFeatures());
+    }
+}
+
+static void
+bench_lookup(benchmark::State& state, const SpatialLookup* splu, const QuerySet* qs)
+{
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::vector<std::string> hits = splu->lookup(qs->points[i++ % qs->points.size()]);
+        benchmark::DoNotOptimize(hits.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void
+bench_lookup_ids(benchmark::State& state, const SpatialLookup* splu, const QuerySet* qs)
+{
+    std::vector<uint32_t> ids;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        ids.clear();
+        splu->lookupIds(qs->points[i++ % qs->points.size()], ids);
+        benchmark::DoNotOptimize(ids.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * lookupBatch() over kBatch points at a time; the time is
+ * per batch, and items per second is per point.
+ */
+static void
+bench_lookup_batch(benchmark::State& state, const SpatialLookup* splu, const QuerySet* qs)
+{
+    std::vector<uint32_t> ids;
+    std::vector<std::size_t> ends;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        ids.clear();
+        ends.clear();
+        splu->lookupBatch(qs->points.data() + i, kBatch, ids, ends);
+        benchmark::DoNotOptimize(ids.data());
+        i = (i + kBatch) % (qs->points.size() - kBatch + 1);
+    }
+    state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+static void
+bench_index_query(benchmark::State& state, const SpatialLookup* splu, const QuerySet* qs)
+{
+    std::vector<uint32_t> ids;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        ids.clear();
+        splu->candidates(qs->points[i++ % qs->points.size()], ids);
+        benchmark::DoNotOptimize(ids.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void
+bench_intersects(benchmark::State& state, const SpatialLookup* splu, const QuerySet* qs)
+{
+    if (qs->tests.empty()) {
+        state.SkipWithError("no candidates for these queries");
+        return;
+    }
+    std::size_t i = 0;
+    for (auto _ : state) {
+        const auto& t = qs->tests[i++ % qs->tests.size()];
+        bool hit = splu->entry(t.second).intersects(t.first);
+        benchmark::DoNotOptimize(hit);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * What lookup() does for each hit once the tests are done:
+ * copy the value out into the result.
+ */
+static void
+bench_properties(benchmark::State& state, const SpatialLookup* splu, const QuerySet* qs)
+{
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::vector<std::string> values;
+        for (uint32_t id : qs->hitEntries[i++ % qs->hitEntries.size()])
+            values.push_back(splu->value(splu->entryValueId(id)));
+        benchmark::DoNotOptimize(values.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void
+bench_hits_to_json(benchmark::State& state, const SpatialLookup*, const QuerySet* qs)
+{
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::string json = hits_to_json(qs->hits[i++ % qs->hits.size()]);
+        benchmark::DoNotOptimize(json.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+/*************************************************************************
+ * Main
+ */
+
+static void
+usage()
+{
+    std::cerr << "usage: spatial_lookup_bench [benchmark options] [--save-baseline=PATH]" << std::endl
+              << "           [--baseline=PATH [--max-regression=PERCENT]] [geojson.json property]" << std::endl;
+}
+
+
+int
+main(int argc, char** argv)
+{
+    benchmark::Initialize(&argc, argv);
+
+    // Our own options, after the benchmark ones are taken out
+    static const option longopts[] = {
+        {"baseline",       required_argument, nullptr, 'b'},
+        {"save-baseline",  required_argument, nullptr, 's'},
+        {"max-regression", required_argument, nullptr, 'm'},
+        {nullptr,          0,                 nullptr, 0}
+    };
+    std::string baselinePath;
+    std::string savePath;
+    double maxRegression = 10.0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (opt) {
+        case 'b': baselinePath = optarg; break;
+        case 's': savePath = optarg; break;
+        case 'm': {
+            char* end;
+            maxRegression = std::strtod(optarg, &end);
+            if (end == optarg || *end || !std::isfinite(maxRegression) || maxRegression < 0) {
+                std::cerr << "spatial_lookup_bench: --max-regression must be a percentage of 0 or more, not '"
+                          << optarg << "'" << std::endl;
+                return 1;
+            }
+            break;
+        }
+        default:
+            usage();
+            return 1;
+        }
+    }
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty() && !read_baseline(baselinePath, baseline))
+        return 1;
+
+    // Two synthetic coverages: many simple cells, and a
+    // few cells with very long, detailed boundaries
+    std::vector<BenchData> datasets(2);
+    SyntheticOptions grid;
+    grid.columns = grid.rows = 64;
+    grid.depth = 4;
+    SyntheticOptions detailed;
+    detailed.columns = detailed.rows = 8;
+    detailed.depth = 10;
+    datasets[0].name = "grid";
+    datasets[0].path = write_temporary(synthetic_geojson(grid));
+    datasets[1].name = "detailed";
+    datasets[1].path = write_temporary(synthetic_geojson(detailed));
+    for (BenchData& d : datasets)
+        d.property = "name";
+    auto removeTemporaries = [&datasets]() {
+        for (std::size_t i = 0; i < 2; i++)
+            unlink(datasets[i].path.c_str());
+    };
+
+    // Whatever is left after the flags names a real one
+    if (argc - optind == 2) {
+        BenchData real;
+        real.path = argv[optind];
+        real.name = real.path.substr(real.path.find_last_of('/') + 1);
+        real.property = argv[optind + 1];
+        datasets.push_back(std::move(real));
+    }
+    else if (argc != optind) {
+        usage();
+        removeTemporaries();
+        return 1;
+    }
+
+    using BenchFn = void (*)(benchmark::State&, const SpatialLookup*, const QuerySet*);
+    const std::pair<const char*, BenchFn> benches[] = {
+        {"lookup", bench_lookup},
+        {"lookup_ids", bench_lookup_ids},
+        {"lookup_batch", bench_lookup_batch},
+        {"index_query", bench_index_query},
+        {"intersects", bench_intersects},
+        {"properties", bench_properties},
+        {"hits_to_json", bench_hits_to_json},
+    };
+
+    std::vector<std::unique_ptr<QuerySet>> querySets;
+    std::map<std::string, double> memory;
+    for (BenchData& d : datasets) {
+        if (!d.path.empty())
+            d.splu.reset(new SpatialLookup(d.path, d.property));
+        if (!d.splu || !d.splu->ready() || !d.splu->numFeatures()) {
+            std::cerr << "spatial_lookup_bench: unable to load data set '" << d.name << "'" << std::endl;
+            removeTemporaries();
+            return 1;
+        }
+        const LoadReport& lr = d.splu->loadReport();
+        memory["memory/" + d.name] = static_cast<double>(
+            lr.geometryBytes + lr.preparedBytes + lr.propertyBytes + lr.indexBytes);
+
+        std::string loadName = "load/" + d.name;
+        benchmark::RegisterBenchmark(loadName.c_str(), bench_load, &d)->Unit(benchmark::kMillisecond);
+        for (QueryDistribution dist : {QueryDistribution::UNIFORM, QueryDistribution::CLUSTERED,
+                                       QueryDistribution::BOUNDARY}) {
+            querySets.emplace_back(new QuerySet(make_query_set(*d.splu, dist)));
+            const QuerySet* qs = querySets.back().get();
+            for (const auto& b : benches) {
+                std::string name = std::string(b.first) + "/" + d.name + "/" + distribution_name(dist);
+                benchmark::RegisterBenchmark(name.c_str(), b.second, d.splu.get(), qs);
+            }
+        }
+    }
+
+    RecordingReporter reporter;
+    benchmark::RunSpecifiedBenchmarks(&reporter);
+    benchmark::Shutdown();
+    removeTemporaries();
+
+    std::map<std::string, double>& results = reporter.results();
+    results.insert(memory.begin(), memory.end());
+    if (!savePath.empty()) {
+        if (!write_baseline(savePath, results))
+            return 1;
+        std::cerr << "spatial_lookup_bench: saved " << results.size() << " results to " << savePath << std::endl;
+    }
+    if (!baselinePath.empty() && !compare_baseline(baseline, results, maxRegression))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,268 @@
+/*
+*  LookupClient.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cerrno>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+// App headers
+#include "LookupClient.h"
+#include "Sockets.h"
+
+
+/**
+ * Read a uint32 from the body at pos, advancing pos.
+ */
+static bool
+read_u32(const std::string& body, std::size_t& pos, uint32_t& v)
+{
+    if (body.size() - pos < sizeof(v))
+        return false;
+    memcpy(&v, body.data() + pos, sizeof(v));
+    pos += sizeof(v);
+    return true;
+}
+
+static bool
+read_string(const std::string& body, std::size_t& pos, std::string& s)
+{
+    uint32_t len;
+    if (!read_u32(body, pos, len) || body.size() - pos < len)
+        return false;
+    s.assign(body, pos, len);
+    pos += len;
+    return true;
+}
+
+
+LookupClient::LookupClient()
+    : m_fd(-1)
+    , m_nextId(1)
+{}
+
+
+LookupClient::~LookupClient()
+{
+    close();
+}
+
+
+bool
+LookupClient::connect(const std::string& host, unsigned int port)
+{
+    close();
+    m_fd = connect_tcp(host, port, m_error);
+    if (m_fd < 0)
+        return false;
+    m_error.clear();
+    return true;
+}
+
+
+bool
+LookupClient::connectUnix(const std::string& path)
+{
+    close();
+    m_fd = connect_unix(path, m_error);
+    if (m_fd < 0)
+        return false;
+    m_error.clear();
+    return true;
+}
+
+
+void
+LookupClient::close()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+
+bool
+LookupClient::fail(const std::string& msg)
+{
+    m_error = msg;
+    close();
+    return false;
+}
+
+
+bool
+LookupClient::writeAll(const char* data, std::size_t size)
+{
+    while (size) {
+        ssize_t n = ::send(m_fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return fail(std::string("send failed: ") + strerror(errno));
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+
+bool
+LookupClient::readAll(char* data, std::size_t size)
+{
+    while (size) {
+        ssize_t n = ::recv(m_fd, data, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0)
+            return fail("connection closed by server");
+        if (n < 0)
+            return fail(std::string("recv failed: ") + strerror(errno));
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+
+bool
+LookupClient::send(BinaryMessageType type, const double* xy, std::size_t count,
+                   uint32_t& requestId)
+{
+    if (m_fd < 0)
+        return fail("not connected");
+    if (count > kBinaryMaxPoints)
+        return fail("batch too large");
+
+    BinaryHeader req;
+    memset(&req, 0, sizeof(req));
+    req.type = type;
+    req.requestId = requestId = m_nextId++;
+    req.count = static_cast<uint32_t>(count);
+    req.length = static_cast<uint32_t>(binary_request_length(req.count));
+
+    // One write per request, header and points together
+    m_send.assign(reinterpret_cast<const char*>(&req), sizeof(req));
+    m_send.append(reinterpret_cast<const char*>(xy), req.length);
+    return writeAll(m_send.data(), m_send.size());
+}
+
+
+bool
+LookupClient::receive(BinaryHeader& header, std::string& body)
+{
+    if (m_fd < 0)
+        return fail("not connected");
+    if (!readAll(reinterpret_cast<char*>(&header), sizeof(header)))
+        return false;
+    body.resize(header.length);
+    if (header.length && !readAll(&body[0], header.length))
+        return false;
+    if (header.status != BINARY_OK) {
+        m_error = "server rejected request";
+        return false;
+    }
+    return true;
+}
+
+
+bool
+LookupClient::roundTrip(BinaryMessageType type, const double* xy, std::size_t count,
+                        BinaryHeader& header)
+{
+    uint32_t id;
+    if (!send(type, xy, count, id) || !receive(header, m_body))
+        return false;
+    if (header.requestId != id || header.type != type)
+        return fail("response does not match request");
+    return true;
+}
+
+
+bool
+LookupClient::decodeIds(const BinaryHeader& header, const std::string& body,
+                        LookupResults& results)
+{
+    results.offsets.assign(1, 0);
+    results.ids.clear();
+    std::size_t pos = 0;
+    for (uint32_t i = 0; i < header.count; i++) {
+        uint32_t n;
+        if (!read_u32(body, pos, n) || (body.size() - pos) / sizeof(uint32_t) < n)
+            return false;
+        std::size_t old = results.ids.size();
+        results.ids.resize(old + n);
+        memcpy(results.ids.data() + old, body.data() + pos, n * sizeof(uint32_t));
+        pos += n * sizeof(uint32_t);
+        results.offsets.push_back(static_cast<uint32_t>(results.ids.size()));
+    }
+    return pos == body.size();
+}
+
+
+bool
+LookupClient::lookupBatch(const double* xy, std::size_t count, LookupResults& results)
+{
+    BinaryHeader header;
+    if (!roundTrip(BINARY_LOOKUP_IDS, xy, count, header))
+        return false;
+    if (!decodeIds(header, m_body, results))
+        return fail("malformed response");
+    return true;
+}
+
+
+bool
+LookupClient::lookup(double x, double y, std::vector<uint32_t>& ids)
+{
+    double xy[2] = {x, y};
+    LookupResults results;
+    if (!lookupBatch(xy, 1, results))
+        return false;
+    ids.assign(results.begin(0), results.end(0));
+    return true;
+}
+
+
+bool
+LookupClient::lookup(double x, double y, std::vector<std::string>& values)
+{
+    double xy[2] = {x, y};
+    BinaryHeader header;
+    if (!roundTrip(BINARY_LOOKUP_STRINGS, xy, 1, header))
+        return false;
+
+    std::size_t pos = 0;
+    uint32_t n;
+    if (header.count != 1 || !read_u32(m_body, pos, n))
+        return fail("malformed response");
+    values.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+        if (!read_string(m_body, pos, values[i]))
+            return fail("malformed response");
+    }
+    return true;
+}
+
+
+bool
+LookupClient::fetchValues(std::vector<std::string>& values)
+{
+    BinaryHeader header;
+    if (!roundTrip(BINARY_VALUES, nullptr, 0, header))
+        return false;
+
+    std::size_t pos = 0;
+    values.resize(header.count);
+    for (uint32_t i = 0; i < header.count; i++) {
+        if (!read_string(m_body, pos, values[i]))
+            return fail("malformed response");
+    }
+    return true;
+}
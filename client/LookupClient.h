@@ -0,0 +1,127 @@
+/*
+*  LookupClient.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// App headers
+#include "BinaryProtocol.h"
+
+
+/**
+ * The results of a batch lookup, one list of hits per query
+ * point, stored flat: the hits for point i are
+ * ids[offsets[i]] up to ids[offsets[i+1]].
+ */
+struct LookupResults {
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> ids;
+
+    std::size_t size() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+    const uint32_t* begin(std::size_t i) const {
+        return ids.data() + offsets[i];
+    }
+    const uint32_t* end(std::size_t i) const {
+        return ids.data() + offsets[i + 1];
+    }
+};
+
+
+/**
+ * A small blocking client for the binary lookup protocol of
+ * BinaryServer. The simple calls send one request and wait
+ * for its answer. For throughput, send() several requests and
+ * then receive() their answers in order.
+ *
+ * Every call returns false on failure, with the reason in
+ * error(). After a connection or protocol failure the
+ * connection is closed; a request the server rejects leaves
+ * it open.
+ */
+class LookupClient {
+
+public:
+
+    LookupClient();
+    ~LookupClient();
+
+    LookupClient(const LookupClient&) = delete;
+    LookupClient& operator=(const LookupClient&) = delete;
+
+    bool connect(const std::string& host, unsigned int port);
+    bool connectUnix(const std::string& path);
+    void close();
+    bool connected() const {
+        return m_fd >= 0;
+    }
+    const std::string& error() const {
+        return m_error;
+    }
+
+    /**
+     * Look up one point, returning the value ids of the
+     * hits. Use fetchValues() to turn them into strings.
+     */
+    bool lookup(double x, double y, std::vector<uint32_t>& ids);
+
+    /**
+     * Look up one point, returning the value strings.
+     */
+    bool lookup(double x, double y, std::vector<std::string>& values);
+
+    /**
+     * Look up count points, given as x,y pairs in xy.
+     */
+    bool lookupBatch(const double* xy, std::size_t count, LookupResults& results);
+
+    /**
+     * Fetch the table of value strings, indexed by value id.
+     */
+    bool fetchValues(std::vector<std::string>& values);
+
+    /**
+     * Queue a request without waiting for the answer. The
+     * request id is returned, to match up with receive().
+     */
+    bool send(BinaryMessageType type, const double* xy, std::size_t count,
+              uint32_t& requestId);
+
+    /**
+     * Wait for the next response, returning its header and body.
+     */
+    bool receive(BinaryHeader& header, std::string& body);
+
+    /**
+     * Decode the body of a BINARY_LOOKUP_IDS response.
+     */
+    static bool decodeIds(const BinaryHeader& header, const std::string& body,
+                          LookupResults& results);
+
+private:
+
+    // Members
+    int m_fd;
+    uint32_t m_nextId;
+    std::string m_error;
+    std::string m_send;
+    std::string m_body;
+
+    // Methods
+    bool fail(const std::string& msg);
+    bool writeAll(const char* data, std::size_t size);
+    bool readAll(char* data, std::size_t size);
+    bool roundTrip(BinaryMessageType type, const double* xy, std::size_t count,
+                   BinaryHeader& header);
+
+};
@@ -0,0 +1,104 @@
+/*
+*  Admin.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cstring>
+
+// App headers
+#include "Admin.h"
+#include "LookupQuery.h"
+
+// Most costly features listed when no limit is given
+static const std::size_t kDefaultFeatureLimit = 20;
+
+
+/**
+ * Whether the raw target's path, leaving off any query,
+ * is exactly path.
+ */
+static bool
+path_is(const char* target, const char* targetEnd, const char* path)
+{
+    const char* q = static_cast<const char*>(memchr(target, '?', targetEnd - target));
+    std::size_t n = (q ? q : targetEnd) - target;
+    return n == strlen(path) && memcmp(target, path, n) == 0;
+}
+
+
+Admin::Admin(const SpatialLookup& splu, Metrics& metrics, FeatureProfile& profile)
+    : m_splu(splu)
+    , m_metrics(metrics)
+    , m_profile(profile)
+{}
+
+
+int
+Admin::handle(bool post, const char* target, const char* targetEnd, std::string& body)
+{
+    if (path_is(target, targetEnd, "/admin/stage-timing"))
+        return stageTiming(post, target, targetEnd, body);
+    if (path_is(target, targetEnd, "/admin/features"))
+        return features(post, target, targetEnd, body);
+    if (path_is(target, targetEnd, "/admin/load"))
+        return load(post, body);
+    body = "{\"error\":\"not found\"}\n";
+    return 404;
+}
+
+
+int
+Admin::stageTiming(bool post, const char* target, const char* targetEnd, std::string& body)
+{
+    if (post) {
+        int on = query_switch(target, targetEnd, "enabled");
+        if (on < 0) {
+            body = "{\"error\":\"enabled must be 1 or 0\"}\n";
+            return 400;
+        }
+        m_metrics.setStageTiming(on == 1);
+    }
+    body = m_metrics.stageTiming() ? "{\"stage_timing\":true}\n" : "{\"stage_timing\":false}\n";
+    return 200;
+}
+
+
+int
+Admin::features(bool post, const char* target, const char* targetEnd, std::string& body)
+{
+    if (post) {
+        int on = query_switch(target, targetEnd, "enabled");
+        int reset = query_switch(target, targetEnd, "reset");
+        if (on < 0 && reset != 1) {
+            body = "{\"error\":\"enabled must be 1 or 0, or reset must be 1\"}\n";
+            return 400;
+        }
+        if (reset == 1)
+            m_profile.reset();
+        if (on >= 0)
+            m_profile.setEnabled(on == 1);
+    }
+
+    std::size_t limit = kDefaultFeatureLimit;
+    if (query_count(target, targetEnd, "limit", limit) < 0) {
+        body = "{\"error\":\"limit must be a whole number\"}\n";
+        return 400;
+    }
+    body = m_profile.reportJson(m_splu, limit);
+    return 200;
+}
+
+
+int
+Admin::load(bool post, std::string& body)
+{
+    if (post) {
+        body = "{\"error\":\"/admin/load is read only\"}\n";
+        return 400;
+    }
+    body = load_report_json(m_splu.loadReport());
+    return 200;
+}
@@ -0,0 +1,54 @@
+/*
+*  Admin.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <string>
+
+// App headers
+#include "FeatureProfile.h"
+#include "Metrics.h"
+#include "SpatialLookup.h"
+
+
+/**
+ * The /admin/ routes, answered the same way by the httplib
+ * and epoll front ends:
+ *
+ *   GET  /admin/stage-timing             whether stage timing is on
+ *   POST /admin/stage-timing?enabled=1   switch it on, or off with 0
+ *   GET  /admin/features?limit=N         the N most costly features
+ *   POST /admin/features?enabled=1       switch feature profiling on or off
+ *   POST /admin/features?reset=1         zero the feature profile
+ *   GET  /admin/load                     what loading the data took
+ */
+class Admin {
+
+public:
+
+    Admin(const SpatialLookup& splu, Metrics& metrics, FeatureProfile& profile);
+
+    /**
+     * Answer a GET, or a POST if post is set, for the raw
+     * target, which starts with /admin/. Sets body to the
+     * JSON to send back and returns the HTTP status.
+     */
+    int handle(bool post, const char* target, const char* targetEnd, std::string& body);
+
+private:
+
+    int stageTiming(bool post, const char* target, const char* targetEnd, std::string& body);
+    int features(bool post, const char* target, const char* targetEnd, std::string& body);
+    int load(bool post, std::string& body);
+
+    // Members
+    const SpatialLookup& m_splu;
+    Metrics& m_metrics;
+    FeatureProfile& m_profile;
+
+};
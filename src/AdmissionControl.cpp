@@ -0,0 +1,158 @@
+/*
+*  AdmissionControl.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <functional>
+#include <sstream>
+
+// App headers
+#include "AdmissionControl.h"
+
+// The most clients a shard remembers. Past this, the one
+// heard from least recently is forgotten, even if its bucket
+// isn't full yet.
+static const std::size_t kMaxClientsPerShard = 4096;
+
+
+AdmissionControl::AdmissionControl(std::size_t maxQueue, double ratePerSec, double burst)
+    : m_maxQueue(maxQueue)
+    , m_rate(ratePerSec)
+    , m_burst(std::max(1.0, burst))
+    , m_refill(ratePerSec > 0.0
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(m_burst / ratePerSec))
+        : Clock::duration::zero())
+    , m_depth(0)
+    , m_admitted(0)
+    , m_shed(0)
+    , m_limited(0)
+    , m_queueNanos(0)
+    , m_queueMaxNanos(0)
+{}
+
+
+bool
+AdmissionControl::tryEnqueue(std::size_t n)
+{
+    // An empty queue takes anything, so that a batch bigger
+    // than the cap can still get through when things are quiet
+    std::size_t depth = m_depth.load(std::memory_order_relaxed);
+    do {
+        if (m_maxQueue && depth && depth + n > m_maxQueue) {
+            m_shed += n;
+            return false;
+        }
+    } while (!m_depth.compare_exchange_weak(depth, depth + n, std::memory_order_relaxed));
+    return true;
+}
+
+
+void
+AdmissionControl::dequeued(std::size_t n, Clock::duration waited)
+{
+    m_depth -= n;
+    m_admitted += n;
+    uint64_t ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+    m_queueNanos += ns * n;
+    uint64_t max = m_queueMaxNanos.load(std::memory_order_relaxed);
+    while (ns > max && !m_queueMaxNanos.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+
+bool
+AdmissionControl::allowClient(const std::string& client)
+{
+    if (m_rate <= 0.0)
+        return true;
+
+    Shard& shard = m_shards[std::hash<std::string>()(client) % kShards];
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(client);
+    if (it == shard.index.end()) {
+        prune(shard, now);
+        shard.buckets.push_front(Bucket{client, m_burst, now});
+        it = shard.index.emplace(client, shard.buckets.begin()).first;
+    }
+    else {
+        shard.buckets.splice(shard.buckets.begin(), shard.buckets, it->second);
+    }
+
+    // Refill for the time since the last request
+    Bucket& b = *it->second;
+    double elapsed = std::chrono::duration<double>(now - b.last).count();
+    b.tokens = std::min(m_burst, b.tokens + elapsed * m_rate);
+    b.last = now;
+    if (b.tokens < 1.0) {
+        m_limited++;
+        return false;
+    }
+    b.tokens -= 1.0;
+    return true;
+}
+
+
+/**
+ * Drop buckets idle long enough to have refilled completely,
+ * since a fresh bucket would behave the same, and then the
+ * least recently used ones until there is room for another.
+ * Either way they come off the back, so this costs only as
+ * much as there is to drop.
+ */
+void
+AdmissionControl::prune(Shard& shard, Clock::time_point now)
+{
+    while (!shard.buckets.empty() &&
+           (now - shard.buckets.back().last >= m_refill ||
+            shard.buckets.size() >= kMaxClientsPerShard)) {
+        shard.index.erase(shard.buckets.back().client);
+        shard.buckets.pop_back();
+    }
+}
+
+
+bool
+AdmissionControl::saturated() const
+{
+    return m_maxQueue && m_depth.load(std::memory_order_relaxed) >= m_maxQueue;
+}
+
+
+AdmissionControl::Snapshot
+AdmissionControl::snapshot() const
+{
+    Snapshot s;
+    s.depth = m_depth.load();
+    s.maxQueue = m_maxQueue;
+    s.admitted = m_admitted.load();
+    s.shed = m_shed.load();
+    s.limited = m_limited.load();
+    s.queueNanos = m_queueNanos.load();
+    s.queueMaxNanos = m_queueMaxNanos.load();
+    return s;
+}
+
+
+std::string
+AdmissionControl::statusJson() const
+{
+    Snapshot s = snapshot();
+    double meanMicros = s.admitted ? s.queueNanos / 1000.0 / s.admitted : 0.0;
+
+    std::stringstream ss;
+    ss << "{\"status\":\"" << (saturated() ? "saturated" : "ok") << "\""
+       << ",\"queue_depth\":" << s.depth
+       << ",\"max_queue\":" << s.maxQueue
+       << ",\"admitted\":" << s.admitted
+       << ",\"shed\":" << s.shed
+       << ",\"rate_limited\":" << s.limited
+       << ",\"queue_time_us\":{\"mean\":" << meanMicros
+       << ",\"max\":" << s.queueMaxNanos / 1000.0 << "}}"
+       << std::endl;
+    return ss.str();
+}
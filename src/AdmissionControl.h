@@ -0,0 +1,120 @@
+/*
+*  AdmissionControl.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+/**
+ * Keeps the server responsive under overload, shared by all
+ * the front ends. Work waiting for a lookup thread is capped
+ * at maxQueue entries, beyond which the front ends answer
+ * 503 at once rather than letting the backlog, and with it
+ * everyone's latency, grow without bound. Each client (by
+ * address) also gets a token bucket of ratePerSec requests
+ * a second with bursts of up to burst, past which it gets
+ * 429 instead.
+ *
+ * A maxQueue or ratePerSec of 0 turns that limit off.
+ */
+class AdmissionControl {
+
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    AdmissionControl(std::size_t maxQueue, double ratePerSec, double burst);
+
+    /**
+     * Reserve room in the queue for n items of work. Returns
+     * false, and counts them as shed, if the queue is full.
+     */
+    bool tryEnqueue(std::size_t n = 1);
+
+    /**
+     * n items left the queue for a worker after waiting
+     * for the given time.
+     */
+    void dequeued(std::size_t n, Clock::duration waited);
+
+    /**
+     * Take a token from the client's bucket. Returns false,
+     * and counts the request as limited, if it is empty.
+     */
+    bool allowClient(const std::string& client);
+
+    /**
+     * Whether the queue is full, so a load balancer should
+     * send traffic elsewhere for now.
+     */
+    bool saturated() const;
+
+    /**
+     * The queue limit and the counters, as they stand.
+     */
+    struct Snapshot {
+        std::size_t depth;
+        std::size_t maxQueue;
+        uint64_t admitted;
+        uint64_t shed;
+        uint64_t limited;
+        uint64_t queueNanos;
+        uint64_t queueMaxNanos;
+    };
+
+    Snapshot snapshot() const;
+
+    /**
+     * The limits and counters, as a JSON object.
+     */
+    std::string statusJson() const;
+
+private:
+
+    struct Bucket {
+        std::string client;
+        double tokens;
+        Clock::time_point last;
+    };
+
+    // Buckets are sharded by client to keep lock
+    // contention down. Each shard keeps its buckets in
+    // order of use, most recent first, so the idle ones
+    // are always found at the back.
+    struct Shard {
+        std::mutex mutex;
+        std::list<Bucket> buckets;
+        std::unordered_map<std::string, std::list<Bucket>::iterator> index;
+    };
+
+    static const std::size_t kShards = 16;
+
+    void prune(Shard& shard, Clock::time_point now);
+
+    // Members
+    const std::size_t m_maxQueue;
+    const double m_rate;
+    const double m_burst;
+    const Clock::duration m_refill;     // time for an empty bucket to fill
+    Shard m_shards[kShards];
+
+    std::atomic<std::size_t> m_depth;
+    std::atomic<uint64_t> m_admitted;
+    std::atomic<uint64_t> m_shed;
+    std::atomic<uint64_t> m_limited;
+    std::atomic<uint64_t> m_queueNanos;
+    std::atomic<uint64_t> m_queueMaxNanos;
+
+};
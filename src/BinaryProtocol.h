@@ -0,0 +1,84 @@
+/*
+*  BinaryProtocol.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Wire format of the binary lookup protocol, shared by the
+ * BinaryServer and the LookupClient library.
+ *
+ * Every message, in either direction, is a 16 byte header
+ * followed by 'length' bytes of body. Clients may send any
+ * number of requests without waiting (pipelining); responses
+ * come back on the same connection in request order, each
+ * carrying the requestId of the request it answers.
+ *
+ * Request bodies:
+ *
+ *   BINARY_LOOKUP_IDS, BINARY_LOOKUP_STRINGS
+ *     count pairs of doubles, x then y
+ *   BINARY_VALUES
+ *     empty, count is 0
+ *
+ * Response bodies, when status is BINARY_OK:
+ *
+ *   BINARY_LOOKUP_IDS
+ *     for each of the count points, a uint32 number of
+ *     hits, then that many uint32 value ids
+ *   BINARY_LOOKUP_STRINGS
+ *     for each of the count points, a uint32 number of
+ *     hits, then for each hit a uint32 length and the bytes
+ *   BINARY_VALUES
+ *     for each of the count value ids in order, a uint32
+ *     length and the bytes
+ *
+ * Value ids are only meaningful for the dataset the server
+ * has loaded, so clients that want ids should fetch the
+ * BINARY_VALUES table once per connection.
+ *
+ * All numbers are little-endian, which is to say native
+ * byte order on every platform we run on.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The binary lookup protocol assumes a little-endian host"
+#endif
+
+enum BinaryMessageType : uint8_t {
+    BINARY_LOOKUP_IDS = 1,
+    BINARY_LOOKUP_STRINGS = 2,
+    BINARY_VALUES = 3
+};
+
+enum BinaryStatus : uint8_t {
+    BINARY_OK = 0,
+    BINARY_BAD_REQUEST = 1
+};
+
+struct BinaryHeader {
+    uint32_t length;     // bytes of body after this header
+    uint8_t type;        // a BinaryMessageType
+    uint8_t status;      // a BinaryStatus, 0 in requests
+    uint16_t reserved;   // 0
+    uint32_t requestId;  // chosen by the client, echoed back
+    uint32_t count;      // points in a request, results in a response
+};
+
+static_assert(sizeof(BinaryHeader) == 16, "BinaryHeader must be 16 bytes");
+
+// Largest batch of points in one request
+static const uint32_t kBinaryMaxPoints = 1 << 16;
+
+// Size of the body of a lookup request for count points
+inline std::size_t
+binary_request_length(uint32_t count)
+{
+    return static_cast<std::size_t>(count) * 2 * sizeof(double);
+}
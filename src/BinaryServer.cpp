@@ -0,0 +1,491 @@
+/*
+*  BinaryServer.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// App headers
+#include "BinaryServer.h"
+#include "Numa.h"
+#include "Sockets.h"
+
+
+/*************************************************************************
+ * Helpers
+ */
+
+// Epoll user data for the descriptors that are not connections
+static const uint64_t kListenTag = 0;
+static const uint64_t kWakeTag = 1;
+static const uint64_t kFirstConnId = 2;
+
+// Stop answering a connection's requests while this much output
+// is waiting for it to read, and drop it if it sends this much
+// without reading
+static const std::size_t kMaxPendingOutput = 4 << 20;
+static const std::size_t kMaxPendingInput = 8 << 20;
+
+static const int kMaxEvents = 256;
+
+static void
+append_u32(std::string& out, uint32_t v)
+{
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+
+/*************************************************************************
+ * BinaryServer::IoLoop
+ */
+
+class BinaryServer::IoLoop {
+
+public:
+
+    IoLoop(BinaryServer& server, int listenFd);
+    ~IoLoop();
+
+    bool ok() const { return m_epollFd >= 0 && m_wakeFd >= 0; }
+    void run();
+    void wake();
+
+private:
+
+    struct Connection {
+        int fd;
+        std::string in;
+        std::size_t inPos = 0;
+        std::string out;
+        std::size_t outPos = 0;
+        bool closing = false;   // close once the output drains
+    };
+
+    // Members
+    BinaryServer& m_server;
+    int m_listenFd;
+    int m_epollFd;
+    int m_wakeFd;
+    uint64_t m_nextId;
+    std::unordered_map<uint64_t, Connection> m_conns;
+    std::vector<uint32_t> m_ids;  // scratch for lookupIds
+
+    // Methods
+    void acceptAll();
+    bool readInput(Connection& c);
+    std::size_t processInput(Connection& c);
+    void answer(const BinaryHeader& req, const char* body, std::string& out);
+    bool flush(Connection& c);
+    void close(uint64_t id);
+
+};
+
+
+BinaryServer::IoLoop::IoLoop(BinaryServer& server, int listenFd)
+    : m_server(server)
+    , m_listenFd(listenFd)
+    , m_epollFd(epoll_create1(EPOLL_CLOEXEC))
+    , m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    , m_nextId(kFirstConnId)
+{
+    if (!ok())
+        return;
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.u64 = kListenTag;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_listenFd, &ev);
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = kWakeTag;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev);
+}
+
+
+BinaryServer::IoLoop::~IoLoop()
+{
+    for (auto& kv : m_conns)
+        ::close(kv.second.fd);
+    if (m_wakeFd >= 0)
+        ::close(m_wakeFd);
+    if (m_epollFd >= 0)
+        ::close(m_epollFd);
+}
+
+
+void
+BinaryServer::IoLoop::wake()
+{
+    uint64_t one = 1;
+    ssize_t rv = write(m_wakeFd, &one, sizeof(one));
+    (void)rv;
+}
+
+
+void
+BinaryServer::IoLoop::run()
+{
+    // Lookups run on the I/O threads here
+    numa_pin_worker();
+    epoll_event events[kMaxEvents];
+
+    while (m_server.m_running) {
+        int n = epoll_wait(m_epollFd, events, kMaxEvents, -1);
+        if (n < 0 && errno != EINTR) {
+            std::cerr << "spatial_lookup: epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            uint32_t flags = events[i].events;
+
+            if (tag == kListenTag) {
+                acceptAll();
+                continue;
+            }
+            if (tag == kWakeTag)
+                continue;
+
+            auto it = m_conns.find(tag);
+            if (it == m_conns.end())
+                continue;
+            Connection& c = it->second;
+
+            if (flags & (EPOLLERR | EPOLLHUP)) {
+                close(tag);
+                continue;
+            }
+            if ((flags & (EPOLLIN | EPOLLRDHUP)) && !readInput(c)) {
+                close(tag);
+                continue;
+            }
+            // Answer what we can, which may be limited by the
+            // output we already have queued for this client.
+            // If the output drains completely, go round again.
+            for (;;) {
+                std::size_t answered = processInput(c);
+                if (!flush(c) || (c.closing && c.out.empty())) {
+                    close(tag);
+                    break;
+                }
+                if (!answered || !c.out.empty())
+                    break;
+            }
+        }
+    }
+}
+
+
+void
+BinaryServer::IoLoop::acceptAll()
+{
+    for (;;) {
+        int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        uint64_t id = m_nextId++;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = id;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            ::close(fd);
+            continue;
+        }
+        m_conns[id].fd = fd;
+    }
+}
+
+
+/**
+ * Read until the socket is drained. Returns false when the
+ * connection is finished, or the client is flooding us.
+ */
+bool
+BinaryServer::IoLoop::readInput(Connection& c)
+{
+    char buf[65536];
+    for (;;) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c.in.append(buf, static_cast<std::size_t>(n));
+            if (c.in.size() - c.inPos > kMaxPendingInput)
+                return false;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        return false;
+    }
+}
+
+
+/**
+ * Answer every complete request in the input buffer, in order,
+ * appending the responses to the output buffer. Returns the
+ * number of requests answered.
+ */
+std::size_t
+BinaryServer::IoLoop::processInput(Connection& c)
+{
+    const std::size_t maxBody = binary_request_length(kBinaryMaxPoints);
+    std::size_t answered = 0;
+
+    while (!c.closing && c.out.size() - c.outPos < kMaxPendingOutput) {
+        std::size_t avail = c.in.size() - c.inPos;
+        if (avail < sizeof(BinaryHeader))
+            break;
+
+        BinaryHeader req;
+        memcpy(&req, c.in.data() + c.inPos, sizeof(req));
+        if (req.length > maxBody) {
+            // Can't resynchronise after a bogus length, so
+            // answer once and hang up
+            BinaryHeader res = req;
+            res.length = 0;
+            res.status = BINARY_BAD_REQUEST;
+            res.count = 0;
+            c.out.append(reinterpret_cast<const char*>(&res), sizeof(res));
+            c.inPos = c.in.size();
+            c.closing = true;
+            break;
+        }
+        if (avail < sizeof(req) + req.length)
+            break;
+
+        answer(req, c.in.data() + c.inPos + sizeof(req), c.out);
+        c.inPos += sizeof(req) + req.length;
+        answered++;
+    }
+
+    // Drop consumed input, without shuffling the buffer
+    // on every request
+    if (c.inPos == c.in.size()) {
+        c.in.clear();
+        c.inPos = 0;
+    }
+    else if (c.inPos > 65536) {
+        c.in.erase(0, c.inPos);
+        c.inPos = 0;
+    }
+    return answered;
+}
+
+
+void
+BinaryServer::IoLoop::answer(const BinaryHeader& req, const char* body, std::string& out)
+{
+    const SpatialLookup& splu = m_server.m_splu;
+    Metrics* metrics = m_server.m_metrics;
+
+    BinaryHeader res;
+    memset(&res, 0, sizeof(res));
+    res.type = req.type;
+    res.requestId = req.requestId;
+
+    // Header goes in first and is filled in once
+    // we know how long the body is
+    std::size_t headerPos = out.size();
+    out.append(sizeof(res), '\0');
+
+    bool isLookup = req.type == BINARY_LOOKUP_IDS || req.type == BINARY_LOOKUP_STRINGS;
+    if (isLookup && req.count <= kBinaryMaxPoints &&
+        req.length == binary_request_length(req.count)) {
+        for (uint32_t i = 0; i < req.count; i++) {
+            double xy[2];
+            memcpy(xy, body + i * sizeof(xy), sizeof(xy));
+
+            m_ids.clear();
+            Coordinate coord(xy[0], xy[1]);
+            if (metrics) {
+                LookupStats stats;
+                stats.profile = metrics->featureProfile();
+                Metrics::Clock::time_point start = Metrics::Clock::now();
+                splu.lookupIds(coord, m_ids, &stats);
+                metrics->recordLookup(coord, Metrics::nanosSince(start), stats);
+            }
+            else {
+                splu.lookupIds(coord, m_ids);
+            }
+            append_u32(out, static_cast<uint32_t>(m_ids.size()));
+            if (req.type == BINARY_LOOKUP_IDS) {
+                out.append(reinterpret_cast<const char*>(m_ids.data()),
+                           m_ids.size() * sizeof(uint32_t));
+            }
+            else {
+                for (uint32_t id : m_ids) {
+                    const std::string& v = splu.value(id);
+                    append_u32(out, static_cast<uint32_t>(v.size()));
+                    out += v;
+                }
+            }
+        }
+        res.count = req.count;
+    }
+    else if (req.type == BINARY_VALUES && req.length == 0) {
+        std::size_t n = splu.numValues();
+        for (std::size_t i = 0; i < n; i++) {
+            const std::string& v = splu.value(static_cast<uint32_t>(i));
+            append_u32(out, static_cast<uint32_t>(v.size()));
+            out += v;
+        }
+        res.count = static_cast<uint32_t>(n);
+    }
+    else {
+        out.resize(headerPos + sizeof(res));
+        res.status = BINARY_BAD_REQUEST;
+    }
+
+    res.length = static_cast<uint32_t>(out.size() - headerPos - sizeof(res));
+    memcpy(&out[headerPos], &res, sizeof(res));
+}
+
+
+bool
+BinaryServer::IoLoop::flush(Connection& c)
+{
+    while (c.outPos < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.outPos,
+                         c.out.size() - c.outPos, MSG_NOSIGNAL);
+        if (n > 0) {
+            c.outPos += static_cast<std::size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        return false;
+    }
+    c.out.clear();
+    c.outPos = 0;
+    return true;
+}
+
+
+void
+BinaryServer::IoLoop::close(uint64_t id)
+{
+    auto it = m_conns.find(id);
+    if (it == m_conns.end())
+        return;
+    ::close(it->second.fd);
+    m_conns.erase(it);
+}
+
+
+/*************************************************************************
+ * BinaryServer
+ */
+
+BinaryServer::BinaryServer(const SpatialLookup& splu, std::size_t ioThreads)
+    : m_splu(splu)
+    , m_numIo(ioThreads ? ioThreads : 1)
+    , m_metrics(nullptr)
+    , m_listenFd(-1)
+    , m_running(false)
+{}
+
+
+BinaryServer::~BinaryServer()
+{
+    stop();
+    if (m_listenFd >= 0)
+        ::close(m_listenFd);
+    if (!m_unixPath.empty())
+        unlink_unix(m_unixPath);
+}
+
+
+bool
+BinaryServer::listen(const std::string& host, unsigned int port)
+{
+    return bind(host, port) && start() && serve();
+}
+
+
+bool
+BinaryServer::bind(const std::string& host, unsigned int port)
+{
+    m_listenFd = listen_tcp(host, port, false);
+    if (m_listenFd < 0) {
+        std::cerr << "spatial_lookup: unable to bind " << host << ":" << port << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool
+BinaryServer::bindUnix(const std::string& path)
+{
+    std::string errmsg;
+    m_listenFd = listen_unix(path, errmsg);
+    if (m_listenFd < 0) {
+        std::cerr << "spatial_lookup: " << errmsg << std::endl;
+        return false;
+    }
+    m_unixPath = path;
+    return true;
+}
+
+
+bool
+BinaryServer::start()
+{
+    for (std::size_t i = 0; i < m_numIo; i++) {
+        m_loops.emplace_back(new IoLoop(*this, m_listenFd));
+        if (!m_loops.back()->ok()) {
+            std::cerr << "spatial_lookup: unable to create epoll loop" << std::endl;
+            m_loops.clear();
+            return false;
+        }
+    }
+    m_running = true;
+    return true;
+}
+
+
+bool
+BinaryServer::serve()
+{
+    // The loops stay until we are destroyed, so a stop() from
+    // another thread always has them to wake
+    std::vector<std::thread> threads;
+    for (auto& loop : m_loops)
+        threads.emplace_back(&IoLoop::run, loop.get());
+    for (auto& t : threads)
+        t.join();
+    return !m_loops.empty();
+}
+
+
+void
+BinaryServer::stop()
+{
+    if (!m_running.exchange(false))
+        return;
+    for (auto& loop : m_loops)
+        loop->wake();
+}
@@ -0,0 +1,90 @@
+/*
+*  BinaryServer.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// App headers
+#include "SpatialLookup.h"
+#include "BinaryProtocol.h"
+#include "Metrics.h"
+
+
+/**
+ * Serves the length-prefixed binary lookup protocol described
+ * in BinaryProtocol.h, for internal clients that don't want to
+ * pay for HTTP and JSON on every lookup.
+ *
+ * Each I/O thread runs an edge-triggered epoll loop. Since a
+ * lookup costs far less than handing it to another thread,
+ * requests are answered inline: every complete request in a
+ * connection's read buffer is run in order and the responses
+ * go out together.
+ */
+class BinaryServer {
+
+public:
+
+    BinaryServer(const SpatialLookup& splu, std::size_t ioThreads);
+
+    ~BinaryServer();
+
+    /**
+     * Record every lookup in metrics.
+     */
+    void setMetrics(Metrics* metrics) { m_metrics = metrics; }
+
+    /**
+     * Bind to the host and port, and serve requests until
+     * stop() is called. Returns false if the address could
+     * not be bound.
+     */
+    bool listen(const std::string& host, unsigned int port);
+
+    /**
+     * The parts of listen(), so that a caller can bind the
+     * address and set up the I/O loops before handing serve()
+     * to a thread. After start(), stop() from any thread ends
+     * serve(), even one that hasn't begun yet.
+     */
+    bool bind(const std::string& host, unsigned int port);
+    bool start();
+    bool serve();
+
+    /**
+     * Bind to a Unix domain socket at path instead, for
+     * clients on the same host. Follow with start() and
+     * serve().
+     */
+    bool bindUnix(const std::string& path);
+
+    /**
+     * Ask the I/O threads to finish, which in turn causes
+     * listen() to return.
+     */
+    void stop();
+
+private:
+
+    class IoLoop;
+
+    // Members
+    const SpatialLookup& m_splu;
+    const std::size_t m_numIo;
+    Metrics* m_metrics;
+    int m_listenFd;
+    std::string m_unixPath;
+    std::atomic<bool> m_running;
+    std::vector<std::unique_ptr<IoLoop>> m_loops;
+
+};
@@ -0,0 +1,115 @@
+/*
+*  BoundedQueue.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+/**
+ * A fixed size lock-free ring for any number of threads to
+ * push into and one to pop from (after Dmitry Vyukov's bounded
+ * queue). Pushing never waits: when the ring is full it fails,
+ * and the caller decides what to do with what didn't fit.
+ */
+template<typename T>
+class BoundedQueue {
+
+public:
+
+    /**
+     * Room for capacity items, rounded up to a power of two.
+     */
+    explicit BoundedQueue(std::size_t capacity)
+        : m_mask(round_up_pow2(capacity ? capacity : 1) - 1)
+        , m_slots(new Slot[m_mask + 1])
+        , m_head(0)
+        , m_tail(0)
+    {
+        for (std::size_t i = 0; i <= m_mask; i++)
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+     * Add an item, or return false if the ring is full.
+     */
+    bool
+    push(const T& item)
+    {
+        // Claim the slot at the head, if the reader has finished
+        // with it, then fill it and hand it over
+        uint64_t pos = m_head.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &m_slots[pos & m_mask];
+            uint64_t seq = slot->seq.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = item;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Take the item at the tail, if it has been filled in.
+     * Only ever called from the one reading thread.
+     */
+    bool
+    pop(T& item)
+    {
+        Slot& slot = m_slots[m_tail & m_mask];
+        if (slot.seq.load(std::memory_order_acquire) != m_tail + 1)
+            return false;
+        item = slot.item;
+        slot.seq.store(m_tail + m_mask + 1, std::memory_order_release);
+        m_tail++;
+        return true;
+    }
+
+private:
+
+    // A ring slot, with a sequence number saying whether it is
+    // free for the writer at some position, or full and ready
+    // for the reader
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        T item;
+    };
+
+    static std::size_t
+    round_up_pow2(std::size_t n)
+    {
+        std::size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+    // Members
+    const std::size_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<uint64_t> m_head;   // next position to fill
+    uint64_t m_tail;                // next position to read, reading thread only
+
+};
@@ -0,0 +1,249 @@
+/*
+*  Compression.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+#ifdef SPATIAL_LOOKUP_ZLIB
+#include <zlib.h>
+#endif
+#ifdef SPATIAL_LOOKUP_ZSTD
+#include <zstd.h>
+#endif
+
+// App headers
+#include "Compression.h"
+
+// Output is grown by this much at a time
+static const std::size_t kChunkSize = 16384;
+
+
+/*************************************************************************
+ * Negotiation
+ */
+
+static bool
+token_is(const char* b, const char* e, const char* s)
+{
+    std::size_t n = strlen(s);
+    return static_cast<std::size_t>(e - b) == n && strncasecmp(b, s, n) == 0;
+}
+
+static bool
+is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+
+ContentEncoding
+negotiate_encoding(const char* begin, const char* end)
+{
+    // A coding named in the list is settled by its own entry;
+    // "*" only speaks for the codings left unnamed
+    bool gzip = false, gzipListed = false;
+    bool zstd = false, zstdListed = false;
+    bool any = false;
+
+    // A list of "coding;q=value", comma separated
+    const char* p = begin;
+    while (p < end) {
+        const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+        const char* item = p;
+        const char* itemEnd = comma ? comma : end;
+        p = itemEnd + 1;
+
+        const char* semi = static_cast<const char*>(memchr(item, ';', itemEnd - item));
+        const char* name = item;
+        const char* nameEnd = semi ? semi : itemEnd;
+        while (name < nameEnd && is_space(*name))
+            name++;
+        while (nameEnd > name && is_space(nameEnd[-1]))
+            nameEnd--;
+
+        // Anything but an explicit q=0 is acceptance
+        bool accepted = true;
+        if (semi) {
+            const char* q = semi + 1;
+            while (q < itemEnd && is_space(*q))
+                q++;
+            if (itemEnd - q > 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=')
+                accepted = std::strtod(q + 2, nullptr) > 0.0;
+        }
+
+        if (token_is(name, nameEnd, "gzip") || token_is(name, nameEnd, "x-gzip")) {
+            gzip = accepted;
+            gzipListed = true;
+        }
+        else if (token_is(name, nameEnd, "zstd")) {
+            zstd = accepted;
+            zstdListed = true;
+        }
+        else if (token_is(name, nameEnd, "*"))
+            any = accepted;
+    }
+
+#ifdef SPATIAL_LOOKUP_ZSTD
+    if (zstdListed ? zstd : any)
+        return ContentEncoding::ZSTD;
+#endif
+#ifdef SPATIAL_LOOKUP_ZLIB
+    if (gzipListed ? gzip : any)
+        return ContentEncoding::GZIP;
+#endif
+    (void)gzip;
+    (void)gzipListed;
+    (void)zstd;
+    (void)zstdListed;
+    (void)any;
+    return ContentEncoding::IDENTITY;
+}
+
+
+const char*
+encoding_name(ContentEncoding encoding)
+{
+    switch (encoding) {
+    case ContentEncoding::GZIP:
+        return "gzip";
+    case ContentEncoding::ZSTD:
+        return "zstd";
+    default:
+        return nullptr;
+    }
+}
+
+
+/*************************************************************************
+ * Compressor
+ */
+
+Compressor::Compressor(ContentEncoding encoding)
+    : m_encoding(encoding)
+    , m_stream(nullptr)
+{
+#ifdef SPATIAL_LOOKUP_ZLIB
+    if (encoding == ContentEncoding::GZIP) {
+        z_stream* zs = new z_stream;
+        memset(zs, 0, sizeof(*zs));
+        // 15 bits of window, plus 16 for a gzip wrapper
+        if (deflateInit2(zs, 1, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK)
+            m_stream = zs;
+        else
+            delete zs;
+    }
+#endif
+#ifdef SPATIAL_LOOKUP_ZSTD
+    if (encoding == ContentEncoding::ZSTD) {
+        ZSTD_CCtx* cctx = ZSTD_createCCtx();
+        if (cctx) {
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, 1);
+            m_stream = cctx;
+        }
+    }
+#endif
+}
+
+
+Compressor::~Compressor()
+{
+    if (!m_stream)
+        return;
+#ifdef SPATIAL_LOOKUP_ZLIB
+    if (m_encoding == ContentEncoding::GZIP) {
+        z_stream* zs = static_cast<z_stream*>(m_stream);
+        deflateEnd(zs);
+        delete zs;
+    }
+#endif
+#ifdef SPATIAL_LOOKUP_ZSTD
+    if (m_encoding == ContentEncoding::ZSTD)
+        ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(m_stream));
+#endif
+}
+
+
+bool
+Compressor::write(const char* data, std::size_t size, std::string& out, bool flush)
+{
+    return run(data, size, out, flush ? Op::FLUSH : Op::NONE);
+}
+
+
+bool
+Compressor::finish(std::string& out)
+{
+    return run(nullptr, 0, out, Op::FINISH);
+}
+
+
+bool
+Compressor::run(const char* data, std::size_t size, std::string& out, Op op)
+{
+    if (!m_stream)
+        return false;
+
+#ifdef SPATIAL_LOOKUP_ZLIB
+    if (m_encoding == ContentEncoding::GZIP) {
+        z_stream* zs = static_cast<z_stream*>(m_stream);
+        zs->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        zs->avail_in = static_cast<uInt>(size);
+        int mode = op == Op::FINISH ? Z_FINISH : op == Op::FLUSH ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        // Deflate straight into the end of the output, until
+        // it stops filling all the space it is given
+        do {
+            std::size_t old = out.size();
+            out.resize(old + kChunkSize);
+            zs->next_out = reinterpret_cast<Bytef*>(&out[old]);
+            zs->avail_out = static_cast<uInt>(kChunkSize);
+            int rc = deflate(zs, mode);
+            out.resize(old + kChunkSize - zs->avail_out);
+            if (rc == Z_STREAM_ERROR)
+                return false;
+        } while (zs->avail_out == 0);
+        return true;
+    }
+#endif
+#ifdef SPATIAL_LOOKUP_ZSTD
+    if (m_encoding == ContentEncoding::ZSTD) {
+        ZSTD_CCtx* cctx = static_cast<ZSTD_CCtx*>(m_stream);
+        ZSTD_inBuffer in = {data, size, 0};
+        ZSTD_EndDirective mode = op == Op::FINISH ? ZSTD_e_end
+                               : op == Op::FLUSH ? ZSTD_e_flush
+                               : ZSTD_e_continue;
+        for (;;) {
+            std::size_t old = out.size();
+            out.resize(old + kChunkSize);
+            ZSTD_outBuffer ob = {&out[old], kChunkSize, 0};
+            std::size_t remaining = ZSTD_compressStream2(cctx, &ob, &in, mode);
+            out.resize(old + ob.pos);
+            if (ZSTD_isError(remaining))
+                return false;
+            // Continuing, stop once the input is taken; flushing
+            // or ending, once zstd has nothing left to write
+            if (mode == ZSTD_e_continue ? in.pos == in.size : remaining == 0)
+                break;
+        }
+        return true;
+    }
+#endif
+    (void)data;
+    (void)size;
+    (void)out;
+    (void)op;
+    return false;
+}
+
+
+bool
+compress_body(ContentEncoding encoding, const std::string& body, std::string& out)
+{
+    Compressor c(encoding);
+    return c.ok() && c.write(body.data(), body.size(), out) && c.finish(out);
+}
@@ -0,0 +1,94 @@
+/*
+*  Compression.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+#include <string>
+
+
+/**
+ * Response encodings we can produce. GZIP needs the server
+ * built with zlib (SPATIAL_LOOKUP_ZLIB) and ZSTD with libzstd
+ * (SPATIAL_LOOKUP_ZSTD); without them negotiation never
+ * picks them.
+ */
+enum class ContentEncoding {
+    IDENTITY,
+    GZIP,
+    ZSTD
+};
+
+/**
+ * Pick the best encoding that we support and the client will
+ * take, from the value of its Accept-Encoding header. zstd is
+ * preferred to gzip, and "q=0" refuses an encoding. A "*"
+ * covers only the codings the header does not name, so
+ * "gzip;q=0, *" never gets gzip.
+ */
+ContentEncoding negotiate_encoding(const char* begin, const char* end);
+
+inline ContentEncoding
+negotiate_encoding(const std::string& accept)
+{
+    return negotiate_encoding(accept.data(), accept.data() + accept.size());
+}
+
+/**
+ * The Content-Encoding header value, or nullptr for IDENTITY.
+ */
+const char* encoding_name(ContentEncoding encoding);
+
+/**
+ * An incremental compressor. Input goes in a piece at a time
+ * and compressed output is appended to a caller's buffer as it
+ * becomes available, so neither the whole input nor the whole
+ * output needs to be held at once. Uses fast compression
+ * levels, since responses are compressed on the request path.
+ */
+class Compressor {
+
+public:
+
+    explicit Compressor(ContentEncoding encoding);
+    ~Compressor();
+
+    Compressor(const Compressor&) = delete;
+    Compressor& operator=(const Compressor&) = delete;
+
+    bool ok() const { return m_stream != nullptr; }
+
+    /**
+     * Compress size bytes of data, appending any output to out.
+     * With flush set, everything written so far is pushed out,
+     * so a streaming client can decode it straight away.
+     */
+    bool write(const char* data, std::size_t size, std::string& out, bool flush = false);
+
+    /**
+     * End the stream, appending the last of the output.
+     */
+    bool finish(std::string& out);
+
+private:
+
+    enum class Op { NONE, FLUSH, FINISH };
+    bool run(const char* data, std::size_t size, std::string& out, Op op);
+
+    // Members
+    ContentEncoding m_encoding;
+    void* m_stream;
+
+};
+
+/**
+ * Compress a whole response body in one go, appending the
+ * output to out. On failure out holds a partial stream and
+ * the caller should fall back to the plain body.
+ */
+bool compress_body(ContentEncoding encoding, const std::string& body, std::string& out);
@@ -0,0 +1,1017 @@
+/*
+*  EpollServer.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// App headers
+#include "EpollServer.h"
+#include "LookupQuery.h"
+#include "Numa.h"
+#include "Sockets.h"
+
+
+/*************************************************************************
+ * Helpers
+ */
+
+// Epoll user data for the descriptors that are not connections
+static const uint64_t kListenTag = 0;
+static const uint64_t kWakeTag = 1;
+static const uint64_t kFirstConnId = 2;
+
+// Limits on what we will buffer for a single connection
+static const std::size_t kMaxHeaderBytes = 8192;
+static const std::size_t kMaxInputBytes = 1 << 20;
+
+static const int kMaxEvents = 256;
+
+// Most pipelined requests handed to the workers in one job
+static const std::size_t kMaxBatch = 64;
+
+// Most output segments given to one writev
+static const int kMaxIov = 64;
+
+/**
+ * Append the status line and headers of an HTTP/1.1 response,
+ * with a Content-Encoding if the body is compressed.
+ */
+static void
+render_head(std::string& r, int status, const char* reason,
+            std::size_t bodySize, bool keepAlive,
+            const char* encoding, const char* contentType)
+{
+    r += "HTTP/1.1 ";
+    r += std::to_string(status);
+    r += ' ';
+    r += reason;
+    r += "\r\nContent-Type: ";
+    r += contentType;
+    r += "\r\n";
+    if (encoding) {
+        r += "Content-Encoding: ";
+        r += encoding;
+        r += "\r\nVary: Accept-Encoding\r\n";
+    }
+    r += "Content-Length: ";
+    r += std::to_string(bodySize);
+    r += keepAlive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+}
+
+/**
+ * Render a complete HTTP/1.1 response, headers and body.
+ */
+static std::string
+render_response(int status, const char* reason,
+                const char* body, std::size_t bodySize, bool keepAlive,
+                const char* encoding = nullptr,
+                const char* contentType = "application/json")
+{
+    std::string r;
+    r.reserve(128 + bodySize);
+    render_head(r, status, reason, bodySize, keepAlive, encoding, contentType);
+    r.append(body, bodySize);
+    return r;
+}
+
+// Room left ahead of a compressed body for its headers
+static const std::size_t kHeadRoom = 256;
+
+/**
+ * Render a 200 response with the body compressed straight into
+ * the response buffer, behind room left for the headers, which
+ * go in once the compressed length is known. Only the plain
+ * body and the response are alive at once, never a third
+ * compressed copy. Returns false, leaving r empty, if the
+ * body could not be compressed.
+ */
+static bool
+render_compressed(std::string& r, const std::string& body, bool keepAlive,
+                  ContentEncoding encoding,
+                  const char* contentType = "application/json")
+{
+    r.assign(kHeadRoom, '\0');
+    if (!compress_body(encoding, body, r)) {
+        r.clear();
+        return false;
+    }
+    std::string head;
+    render_head(head, 200, "OK", r.size() - kHeadRoom, keepAlive,
+                encoding_name(encoding), contentType);
+    if (head.size() <= kHeadRoom) {
+        std::size_t start = kHeadRoom - head.size();
+        r.replace(start, head.size(), head);
+        r.erase(0, start);
+    }
+    else {
+        r.replace(0, kHeadRoom, head);
+    }
+    return true;
+}
+
+static std::string
+render_response(int status, const char* reason,
+                const std::string& body, bool keepAlive)
+{
+    return render_response(status, reason, body.data(), body.size(), keepAlive);
+}
+
+static std::string
+render_response(int status, const char* reason,
+                const char* body, bool keepAlive)
+{
+    return render_response(status, reason, body, std::strlen(body), keepAlive);
+}
+
+/**
+ * The reason phrase for the statuses the admin routes answer.
+ */
+static const char*
+status_reason(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        default:  return "Error";
+    }
+}
+
+/**
+ * The client's IP address as text, or "" for a Unix
+ * domain socket peer.
+ */
+static std::string
+peer_address(const sockaddr_storage& addr)
+{
+    char buf[INET6_ADDRSTRLEN] = "";
+    if (addr.ss_family == AF_INET)
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in&>(addr).sin_addr, buf, sizeof(buf));
+    else if (addr.ss_family == AF_INET6)
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6&>(addr).sin6_addr, buf, sizeof(buf));
+    return buf;
+}
+
+/**
+ * Case-insensitive comparison of a header name or value.
+ */
+static bool
+equals_nocase(const char* b, const char* e, const char* s)
+{
+    std::size_t n = std::strlen(s);
+    return static_cast<std::size_t>(e - b) == n && strncasecmp(b, s, n) == 0;
+}
+
+
+/*************************************************************************
+ * EpollServer::IoLoop
+ */
+
+/**
+ * One I/O thread: an epoll set holding a listening socket
+ * (shared, or its own under SO_REUSEPORT), an eventfd that workers use to signal completed
+ * jobs, and every connection this thread has accepted.
+ * Connections are only ever touched from this thread.
+ */
+class EpollServer::IoLoop {
+
+public:
+
+    IoLoop(EpollServer& server, int listenFd, bool shared);
+    ~IoLoop();
+
+    bool ok() const { return m_epollFd >= 0 && m_wakeFd >= 0; }
+    void run();
+    void wake();
+
+    /**
+     * Called from worker threads to return a finished job.
+     */
+    void complete(Job&& job);
+
+private:
+
+    struct Connection {
+        int fd;
+        std::string peer;               // client address, for rate limits
+        std::string in;
+        std::size_t inPos = 0;          // bytes of in already parsed
+        std::deque<std::string> out;    // one response per segment
+        std::size_t outPos = 0;         // bytes of out.front() sent
+        std::size_t served = 0;
+        bool busy = false;      // a batch is out with the workers
+        bool closing = false;   // close once the output drains
+        bool eof = false;       // the peer has finished sending
+        time_t lastActive = 0;
+    };
+
+    // Members
+    EpollServer& m_server;
+    int m_listenFd;
+    int m_epollFd;
+    int m_wakeFd;
+    int m_spareFd;          // given up to accept and drop a connection when out of fds
+    uint32_t m_listenEvents;
+    bool m_listenPaused;    // out of fds with no spare, so not listening for a moment
+    uint64_t m_nextId;
+    std::unordered_map<uint64_t, Connection> m_conns;
+    std::mutex m_doneMutex;
+    std::deque<Job> m_done;
+
+    // Methods
+    void acceptAll(time_t now);
+    void shedAccept();
+    void listenFor(bool on);
+    void readInput(uint64_t id, Connection& c);
+    void processInput(uint64_t id, Connection& c);
+    bool processBatch(uint64_t id, Connection& c);
+    std::string renderMetrics(ContentEncoding encoding, bool keepAlive);
+    bool flush(Connection& c);
+    void drainCompletions(time_t now);
+    void settle(uint64_t id, Connection& c);
+    void close(uint64_t id);
+    void sweepIdle(time_t now);
+
+};
+
+
+EpollServer::IoLoop::IoLoop(EpollServer& server, int listenFd, bool shared)
+    : m_server(server)
+    , m_listenFd(listenFd)
+    , m_epollFd(epoll_create1(EPOLL_CLOEXEC))
+    , m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    , m_spareFd(open("/dev/null", O_RDONLY | O_CLOEXEC))
+    , m_listenEvents(shared ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN)
+    , m_listenPaused(false)
+    , m_nextId(kFirstConnId)
+{
+    if (!ok())
+        return;
+
+    // When loops share a listening socket, the EPOLLEXCLUSIVE
+    // of m_listenEvents stops the kernel waking all of them for
+    // each new connection
+    listenFor(true);
+
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = kWakeTag;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev);
+}
+
+
+EpollServer::IoLoop::~IoLoop()
+{
+    for (auto& kv : m_conns)
+        ::close(kv.second.fd);
+    if (m_wakeFd >= 0)
+        ::close(m_wakeFd);
+    if (m_spareFd >= 0)
+        ::close(m_spareFd);
+    if (m_epollFd >= 0)
+        ::close(m_epollFd);
+}
+
+
+void
+EpollServer::IoLoop::wake()
+{
+    uint64_t one = 1;
+    ssize_t rv = write(m_wakeFd, &one, sizeof(one));
+    (void)rv;
+}
+
+
+void
+EpollServer::IoLoop::complete(Job&& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_doneMutex);
+        m_done.push_back(std::move(job));
+    }
+    wake();
+}
+
+
+void
+EpollServer::IoLoop::run()
+{
+    epoll_event events[kMaxEvents];
+    time_t lastSweep = time(nullptr);
+
+    while (m_server.m_running) {
+        int n = epoll_wait(m_epollFd, events, kMaxEvents, 1000);
+        if (n < 0 && errno != EINTR) {
+            std::cerr << "spatial_lookup: epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        time_t now = time(nullptr);
+
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            uint32_t flags = events[i].events;
+
+            if (tag == kListenTag) {
+                acceptAll(now);
+                continue;
+            }
+            if (tag == kWakeTag) {
+                uint64_t count;
+                while (read(m_wakeFd, &count, sizeof(count)) > 0) {}
+                drainCompletions(now);
+                continue;
+            }
+
+            auto it = m_conns.find(tag);
+            if (it == m_conns.end())
+                continue;
+            Connection& c = it->second;
+
+            if (flags & (EPOLLERR | EPOLLHUP)) {
+                close(tag);
+                continue;
+            }
+            c.lastActive = now;
+            if (flags & (EPOLLIN | EPOLLRDHUP))
+                readInput(tag, c);
+            else if (flags & EPOLLOUT)
+                settle(tag, c);
+        }
+
+        if (now - lastSweep >= 1) {
+            sweepIdle(now);
+            if (m_listenPaused)
+                listenFor(true);
+            lastSweep = now;
+        }
+    }
+}
+
+
+void
+EpollServer::IoLoop::acceptAll(time_t now)
+{
+    for (;;) {
+        sockaddr_storage addr;
+        socklen_t addrLen = sizeof(addr);
+        int fd = accept4(m_listenFd, reinterpret_cast<sockaddr*>(&addr), &addrLen,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Out of descriptors, the listening socket stays
+            // readable, and being level triggered would wake us
+            // straight back up, so take the waiting connection
+            // off it one way or another
+            if (errno == EMFILE || errno == ENFILE)
+                shedAccept();
+            return;
+        }
+
+        // Responses are small single writes, don't let Nagle hold them
+        if (m_server.m_tcpNoDelay) {
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        }
+
+        uint64_t id = m_nextId++;
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = id;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            ::close(fd);
+            continue;
+        }
+        Connection& c = m_conns[id];
+        c.fd = fd;
+        c.lastActive = now;
+        if (m_server.m_admission)
+            c.peer = peer_address(addr);
+    }
+}
+
+
+/**
+ * Out of descriptors: give up the spare one to accept the
+ * next connection and close it straight away, so the client
+ * sees a reset rather than hang in the backlog. Without a
+ * spare, stop listening until the next idle sweep.
+ */
+void
+EpollServer::IoLoop::shedAccept()
+{
+    if (m_spareFd >= 0) {
+        ::close(m_spareFd);
+        int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0)
+            ::close(fd);
+        m_spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    if (m_spareFd < 0)
+        listenFor(false);
+}
+
+
+void
+EpollServer::IoLoop::listenFor(bool on)
+{
+    epoll_event ev;
+    ev.events = m_listenEvents;
+    ev.data.u64 = kListenTag;
+    epoll_ctl(m_epollFd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, m_listenFd, &ev);
+    m_listenPaused = !on;
+}
+
+
+void
+EpollServer::IoLoop::readInput(uint64_t id, Connection& c)
+{
+    // Edge triggered, so read until the socket is drained
+    char buf[16384];
+    for (;;) {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c.in.append(buf, static_cast<std::size_t>(n));
+            if (c.in.size() > kMaxInputBytes) {
+                close(id);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n == 0) {
+            // The peer has shut down its side, but may still
+            // be waiting on answers to what it already sent
+            c.eof = true;
+            break;
+        }
+        close(id);
+        return;
+    }
+    processInput(id, c);
+    settle(id, c);
+}
+
+
+/**
+ * Work through the input buffer a batch at a time. Requests
+ * are parsed in place, and the buffer only compacted once at
+ * the end, so a deep pipeline isn't copied down once for
+ * every request taken off the front of it.
+ */
+void
+EpollServer::IoLoop::processInput(uint64_t id, Connection& c)
+{
+    // A full batch answered here may have left complete
+    // requests behind, with no more input coming to prompt
+    // another look at them
+    while (processBatch(id, c))
+        ;
+    c.in.erase(0, c.inPos);
+    c.inPos = 0;
+}
+
+
+/**
+ * Parse as many complete requests as we can from the input
+ * buffer, and send them to the workers as one batch. Errors
+ * are answered from this thread, but still travel with the
+ * batch when it has lookups in it, so that responses always
+ * go out in request order. Only one batch per connection is
+ * in flight at a time. Returns true if the batch was full
+ * and answered here, so there may be more to do.
+ */
+bool
+EpollServer::IoLoop::processBatch(uint64_t id, Connection& c)
+{
+    if (c.busy || c.closing)
+        return false;
+
+    Job job;
+    job.loop = this;
+    job.connId = id;
+    job.lookups = 0;
+    AdmissionControl* admission = m_server.m_admission;
+    Metrics* metrics = m_server.m_metrics;
+    auto count = [metrics](Metrics::Route route, int status) {
+        if (metrics)
+            metrics->countRequest(route, status);
+    };
+
+    while (!c.closing && job.requests.size() < kMaxBatch) {
+        uint64_t parseStart = cycle_count();
+        std::size_t headerEnd = c.in.find("\r\n\r\n", c.inPos);
+        if (headerEnd == std::string::npos) {
+            if (c.in.size() - c.inPos > kMaxHeaderBytes) {
+                job.requests.push_back({0.0, 0.0, false, ContentEncoding::IDENTITY,
+                    render_response(431, "Request Header Fields Too Large", "", false)});
+                count(Metrics::Route::OTHER, 431);
+                c.closing = true;
+            }
+            break;
+        }
+
+        // Request line: method, target, version
+        const char* p = c.in.data() + c.inPos;
+        const char* eol = c.in.data() + c.in.find("\r\n", c.inPos);
+        const char* sp1 = static_cast<const char*>(memchr(p, ' ', eol - p));
+        const char* sp2 = sp1 ? static_cast<const char*>(memchr(sp1 + 1, ' ', eol - sp1 - 1)) : nullptr;
+        if (!sp1 || !sp2) {
+            job.requests.push_back({0.0, 0.0, false, ContentEncoding::IDENTITY,
+                render_response(400, "Bad Request", "", false)});
+            count(Metrics::Route::OTHER, 400);
+            c.closing = true;
+            break;
+        }
+        const char* target = sp1 + 1;
+        const char* targetEnd = sp2;
+        const char* q = static_cast<const char*>(memchr(target, '?', targetEnd - target));
+        Metrics::Route route = Metrics::route(target, q ? q : targetEnd);
+        bool isGet = equals_nocase(p, sp1, "GET");
+        bool isPost = equals_nocase(p, sp1, "POST");
+        bool keepAlive = equals_nocase(sp2 + 1, eol, "HTTP/1.1");
+
+        // Headers: we only care about connection handling,
+        // compression, and whether there is a body to skip over
+        std::size_t contentLength = 0;
+        bool haveLength = false;
+        bool badLength = false;
+        bool haveTransferEncoding = false;
+        ContentEncoding encoding = ContentEncoding::IDENTITY;
+        const char* hend = c.in.data() + headerEnd + 2;
+        for (const char* line = eol + 2; line < hend; ) {
+            const char* lend = static_cast<const char*>(memchr(line, '\r', hend - line));
+            const char* colon = static_cast<const char*>(memchr(line, ':', lend - line));
+            if (colon) {
+                const char* v = colon + 1;
+                while (v < lend && (*v == ' ' || *v == '\t'))
+                    v++;
+                if (equals_nocase(line, colon, "Connection")) {
+                    if (equals_nocase(v, lend, "close"))
+                        keepAlive = false;
+                    else if (equals_nocase(v, lend, "keep-alive"))
+                        keepAlive = true;
+                }
+                else if (equals_nocase(line, colon, "Content-Length")) {
+                    // A repeat is only allowed to say the same again
+                    std::size_t length;
+                    if (!parse_content_length(v, lend, kMaxInputBytes, length) ||
+                        (haveLength && length != contentLength))
+                        badLength = true;
+                    contentLength = length;
+                    haveLength = true;
+                }
+                else if (equals_nocase(line, colon, "Transfer-Encoding")) {
+                    haveTransferEncoding = true;
+                }
+                else if (m_server.m_compress && equals_nocase(line, colon, "Accept-Encoding")) {
+                    encoding = negotiate_encoding(v, lend);
+                }
+            }
+            line = lend + 2;
+        }
+
+        // Without a length we can trust, there's no telling
+        // where the next request starts. Chunked bodies aren't
+        // read at all, so any Transfer-Encoding ends the
+        // connection too, rather than have its chunks taken
+        // for the next request; with a Content-Length as well,
+        // the request is ambiguous, and malformed.
+        if (badLength || (haveTransferEncoding && haveLength)) {
+            job.requests.push_back({0.0, 0.0, false, ContentEncoding::IDENTITY,
+                render_response(400, "Bad Request", "", false)});
+            count(route, 400);
+            c.closing = true;
+            break;
+        }
+        if (haveTransferEncoding) {
+            job.requests.push_back({0.0, 0.0, false, ContentEncoding::IDENTITY,
+                render_response(501, "Not Implemented", "", false)});
+            count(route, 501);
+            c.closing = true;
+            break;
+        }
+        std::size_t end = headerEnd + 4 + contentLength;
+        if (end - c.inPos > kMaxInputBytes) {
+            job.requests.push_back({0.0, 0.0, false, ContentEncoding::IDENTITY,
+                render_response(413, "Payload Too Large", "", false)});
+            count(route, 413);
+            c.closing = true;
+            break;
+        }
+        if (c.in.size() < end)
+            break;
+
+        // Routing. The request line is read in place, and
+        // stays put until processInput() compacts the buffer.
+        bool isLookup = route == Metrics::Route::LOOKUP;
+        Admin* admin = m_server.m_admin;
+        bool isAdmin = route == Metrics::Route::ADMIN && admin && (isGet || isPost);
+        Request req;
+        req.x = 0.0;
+        req.y = 0.0;
+        LookupQueryStatus qs = isLookup
+            ? parse_lookup_query(target, targetEnd, req.x, req.y)
+            : LookupQueryStatus::MISSING;
+        req.debug = isLookup && query_switch(target, targetEnd, "debug") == 1;
+        std::string adminBody;
+        int adminStatus = isAdmin ? admin->handle(isPost, target, targetEnd, adminBody) : 0;
+        req.parseTicks = cycle_count() - parseStart;
+        c.inPos = end;
+        if (++c.served >= m_server.m_keepAliveMax)
+            keepAlive = false;
+        req.keepAlive = keepAlive;
+        req.encoding = encoding;
+
+        if (isAdmin) {
+            req.response = render_response(adminStatus, status_reason(adminStatus), adminBody, keepAlive);
+            count(route, adminStatus);
+        }
+        else if (!isGet) {
+            req.response = render_response(405, "Method Not Allowed", "", keepAlive);
+            count(route, 405);
+        }
+        else if (route == Metrics::Route::HEALTH) {
+            std::string status = admission ? admission->statusJson() : "{\"status\":\"ok\"}\n";
+            bool saturated = admission && admission->saturated();
+            req.response = saturated
+                ? render_response(503, "Service Unavailable", status, keepAlive)
+                : render_response(200, "OK", status, keepAlive);
+            count(route, saturated ? 503 : 200);
+        }
+        else if (route == Metrics::Route::METRICS && metrics) {
+            req.response = renderMetrics(encoding, keepAlive);
+            count(route, 200);
+        }
+        else if (!isLookup) {
+            req.response = render_response(404, "Not Found", "", keepAlive);
+            count(route, 404);
+        }
+        else if (qs != LookupQueryStatus::OK) {
+            req.response = render_response(400, "Bad Request", lookup_query_error(qs), keepAlive);
+            count(route, 400);
+        }
+        else if (admission && !admission->allowClient(c.peer)) {
+            req.response = render_response(429, "Too Many Requests",
+                                           "{\"error\":\"too many requests\"}\n", keepAlive);
+            count(route, 429);
+        }
+        else {
+            job.lookups++;
+        }
+        job.requests.push_back(std::move(req));
+
+        if (!keepAlive)
+            c.closing = true;
+    }
+
+    // With the worker queue full, answer the lookups 503 here
+    // and now rather than add to the wait
+    if (job.lookups && admission && !admission->tryEnqueue(job.lookups)) {
+        for (auto& req : job.requests) {
+            if (req.response.empty()) {
+                req.response = render_response(503, "Service Unavailable",
+                                               "{\"error\":\"server is overloaded\"}\n", req.keepAlive);
+                count(Metrics::Route::LOOKUP, 503);
+            }
+        }
+        job.lookups = 0;
+    }
+    if (job.lookups) {
+        job.queued = AdmissionControl::Clock::now();
+        c.busy = true;
+        m_server.dispatch(std::move(job));
+        return false;
+    }
+    for (auto& req : job.requests)
+        c.out.push_back(std::move(req.response));
+    return job.requests.size() == kMaxBatch;
+}
+
+
+/**
+ * The /metrics page. Scrapes are rare enough to answer
+ * here on the I/O thread, compression and all.
+ */
+std::string
+EpollServer::IoLoop::renderMetrics(ContentEncoding encoding, bool keepAlive)
+{
+    static const char* kContentType = "text/plain; version=0.0.4";
+    std::string body = m_server.m_metrics->exposition(m_server.m_splu, m_server.m_admission);
+    std::string r;
+    if (encoding != ContentEncoding::IDENTITY && body.size() >= m_server.m_compressMin &&
+        render_compressed(r, body, keepAlive, encoding, kContentType)) {
+        return r;
+    }
+    return render_response(200, "OK", body.data(), body.size(), keepAlive, nullptr, kContentType);
+}
+
+
+/**
+ * Write as much pending output as the socket will take,
+ * gathering queued responses into as few writev calls as
+ * possible. Returns false if the connection has failed.
+ */
+bool
+EpollServer::IoLoop::flush(Connection& c)
+{
+    iovec iov[kMaxIov];
+    while (!c.out.empty()) {
+        int n = 0;
+        for (auto it = c.out.begin(); it != c.out.end() && n < kMaxIov; ++it, ++n) {
+            std::size_t skip = n ? 0 : c.outPos;
+            iov[n].iov_base = const_cast<char*>(it->data() + skip);
+            iov[n].iov_len = it->size() - skip;
+        }
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+        ssize_t sent = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (sent <= 0)
+            return false;
+
+        // Drop the responses that went out in full
+        std::size_t left = static_cast<std::size_t>(sent);
+        while (left && left >= c.out.front().size() - c.outPos) {
+            left -= c.out.front().size() - c.outPos;
+            c.out.pop_front();
+            c.outPos = 0;
+        }
+        c.outPos += left;
+    }
+    return true;
+}
+
+
+/**
+ * Push out any pending output, and close the connection
+ * if it is finished with. Once the peer has stopped sending,
+ * that is as soon as everything it asked for has been sent.
+ */
+void
+EpollServer::IoLoop::settle(uint64_t id, Connection& c)
+{
+    if (!flush(c)) {
+        close(id);
+        return;
+    }
+    if ((c.closing || c.eof) && !c.busy && c.out.empty())
+        close(id);
+}
+
+
+void
+EpollServer::IoLoop::drainCompletions(time_t now)
+{
+    std::deque<Job> done;
+    {
+        std::lock_guard<std::mutex> lock(m_doneMutex);
+        done.swap(m_done);
+    }
+    for (auto& job : done) {
+        // The connection may have gone away while
+        // the lookup was running
+        auto it = m_conns.find(job.connId);
+        if (it == m_conns.end())
+            continue;
+        Connection& c = it->second;
+        c.busy = false;
+        c.lastActive = now;
+        for (auto& req : job.requests)
+            c.out.push_back(std::move(req.response));
+        processInput(job.connId, c);
+        settle(job.connId, c);
+    }
+}
+
+
+void
+EpollServer::IoLoop::close(uint64_t id)
+{
+    auto it = m_conns.find(id);
+    if (it == m_conns.end())
+        return;
+    // Closing the descriptor also removes it from the epoll set
+    ::close(it->second.fd);
+    m_conns.erase(it);
+}
+
+
+void
+EpollServer::IoLoop::sweepIdle(time_t now)
+{
+    for (auto it = m_conns.begin(); it != m_conns.end(); ) {
+        Connection& c = it->second;
+        if (!c.busy && c.out.empty() && now - c.lastActive > m_server.m_keepAliveTimeout) {
+            ::close(c.fd);
+            it = m_conns.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+
+/*************************************************************************
+ * EpollServer
+ */
+
+EpollServer::EpollServer(const SpatialLookup& splu,
+                         std::size_t ioThreads,
+                         std::size_t workerThreads)
+    : m_splu(splu)
+    , m_numIo(ioThreads ? ioThreads : 1)
+    , m_numWorkers(workerThreads ? workerThreads : 1)
+    , m_reusePort(false)
+    , m_tcpNoDelay(true)
+    , m_compress(true)
+    , m_compressMin(1024)
+    , m_admission(nullptr)
+    , m_metrics(nullptr)
+    , m_admin(nullptr)
+    , m_keepAliveMax(5)
+    , m_keepAliveTimeout(5)
+    , m_running(false)
+{}
+
+
+EpollServer::~EpollServer()
+{
+    stop();
+    for (int fd : m_listenFds)
+        ::close(fd);
+}
+
+
+bool
+EpollServer::listen(const std::string& host, unsigned int port)
+{
+    // One socket shared by every loop, or one each
+    std::size_t numSockets = m_reusePort ? m_numIo : 1;
+    for (std::size_t i = 0; i < numSockets; i++) {
+        int fd = listen_tcp(host, port, m_reusePort);
+        if (fd < 0) {
+            std::cerr << "spatial_lookup: unable to bind " << host << ":" << port << std::endl;
+            return false;
+        }
+        m_listenFds.push_back(fd);
+    }
+    return serve();
+}
+
+
+bool
+EpollServer::listenUnix(const std::string& path)
+{
+    // SO_REUSEPORT doesn't apply, so the loops always share
+    std::string errmsg;
+    int fd = listen_unix(path, errmsg);
+    if (fd < 0) {
+        std::cerr << "spatial_lookup: " << errmsg << std::endl;
+        return false;
+    }
+    m_listenFds.push_back(fd);
+    bool served = serve();
+    unlink_unix(path);
+    return served;
+}
+
+
+bool
+EpollServer::serve()
+{
+    std::size_t numSockets = m_listenFds.size();
+    bool shared = numSockets < m_numIo;
+
+    m_running = true;
+    for (std::size_t i = 0; i < m_numIo; i++) {
+        m_loops.emplace_back(new IoLoop(*this, m_listenFds[i % numSockets], shared));
+        if (!m_loops.back()->ok()) {
+            std::cerr << "spatial_lookup: unable to create epoll loop" << std::endl;
+            m_running = false;
+            m_loops.clear();
+            return false;
+        }
+    }
+
+    for (std::size_t i = 0; i < m_numWorkers; i++)
+        m_workers.emplace_back(&EpollServer::runWorker, this);
+
+    std::vector<std::thread> ioThreads;
+    for (auto& loop : m_loops)
+        ioThreads.emplace_back(&IoLoop::run, loop.get());
+
+    for (auto& t : ioThreads)
+        t.join();
+    for (auto& t : m_workers)
+        t.join();
+    m_workers.clear();
+    m_loops.clear();
+    return true;
+}
+
+
+void
+EpollServer::stop()
+{
+    if (!m_running.exchange(false))
+        return;
+    for (auto& loop : m_loops)
+        loop->wake();
+    std::lock_guard<std::mutex> lock(m_jobMutex);
+    m_jobCond.notify_all();
+}
+
+
+void
+EpollServer::dispatch(Job&& job)
+{
+    std::lock_guard<std::mutex> lock(m_jobMutex);
+    m_jobs.push_back(std::move(job));
+    m_jobCond.notify_one();
+}
+
+
+void
+EpollServer::runWorker()
+{
+    numa_pin_worker();
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_jobMutex);
+            m_jobCond.wait(lock, [this] { return !m_jobs.empty() || !m_running; });
+            if (!m_running)
+                return;
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+        if (m_admission)
+            m_admission->dequeued(job.lookups, AdmissionControl::Clock::now() - job.queued);
+
+        // Indexed lookup of each coordinate against the data!
+        for (auto& req : job.requests) {
+            if (!req.response.empty())
+                continue;
+            bool recordStages = m_metrics && m_metrics->stageTiming();
+            Coordinate coord(req.x, req.y);
+            LookupStats stats;
+            stats.timeStages = req.debug || recordStages;
+            stats.profile = m_metrics ? m_metrics->featureProfile() : nullptr;
+            Metrics::Clock::time_point start = Metrics::Clock::now();
+            std::vector<std::string> hits = m_splu.lookup(coord, &stats);
+            if (m_metrics) {
+                m_metrics->recordLookup(coord, Metrics::nanosSince(start), stats);
+                m_metrics->countRequest(Metrics::Route::LOOKUP, 200);
+            }
+
+            std::string body;
+            if (stats.timeStages) {
+                StageTicks stages = stats.stages;
+                stages[Stage::PARSE] = req.parseTicks;
+                uint64_t renderStart = cycle_count();
+                body = hits_to_json(hits);
+                stages[Stage::RENDER] = cycle_count() - renderStart;
+                if (recordStages)
+                    m_metrics->recordStages(stages);
+                if (req.debug)
+                    body = lookup_debug_json(body, stats, stages);
+            }
+            else {
+                body = hits_to_json(hits);
+            }
+            if (req.encoding == ContentEncoding::IDENTITY || body.size() < m_compressMin ||
+                !render_compressed(req.response, body, req.keepAlive, req.encoding)) {
+                req.response = render_response(200, "OK", body, req.keepAlive);
+            }
+        }
+        job.loop->complete(std::move(job));
+    }
+}
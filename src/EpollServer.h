@@ -0,0 +1,192 @@
+/*
+*  EpollServer.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// App headers
+#include "SpatialLookup.h"
+#include "AdmissionControl.h"
+#include "Admin.h"
+#include "Compression.h"
+#include "Metrics.h"
+
+
+/**
+ * An event-driven HTTP front end for the /lookup route, as an
+ * alternative to the thread-per-connection httplib::Server.
+ *
+ * A small number of I/O threads each run an edge-triggered
+ * epoll loop over non-blocking sockets. They accept connections,
+ * parse requests and write responses, but never run a lookup
+ * themselves. Parsed requests are handed to a pool of lookup
+ * workers, which run the query and hand the rendered response
+ * back to the owning I/O thread through an eventfd.
+ *
+ * Clients may pipeline requests. Everything waiting in a
+ * connection's read buffer goes to a worker as one batch, and
+ * the responses are written back together with writev, so a
+ * busy client costs a few syscalls per batch rather than per
+ * request.
+ *
+ * Because an idle keep-alive connection costs only a small
+ * Connection record, rather than a blocked thread, the server
+ * can hold tens of thousands of connections open at once.
+ */
+class EpollServer {
+
+public:
+
+    EpollServer(const SpatialLookup& splu,
+                std::size_t ioThreads,
+                std::size_t workerThreads);
+
+    ~EpollServer();
+
+    /**
+     * Give each I/O thread its own listening socket bound with
+     * SO_REUSEPORT, instead of sharing a single one, so the
+     * kernel spreads new connections across the threads and
+     * they never contend on one accept queue.
+     */
+    void setReusePort(bool on) { m_reusePort = on; }
+
+    /**
+     * Close a connection after it has served maxCount requests,
+     * or been idle for timeoutSec seconds.
+     */
+    void setKeepAlive(std::size_t maxCount, time_t timeoutSec) {
+        m_keepAliveMax = maxCount;
+        m_keepAliveTimeout = timeoutSec;
+    }
+
+    /**
+     * Set TCP_NODELAY on accepted connections.
+     */
+    void setTcpNoDelay(bool on) { m_tcpNoDelay = on; }
+
+    /**
+     * Cap the lookups waiting for a worker and rate limit each
+     * client, answering 503 and 429 from the I/O thread. Also
+     * serves the admission counters on /health.
+     */
+    void setAdmission(AdmissionControl* admission) { m_admission = admission; }
+
+    /**
+     * Count requests and record lookups in metrics, and
+     * serve them on /metrics.
+     */
+    void setMetrics(Metrics* metrics) { m_metrics = metrics; }
+
+    /**
+     * Answer GET and POST requests under /admin/ with admin.
+     */
+    void setAdmin(Admin* admin) { m_admin = admin; }
+
+    /**
+     * Compress responses of at least minBytes, in whichever
+     * encoding the client prefers, on the worker thread.
+     */
+    void
+    setCompression(bool on, std::size_t minBytes)
+    {
+        m_compress = on;
+        m_compressMin = minBytes;
+    }
+
+    /**
+     * Bind to the host and port, and serve requests until
+     * stop() is called. Returns false if the address could
+     * not be bound.
+     */
+    bool listen(const std::string& host, unsigned int port);
+
+    /**
+     * As listen(), but on a Unix domain socket at path, for
+     * clients on the same host. The socket file is removed
+     * again when it returns.
+     */
+    bool listenUnix(const std::string& path);
+
+    /**
+     * Ask all the I/O and worker threads to finish, which
+     * in turn causes listen() to return.
+     */
+    void stop();
+
+private:
+
+    class IoLoop;
+
+    /**
+     * One request in a batch: a coordinate to look up, or,
+     * if the I/O thread already rejected it, a ready-made
+     * error response that the worker passes over.
+     */
+    struct Request {
+        double x;
+        double y;
+        bool keepAlive;
+        ContentEncoding encoding;
+        std::string response;
+        bool debug = false;         // /lookup?debug=1
+        uint64_t parseTicks = 0;    // time the I/O thread spent reading it
+    };
+
+    /**
+     * A unit of work for the lookup workers: every request a
+     * pipelining client had waiting in the read buffer, so they
+     * run back to back and their responses go out together.
+     */
+    struct Job {
+        IoLoop* loop;
+        uint64_t connId;
+        std::vector<Request> requests;
+        std::size_t lookups;
+        AdmissionControl::Clock::time_point queued;
+    };
+
+    // Members
+    const SpatialLookup& m_splu;
+    const std::size_t m_numIo;
+    const std::size_t m_numWorkers;
+    bool m_reusePort;
+    bool m_tcpNoDelay;
+    bool m_compress;
+    std::size_t m_compressMin;
+    AdmissionControl* m_admission;
+    Metrics* m_metrics;
+    Admin* m_admin;
+    std::size_t m_keepAliveMax;
+    time_t m_keepAliveTimeout;
+    std::vector<int> m_listenFds;
+    std::atomic<bool> m_running;
+    std::vector<std::unique_ptr<IoLoop>> m_loops;
+    std::vector<std::thread> m_workers;
+
+    // Lookup work queue, shared by all I/O loops
+    std::mutex m_jobMutex;
+    std::condition_variable m_jobCond;
+    std::deque<Job> m_jobs;
+
+    // Methods
+    bool serve();
+    void dispatch(Job&& job);
+    void runWorker();
+
+};
@@ -0,0 +1,84 @@
+/*
+*  FeatureProfile.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// App headers
+#include "FeatureProfile.h"
+#include "SpatialLookup.h"
+#include "StageTimer.h"
+
+
+FeatureProfile::FeatureProfile(std::size_t numFeatures)
+    : m_size(numFeatures)
+    , m_counters(new Counters[numFeatures ? numFeatures : 1])
+    , m_enabled(false)
+{}
+
+
+void
+FeatureProfile::reset()
+{
+    for (std::size_t i = 0; i < m_size; i++) {
+        m_counters[i].candidates.store(0, std::memory_order_relaxed);
+        m_counters[i].hits.store(0, std::memory_order_relaxed);
+        m_counters[i].ticks.store(0, std::memory_order_relaxed);
+    }
+}
+
+
+std::string
+FeatureProfile::reportJson(const SpatialLookup& splu, std::size_t limit) const
+{
+    // Take a copy first, so the sort sees steady numbers
+    struct Row {
+        uint32_t id;
+        uint64_t candidates;
+        uint64_t hits;
+        uint64_t ticks;
+    };
+    std::vector<Row> rows;
+    for (std::size_t i = 0; i < m_size; i++) {
+        const Counters& c = m_counters[i];
+        uint64_t candidates = c.candidates.load(std::memory_order_relaxed);
+        if (candidates) {
+            rows.push_back({static_cast<uint32_t>(i), candidates,
+                            c.hits.load(std::memory_order_relaxed),
+                            c.ticks.load(std::memory_order_relaxed)});
+        }
+    }
+    std::size_t n = std::min(limit, rows.size());
+    std::partial_sort(rows.begin(), rows.begin() + n, rows.end(),
+                      [](const Row& a, const Row& b) { return a.ticks > b.ticks; });
+
+    double usPerTick = nanos_per_cycle() / 1000.0;
+    std::string out = "{\"profiling\":";
+    out += enabled() ? "true" : "false";
+    out += ",\"profiled\":";
+    out += std::to_string(rows.size());
+    out += ",\"features\":[";
+    for (std::size_t i = 0; i < n; i++) {
+        const Row& r = rows[i];
+        char buf[160];
+        snprintf(buf, sizeof(buf),
+                 "%s{\"feature\":%u,\"candidates\":%llu,\"hits\":%llu,\"total_us\":%.1f,\"mean_us\":%.3f,",
+                 i ? "," : "", r.id,
+                 static_cast<unsigned long long>(r.candidates), static_cast<unsigned long long>(r.hits),
+                 r.ticks * usPerTick, r.ticks * usPerTick / r.candidates);
+        out += buf;
+        out += "\"vertices\":";
+        out += std::to_string(splu.entryVertices(r.id));
+        out += ",\"value\":";
+        append_json_string(out, splu.value(splu.entryValueId(r.id)));
+        out += '}';
+    }
+    out += "]}\n";
+    return out;
+}
@@ -0,0 +1,76 @@
+/*
+*  FeatureProfile.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class SpatialLookup;
+
+
+/**
+ * What each indexed polygon costs: how often the index offered
+ * it as a candidate, how often the point in polygon test then
+ * hit, and the total time spent in those tests. Sorted by total
+ * time, this points straight at the polygons worth splitting
+ * or simplifying.
+ *
+ * Counting takes a timed test per candidate and an atomic add
+ * per counter, so it is off until switched on.
+ */
+class FeatureProfile {
+
+public:
+
+    explicit FeatureProfile(std::size_t numFeatures);
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool on) { m_enabled.store(on, std::memory_order_relaxed); }
+
+    /**
+     * Count one test of the entry, taking ticks of cycle_count().
+     * Called from the lookup threads.
+     */
+    void
+    record(uint32_t entryId, bool hit, uint64_t ticks)
+    {
+        Counters& c = m_counters[entryId];
+        c.candidates.fetch_add(1, std::memory_order_relaxed);
+        if (hit)
+            c.hits.fetch_add(1, std::memory_order_relaxed);
+        c.ticks.fetch_add(ticks, std::memory_order_relaxed);
+    }
+
+    /**
+     * Start counting again from zero.
+     */
+    void reset();
+
+    /**
+     * The limit most costly polygons as JSON, most costly
+     * first, with their values and vertex counts from splu.
+     */
+    std::string reportJson(const SpatialLookup& splu, std::size_t limit) const;
+
+private:
+
+    struct Counters {
+        std::atomic<uint64_t> candidates{0};
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> ticks{0};
+    };
+
+    // Members
+    const std::size_t m_size;
+    std::unique_ptr<Counters[]> m_counters;
+    std::atomic<bool> m_enabled;
+
+};
@@ -0,0 +1,136 @@
+/*
+*  LoadReport.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cstdio>
+
+// App headers
+#include "LoadReport.h"
+
+
+/**
+ * Bytes in the most fitting unit, for the log.
+ */
+static std::string
+format_bytes(std::size_t bytes)
+{
+    static const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+    double v = static_cast<double>(bytes);
+    std::size_t u = 0;
+    while (v >= 1024.0 && u < 4) {
+        v /= 1024.0;
+        u++;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), u ? "%.1f %s" : "%.0f %s", v, units[u]);
+    return buf;
+}
+
+
+std::string
+load_report_json(const LoadReport& r)
+{
+    char buf[256];
+    std::string out = "{\"file\":\"";
+    out += r.filename;
+    out += "\",\"property\":\"";
+    out += r.property;
+    out += "\",\"file_bytes\":";
+    out += std::to_string(r.fileBytes);
+
+    snprintf(buf, sizeof(buf),
+             ",\"seconds\":{\"read\":%.6f,\"parse\":%.6f,\"extract\":%.6f,\"prepare\":%.6f,"
+             "\"index\":%.6f,\"warm_up\":%.6f,\"total\":%.6f}",
+             r.readSeconds, r.parseSeconds, r.extractSeconds, r.prepareSeconds,
+             r.indexSeconds, r.warmUpSeconds, r.totalSeconds());
+    out += buf;
+
+    snprintf(buf, sizeof(buf),
+             ",\"features\":{\"read\":%zu,\"indexed\":%zu,\"not_polygonal\":%zu,\"missing_property\":%zu,\"types\":{",
+             r.featuresRead, r.indexed, r.notPolygonal, r.missingProperty);
+    out += buf;
+    bool first = true;
+    for (const auto& t : r.featureTypes) {
+        out += first ? "\"" : ",\"";
+        out += t.first;
+        out += "\":";
+        out += std::to_string(t.second);
+        first = false;
+    }
+    out += "}}";
+
+    snprintf(buf, sizeof(buf),
+             ",\"vertices\":%zu,\"values\":%zu"
+             ",\"bytes\":{\"geometry\":%zu,\"prepared\":%zu,\"properties\":%zu,\"index\":%zu}",
+             r.vertices, r.values, r.geometryBytes, r.preparedBytes, r.propertyBytes, r.indexBytes);
+    out += buf;
+    if (!r.shared.empty()) {
+        out += ",\"shared\":{\"name\":\"";
+        out += r.shared;
+        snprintf(buf, sizeof(buf), "\",\"bytes\":%zu,\"attach_seconds\":%.6f}",
+                 r.sharedBytes, r.attachSeconds);
+        out += buf;
+    }
+    if (r.replicas) {
+        snprintf(buf, sizeof(buf), ",\"numa\":{\"replicas\":%zu,\"bytes\":%zu,\"replicate_seconds\":%.6f}",
+                 r.replicas, r.replicaBytes, r.replicateSeconds);
+        out += buf;
+    }
+    out += "}\n";
+    return out;
+}
+
+
+static void
+print_replicas(std::ostream& out, const LoadReport& r)
+{
+    if (!r.replicas)
+        return;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "in %.3fs", r.replicateSeconds);
+    out << "spatial_lookup: replicated to " << r.replicas << " NUMA nodes, "
+        << format_bytes(r.replicaBytes) << " each, " << buf << std::endl;
+}
+
+
+void
+print_load_report(std::ostream& out, const LoadReport& r)
+{
+    char buf[256];
+    if (!r.shared.empty()) {
+        snprintf(buf, sizeof(buf), "in %.3fs", r.attachSeconds);
+        out << "spatial_lookup: attached shared data set " << r.shared << ", "
+            << format_bytes(r.sharedBytes) << ", " << buf << ", published from "
+            << r.filename << std::endl;
+        out << "spatial_lookup: " << r.indexed << " features, " << r.vertices << " vertices, "
+            << r.values << " distinct values" << std::endl;
+        print_replicas(out, r);
+        return;
+    }
+    snprintf(buf, sizeof(buf),
+             "in %.3fs, parse %.3fs, extract %.3fs, prepare %.3fs, index %.3fs, warm-up %.3fs, total %.3fs",
+             r.readSeconds, r.parseSeconds, r.extractSeconds, r.prepareSeconds,
+             r.indexSeconds, r.warmUpSeconds, r.totalSeconds());
+    out << "spatial_lookup: read " << format_bytes(r.fileBytes) << " " << buf << std::endl;
+
+    out << "spatial_lookup: " << r.featuresRead << " features (";
+    bool first = true;
+    for (const auto& t : r.featureTypes) {
+        out << (first ? "" : ", ") << t.second << " " << t.first;
+        first = false;
+    }
+    out << "), " << r.indexed << " indexed, " << r.notPolygonal << " not polygonal, "
+        << r.missingProperty << " without '" << r.property << "'" << std::endl;
+
+    out << "spatial_lookup: " << r.vertices << " vertices, " << r.values << " distinct values" << std::endl;
+
+    out << "spatial_lookup: memory: geometry " << format_bytes(r.geometryBytes)
+        << ", prepared " << format_bytes(r.preparedBytes)
+        << ", properties " << format_bytes(r.propertyBytes)
+        << ", index " << format_bytes(r.indexBytes) << std::endl;
+    print_replicas(out, r);
+}
@@ -0,0 +1,87 @@
+/*
+*  LoadReport.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+
+
+/**
+ * What loading a data set took, filled in by SpatialLookup as
+ * it reads, parses and indexes the file: the time for each
+ * step, what the features were and which were kept, and the
+ * memory held by each structure once loaded.
+ *
+ * Geometry and property bytes are worked out from the features
+ * kept, so are close but not exact. The prepared geometry and
+ * index bytes are what the heap grew by while they were built,
+ * and are zero where the allocator can't say.
+ *
+ * A server attached to a shared data set loads nothing itself,
+ * so only the counts, the segment and its size are filled in.
+ * Copies made per NUMA node, after loading or attaching, are
+ * reported on their own.
+ */
+struct LoadReport {
+    std::string filename;
+    std::string property;
+    std::size_t fileBytes = 0;
+
+    // Seconds for each step, in the order they run
+    double readSeconds = 0.0;
+    double parseSeconds = 0.0;
+    double extractSeconds = 0.0;
+    double prepareSeconds = 0.0;
+    double indexSeconds = 0.0;
+    double warmUpSeconds = 0.0;
+    double attachSeconds = 0.0;
+    double replicateSeconds = 0.0;
+
+    // Features in the file by geometry type, "null" for
+    // none, and those left out of the index and why
+    std::map<std::string, std::size_t> featureTypes;
+    std::size_t featuresRead = 0;
+    std::size_t notPolygonal = 0;
+    std::size_t missingProperty = 0;
+    std::size_t indexed = 0;
+    std::size_t vertices = 0;
+    std::size_t values = 0;
+
+    // Bytes held once loaded
+    std::size_t geometryBytes = 0;
+    std::size_t preparedBytes = 0;
+    std::size_t propertyBytes = 0;
+    std::size_t indexBytes = 0;
+
+    // The shared memory data set attached to, if any
+    std::string shared;
+    std::size_t sharedBytes = 0;
+
+    // Copies of the data set, one per NUMA node, if made
+    std::size_t replicas = 0;
+    std::size_t replicaBytes = 0;
+
+    double totalSeconds() const {
+        return readSeconds + parseSeconds + extractSeconds +
+               prepareSeconds + indexSeconds + warmUpSeconds + attachSeconds +
+               replicateSeconds;
+    }
+};
+
+/**
+ * The report as JSON, for /admin/load.
+ */
+std::string load_report_json(const LoadReport& report);
+
+/**
+ * The report as a few lines of log, for start up.
+ */
+void print_load_report(std::ostream& out, const LoadReport& report);
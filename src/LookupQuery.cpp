@@ -0,0 +1,247 @@
+/*
+*  LookupQuery.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <string>
+
+// App headers
+#include "LookupQuery.h"
+
+// Longer than any sensible coordinate, after decoding
+static const std::size_t kMaxValueLength = 64;
+
+
+static int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Parse a finite number that fills the whole of b to e.
+ */
+static bool
+parse_number(const char* b, const char* e, double& value)
+{
+    // from_chars takes a '-' but not a '+'
+    if (b < e && *b == '+')
+        b++;
+    if (b == e)
+        return false;
+
+    auto result = std::from_chars(b, e, value);
+    return result.ec == std::errc() && result.ptr == e && std::isfinite(value);
+}
+
+/**
+ * Decode and parse one parameter value, which must be
+ * a finite number and nothing else.
+ */
+static bool
+parse_value(const char* b, const char* e, double& value)
+{
+    // Percent-decode into a stack buffer, only if needed
+    char buf[kMaxValueLength];
+    if (memchr(b, '%', e - b)) {
+        std::size_t n = 0;
+        for (const char* p = b; p < e; p++) {
+            if (n == kMaxValueLength)
+                return false;
+            if (*p == '%') {
+                if (e - p < 3)
+                    return false;
+                int hi = hex_value(p[1]);
+                int lo = hex_value(p[2]);
+                if (hi < 0 || lo < 0)
+                    return false;
+                buf[n++] = static_cast<char>(hi * 16 + lo);
+                p += 2;
+            }
+            else {
+                buf[n++] = *p;
+            }
+        }
+        b = buf;
+        e = buf + n;
+    }
+    return parse_number(b, e, value);
+}
+
+
+LookupQueryStatus
+parse_lookup_query(const char* begin, const char* end, double& x, double& y)
+{
+    const char* q = static_cast<const char*>(memchr(begin, '?', end - begin));
+    if (!q)
+        return LookupQueryStatus::MISSING;
+
+    // Stop at any fragment
+    const char* hash = static_cast<const char*>(memchr(q, '#', end - q));
+    if (hash)
+        end = hash;
+
+    bool haveX = false;
+    bool haveY = false;
+    const char* p = q + 1;
+    while (p < end) {
+        const char* amp = static_cast<const char*>(memchr(p, '&', end - p));
+        const char* pend = amp ? amp : end;
+        const char* eq = static_cast<const char*>(memchr(p, '=', pend - p));
+
+        if (eq && eq - p == 1 && (*p == 'x' || *p == 'y')) {
+            bool& have = (*p == 'x') ? haveX : haveY;
+            double& value = (*p == 'x') ? x : y;
+            if (!have) {
+                if (!parse_value(eq + 1, pend, value))
+                    return LookupQueryStatus::MALFORMED;
+                have = true;
+            }
+        }
+        p = pend + 1;
+    }
+
+    return (haveX && haveY) ? LookupQueryStatus::OK : LookupQueryStatus::MISSING;
+}
+
+
+/**
+ * Find the raw value of the named parameter in the query part
+ * of a target, which is empty for a bare name.
+ */
+static bool
+find_param(const char* begin, const char* end, const char* name,
+           const char*& valueBegin, const char*& valueEnd)
+{
+    const char* q = static_cast<const char*>(memchr(begin, '?', end - begin));
+    if (!q)
+        return false;
+    const char* hash = static_cast<const char*>(memchr(q, '#', end - q));
+    if (hash)
+        end = hash;
+
+    std::size_t n = strlen(name);
+    const char* p = q + 1;
+    while (p < end) {
+        const char* amp = static_cast<const char*>(memchr(p, '&', end - p));
+        const char* pend = amp ? amp : end;
+        const char* eq = static_cast<const char*>(memchr(p, '=', pend - p));
+        const char* nend = eq ? eq : pend;
+
+        if (static_cast<std::size_t>(nend - p) == n && memcmp(p, name, n) == 0) {
+            valueBegin = eq ? eq + 1 : pend;
+            valueEnd = pend;
+            return true;
+        }
+        p = pend + 1;
+    }
+    return false;
+}
+
+
+int
+query_switch(const char* begin, const char* end, const char* name)
+{
+    const char* vb;
+    const char* ve;
+    if (!find_param(begin, end, name, vb, ve))
+        return -1;
+    std::string v(vb, ve);
+    if (v.empty() || v == "1" || v == "true" || v == "on")
+        return 1;
+    if (v == "0" || v == "false" || v == "off")
+        return 0;
+    return -1;
+}
+
+
+int
+query_count(const char* begin, const char* end, const char* name, std::size_t& value)
+{
+    const char* vb;
+    const char* ve;
+    if (!find_param(begin, end, name, vb, ve))
+        return 0;
+    std::size_t v;
+    std::from_chars_result r = std::from_chars(vb, ve, v);
+    if (vb == ve || r.ec != std::errc() || r.ptr != ve)
+        return -1;
+    value = v;
+    return 1;
+}
+
+
+static bool
+is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void
+trim(const char*& b, const char*& e)
+{
+    while (b < e && is_space(*b))
+        b++;
+    while (e > b && is_space(e[-1]))
+        e--;
+}
+
+
+LookupQueryStatus
+parse_coordinate_line(const char* begin, const char* end, double& x, double& y)
+{
+    trim(begin, end);
+    if (begin < end && *begin == '[' && end[-1] == ']') {
+        begin++;
+        end--;
+        trim(begin, end);
+    }
+    if (begin == end)
+        return LookupQueryStatus::MISSING;
+
+    // Split at the comma, or failing that at the first space
+    const char* sep = static_cast<const char*>(memchr(begin, ',', end - begin));
+    if (!sep)
+        sep = std::find_if(begin, end, is_space);
+    if (sep == end)
+        return LookupQueryStatus::MISSING;
+
+    const char* xb = begin;
+    const char* xe = sep;
+    const char* yb = sep + 1;
+    const char* ye = end;
+    trim(xb, xe);
+    trim(yb, ye);
+    if (!parse_number(xb, xe, x) || !parse_number(yb, ye, y))
+        return LookupQueryStatus::MALFORMED;
+    return LookupQueryStatus::OK;
+}
+
+
+bool
+parse_content_length(const char* begin, const char* end, std::size_t limit, std::size_t& length)
+{
+    trim(begin, end);
+    if (begin == end)
+        return false;
+    std::size_t n = 0;
+    for (const char* p = begin; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return false;
+        // Stop counting past the limit, well short of overflow
+        if (n <= limit)
+            n = n * 10 + static_cast<std::size_t>(*p - '0');
+    }
+    length = std::min(n, limit + 1);
+    return true;
+}
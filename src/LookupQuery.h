@@ -0,0 +1,73 @@
+/*
+*  LookupQuery.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+
+
+/**
+ * Outcome of reading the query coordinate from a request.
+ */
+enum class LookupQueryStatus {
+    OK,
+    MISSING,    // no 'x' or no 'y' parameter
+    MALFORMED   // a parameter that is not a finite number
+};
+
+/**
+ * Read the 'x' and 'y' parameters straight out of a raw request
+ * target, like "/lookup?x=-78.40&y=39.69", without building a
+ * parameter map or copying anything to the heap. Values may be
+ * percent-encoded. If a parameter is repeated, the first one is
+ * used, as httplib's get_param_value() does.
+ */
+LookupQueryStatus parse_lookup_query(const char* begin, const char* end,
+                                     double& x, double& y);
+
+/**
+ * Read a coordinate from one line of a streamed request body,
+ * written as "x,y", "x y" or the JSON array "[x,y]", with any
+ * surrounding whitespace and a trailing CR ignored.
+ */
+LookupQueryStatus parse_coordinate_line(const char* begin, const char* end,
+                                        double& x, double& y);
+
+/**
+ * Look for an on/off switch, like "debug=1", in the query part
+ * of a raw request target. Returns 1 for 1, true or on, or the
+ * bare name; 0 for 0, false or off; and -1 if the switch is
+ * missing or set to anything else.
+ */
+int query_switch(const char* begin, const char* end, const char* name);
+
+/**
+ * Read a count, like "limit=20", from the query part of a raw
+ * request target. Returns 1 and sets value if it is there, 0
+ * leaving value alone if it is missing, and -1 if it is not
+ * a whole number.
+ */
+int query_count(const char* begin, const char* end, const char* name, std::size_t& value);
+
+/**
+ * Read a Content-Length header value: digits only, with any
+ * surrounding whitespace ignored. Returns false for anything
+ * else, empty or signed values included. A length over limit
+ * comes back as limit + 1, so a request size worked out from
+ * it can't overflow.
+ */
+bool parse_content_length(const char* begin, const char* end,
+                          std::size_t limit, std::size_t& length);
+
+inline const char*
+lookup_query_error(LookupQueryStatus status)
+{
+    return status == LookupQueryStatus::MISSING
+        ? "{\"error\":\"x and y parameters are required\"}\n"
+        : "{\"error\":\"x and y must be finite numbers\"}\n";
+}
@@ -0,0 +1,116 @@
+/*
+*  LookupStream.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cstring>
+
+// App headers
+#include "LookupStream.h"
+#include "LookupQuery.h"
+
+// No sensible coordinate line is longer than this, so a
+// client can't make us buffer an endless line
+static const std::size_t kMaxLineLength = 256;
+
+
+LookupStream::LookupStream(const SpatialLookup& splu, Metrics* metrics)
+    : m_splu(splu)
+    , m_metrics(metrics)
+    , m_overlong(false)
+    , m_lines(0)
+{}
+
+
+void
+LookupStream::feed(const char* data, std::size_t size, std::string& out)
+{
+    const char* p = data;
+    const char* end = data + size;
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!nl) {
+            // Hold the start of a line until the rest arrives
+            if (m_partial.size() + (end - p) > kMaxLineLength)
+                m_overlong = true;
+            else
+                m_partial.append(p, end);
+            return;
+        }
+
+        if (m_overlong) {
+            processLine(nullptr, nullptr, out);
+        }
+        else if (m_partial.empty()) {
+            processLine(p, nl, out);
+        }
+        else {
+            m_partial.append(p, nl);
+            processLine(m_partial.data(), m_partial.data() + m_partial.size(), out);
+        }
+        m_partial.clear();
+        m_overlong = false;
+        p = nl + 1;
+    }
+}
+
+
+void
+LookupStream::finish(std::string& out)
+{
+    if (m_overlong)
+        processLine(nullptr, nullptr, out);
+    else if (!m_partial.empty())
+        processLine(m_partial.data(), m_partial.data() + m_partial.size(), out);
+    m_partial.clear();
+    m_overlong = false;
+}
+
+
+void
+LookupStream::processLine(const char* begin, const char* end, std::string& out)
+{
+    // Overlong lines come through as null
+    double x, y;
+    LookupQueryStatus qs = LookupQueryStatus::MALFORMED;
+    if (begin) {
+        // Skip blank lines, without a result
+        const char* p = begin;
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+        if (p == end)
+            return;
+        qs = parse_coordinate_line(begin, end, x, y);
+    }
+
+    m_lines++;
+    if (qs != LookupQueryStatus::OK) {
+        out += "{\"error\":\"expected a coordinate as x,y\"}\n";
+        return;
+    }
+
+    // Write the values straight from the interned table,
+    // rather than through a vector of copies
+    m_ids.clear();
+    Coordinate coord(x, y);
+    if (m_metrics) {
+        LookupStats stats;
+        stats.profile = m_metrics->featureProfile();
+        Metrics::Clock::time_point start = Metrics::Clock::now();
+        m_splu.lookupIds(coord, m_ids, &stats);
+        m_metrics->recordLookup(coord, Metrics::nanosSince(start), stats);
+    }
+    else {
+        m_splu.lookupIds(coord, m_ids);
+    }
+    out += '[';
+    for (std::size_t i = 0; i < m_ids.size(); i++) {
+        if (i)
+            out += ',';
+        append_json_string(out, m_splu.value(m_ids[i]));
+    }
+    out += "]\n";
+}
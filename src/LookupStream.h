@@ -0,0 +1,69 @@
+/*
+*  LookupStream.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// App headers
+#include "SpatialLookup.h"
+#include "Metrics.h"
+
+
+/**
+ * Turns newline-delimited coordinates into newline-delimited
+ * JSON results, one line out for every non-blank line in, in
+ * the same order. Input can arrive in chunks of any size and
+ * split anywhere; only the one partial line at the end of a
+ * chunk is held over, so memory use stays the same however
+ * long the stream runs.
+ *
+ * Each result line is the JSON array of hits, as /lookup
+ * returns, or {"error":...} for a line that could not be
+ * read as a coordinate.
+ */
+class LookupStream {
+
+public:
+
+    /**
+     * Each lookup is recorded in metrics, if given.
+     */
+    explicit LookupStream(const SpatialLookup& splu, Metrics* metrics = nullptr);
+
+    /**
+     * Consume a chunk of input, appending the results of the
+     * lines it completes to out.
+     */
+    void feed(const char* data, std::size_t size, std::string& out);
+
+    /**
+     * End of input: look up a last line that had no newline.
+     */
+    void finish(std::string& out);
+
+    /**
+     * Lines answered so far.
+     */
+    std::size_t lines() const { return m_lines; }
+
+private:
+
+    void processLine(const char* begin, const char* end, std::string& out);
+
+    // Members
+    const SpatialLookup& m_splu;
+    Metrics* m_metrics;
+    std::string m_partial;
+    bool m_overlong;
+    std::vector<uint32_t> m_ids;
+    std::size_t m_lines;
+
+};
@@ -0,0 +1,479 @@
+/*
+*  Metrics.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <unistd.h>
+
+// App headers
+#include "Metrics.h"
+
+
+/*************************************************************************
+ * Histogram
+ */
+
+uint64_t
+Histogram::bucketLow(std::size_t i)
+{
+    if (i < kSubCount)
+        return i;
+    std::size_t shift = i / kSubCount - 1;
+    return (kSubCount + i % kSubCount) << shift;
+}
+
+
+uint64_t
+Histogram::bucketHigh(std::size_t i)
+{
+    if (i < kSubCount)
+        return i;
+    if (i == kBuckets - 1)
+        return UINT64_MAX;
+    std::size_t shift = i / kSubCount - 1;
+    return bucketLow(i) + (uint64_t(1) << shift) - 1;
+}
+
+
+void
+Histogram::addTo(Totals& totals) const
+{
+    for (std::size_t i = 0; i < kBuckets; i++) {
+        uint64_t n = m_counts[i].load(std::memory_order_relaxed);
+        totals.counts[i] += n;
+        totals.count += n;
+    }
+    totals.sum += m_sum.load(std::memory_order_relaxed);
+}
+
+
+uint64_t
+Histogram::Totals::atMost(uint64_t v) const
+{
+    uint64_t n = 0;
+    for (std::size_t i = 0; i < kBuckets && bucketHigh(i) <= v; i++)
+        n += counts[i];
+    return n;
+}
+
+
+uint64_t
+Histogram::Totals::quantile(double q) const
+{
+    if (!count)
+        return 0;
+    uint64_t rank = static_cast<uint64_t>(q * count);
+    if (rank >= count)
+        rank = count - 1;
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; i++) {
+        seen += counts[i];
+        if (seen > rank)
+            return bucketHigh(i);
+    }
+    return bucketHigh(kBuckets - 1);
+}
+
+
+/*************************************************************************
+ * Exposition helpers
+ */
+
+// Status codes counted by name; anything else is "other"
+static const int kStatusCodes[] = {
+    200, 206, 400, 404, 405, 408, 413, 414, 415, 416, 429, 431, 500, 503
+};
+
+static const char* kRouteNames[] = {
+    "/lookup", "/lookup/stream", "/health", "/metrics", "/admin", "other"
+};
+
+// Bucket bounds for the exported histograms: lookup
+// latency in nanoseconds, and counts per lookup. Each is
+// exported as the top of the log-linear bucket it falls in,
+// so 1000ns goes out as le="1.023e-06"
+static const uint64_t kLatencyBounds[] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000, 500000000, 1000000000
+};
+
+static const uint64_t kCountBounds[] = {
+    0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024
+};
+
+static const double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+static std::size_t
+status_index(int status)
+{
+    const std::size_t n = sizeof(kStatusCodes) / sizeof(kStatusCodes[0]);
+    for (std::size_t i = 0; i < n; i++) {
+        if (kStatusCodes[i] == status)
+            return i;
+    }
+    return n;
+}
+
+static void
+append_double(std::string& out, double v)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", v);
+    out += buf;
+}
+
+static void
+append_header(std::string& out, const char* name, const char* type, const char* help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void
+append_sample(std::string& out, const char* name, double v)
+{
+    out += name;
+    out += ' ';
+    append_double(out, v);
+    out += '\n';
+}
+
+/**
+ * Write out the series of a histogram with the given bucket
+ * bounds, each value and bound divided by scale, so that
+ * nanoseconds can be reported as seconds. Any labels, like
+ * stage="parse", go on every series.
+ *
+ * Each bound is moved up to the top of the bucket holding it,
+ * where no bucket straddles it, so every le counts exactly
+ * the values no more than it, as Prometheus expects.
+ */
+static void
+append_histogram(std::string& out, const char* name,
+                 const Histogram::Totals& h, const uint64_t* bounds, std::size_t numBounds,
+                 double scale, const std::string& labels = "")
+{
+    std::string prefix = labels.empty() ? "" : labels + ",";
+    std::string suffix = labels.empty() ? " " : "{" + labels + "} ";
+    for (std::size_t i = 0; i < numBounds; i++) {
+        uint64_t le = Histogram::bucketHigh(Histogram::bucketOf(bounds[i]));
+        out += name;
+        out += "_bucket{";
+        out += prefix;
+        out += "le=\"";
+        append_double(out, le / scale);
+        out += "\"} ";
+        out += std::to_string(h.atMost(le));
+        out += '\n';
+    }
+    out += name;
+    out += "_bucket{";
+    out += prefix;
+    out += "le=\"+Inf\"} ";
+    out += std::to_string(h.count);
+    out += '\n';
+    out += name;
+    out += "_sum";
+    out += suffix;
+    append_double(out, h.sum / scale);
+    out += '\n';
+    out += name;
+    out += "_count";
+    out += suffix;
+    out += std::to_string(h.count);
+    out += '\n';
+}
+
+/**
+ * Resident and virtual size of the process, from /proc.
+ */
+static bool
+process_memory(uint64_t& resident, uint64_t& virt)
+{
+    std::ifstream statm("/proc/self/statm");
+    uint64_t pages, residentPages;
+    if (!(statm >> pages >> residentPages))
+        return false;
+    uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    resident = residentPages * pageSize;
+    virt = pages * pageSize;
+    return true;
+}
+
+
+/*************************************************************************
+ * Metrics
+ */
+
+static std::atomic<uint64_t> s_nextSerial(1);
+
+Metrics::Metrics()
+    : m_serial(s_nextSerial++)
+    , m_nanosPerCycle(nanos_per_cycle())
+    , m_stageTiming(false)
+    , m_slowLog(nullptr)
+    , m_capture(nullptr)
+    , m_profile(nullptr)
+{
+    static_assert(sizeof(kStatusCodes) / sizeof(kStatusCodes[0]) + 1 == kCodes,
+                  "one code slot per named status, and one for the rest");
+    static_assert(sizeof(kRouteNames) / sizeof(kRouteNames[0]) == kRoutes,
+                  "one name per route");
+}
+
+
+Metrics::~Metrics()
+{}
+
+
+Metrics::Route
+Metrics::route(const char* begin, const char* end)
+{
+    std::size_t n = static_cast<std::size_t>(end - begin);
+    if (n == 7 && memcmp(begin, "/lookup", 7) == 0)
+        return Route::LOOKUP;
+    if (n == 14 && memcmp(begin, "/lookup/stream", 14) == 0)
+        return Route::STREAM;
+    if (n == 7 && memcmp(begin, "/health", 7) == 0)
+        return Route::HEALTH;
+    if (n == 8 && memcmp(begin, "/metrics", 8) == 0)
+        return Route::METRICS;
+    if (n > 7 && memcmp(begin, "/admin/", 7) == 0)
+        return Route::ADMIN;
+    return Route::OTHER;
+}
+
+
+/**
+ * The calling thread's shard. Each thread remembers the shard
+ * it used last, so the lock is only taken the first time a
+ * thread records into this Metrics. A serial number rather
+ * than the address identifies the owner, since a new Metrics
+ * could land where an old one was freed. A thread that starts
+ * up with the id of one that has exited takes over its shard,
+ * which is still only written by one thread at a time.
+ */
+Metrics::Shard&
+Metrics::shard()
+{
+    thread_local uint64_t t_serial = 0;
+    thread_local Shard* t_shard = nullptr;
+    if (t_serial == m_serial)
+        return *t_shard;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::unique_ptr<Shard>& s = m_shards[std::this_thread::get_id()];
+    if (!s)
+        s.reset(new Shard);
+    t_serial = m_serial;
+    t_shard = s.get();
+    return *t_shard;
+}
+
+
+void
+Metrics::countRequest(Route route, int status)
+{
+    bump(shard().requests[static_cast<std::size_t>(route)][status_index(status)]);
+}
+
+
+void
+Metrics::recordLookup(const Coordinate& coord, uint64_t nanos, const LookupStats& stats)
+{
+    Shard& s = shard();
+    s.latency.record(nanos);
+    s.candidates.record(stats.candidates);
+    s.hits.record(stats.hits);
+    if (m_slowLog && nanos >= m_slowLog->threshold())
+        m_slowLog->record(coord, nanos, stats);
+    if (m_capture)
+        m_capture->sample(coord);
+}
+
+
+void
+Metrics::recordStages(const StageTicks& stages)
+{
+    Shard& s = shard();
+    for (std::size_t i = 0; i < kStages; i++)
+        s.stages[i].record(static_cast<uint64_t>(stages.ticks[i] * m_nanosPerCycle));
+}
+
+
+std::string
+Metrics::exposition(const SpatialLookup& splu, const AdmissionControl* admission) const
+{
+    // Add up the shards
+    uint64_t requests[kRoutes][kCodes] = {};
+    Histogram::Totals latency, candidates, hits;
+    Histogram::Totals stages[kStages];
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& kv : m_shards) {
+            const Shard& s = *kv.second;
+            for (std::size_t r = 0; r < kRoutes; r++) {
+                for (std::size_t c = 0; c < kCodes; c++)
+                    requests[r][c] += s.requests[r][c].load(std::memory_order_relaxed);
+            }
+            s.latency.addTo(latency);
+            s.candidates.addTo(candidates);
+            s.hits.addTo(hits);
+            for (std::size_t i = 0; i < kStages; i++)
+                s.stages[i].addTo(stages[i]);
+        }
+    }
+
+    std::string out;
+    out.reserve(8192);
+
+    append_header(out, "spatial_lookup_http_requests_total", "counter",
+                  "HTTP responses sent, by route and status code.");
+    for (std::size_t r = 0; r < kRoutes; r++) {
+        for (std::size_t c = 0; c < kCodes; c++) {
+            if (!requests[r][c])
+                continue;
+            out += "spatial_lookup_http_requests_total{route=\"";
+            out += kRouteNames[r];
+            out += "\",code=\"";
+            out += c + 1 < kCodes ? std::to_string(kStatusCodes[c]) : "other";
+            out += "\"} ";
+            out += std::to_string(requests[r][c]);
+            out += '\n';
+        }
+    }
+
+    const std::size_t numLatency = sizeof(kLatencyBounds) / sizeof(kLatencyBounds[0]);
+    const std::size_t numCount = sizeof(kCountBounds) / sizeof(kCountBounds[0]);
+    append_header(out, "spatial_lookup_lookup_duration_seconds", "histogram",
+                  "Time to search the index and test the polygons, per coordinate.");
+    append_histogram(out, "spatial_lookup_lookup_duration_seconds",
+                     latency, kLatencyBounds, numLatency, 1e9);
+    append_header(out, "spatial_lookup_lookup_duration_quantile_seconds", "gauge",
+                  "Lookup time quantiles since start up, to within 1/8.");
+    for (double q : kQuantiles) {
+        out += "spatial_lookup_lookup_duration_quantile_seconds{quantile=\"";
+        append_double(out, q);
+        out += "\"} ";
+        append_double(out, latency.quantile(q) / 1e9);
+        out += '\n';
+    }
+    // Every candidate gets a point in polygon test, so this
+    // counts the tests as well
+    append_header(out, "spatial_lookup_lookup_candidates", "histogram",
+                  "Index entries whose bounding box holds the coordinate, each tested, per lookup.");
+    append_histogram(out, "spatial_lookup_lookup_candidates", candidates, kCountBounds, numCount, 1.0);
+    append_header(out, "spatial_lookup_lookup_hits", "histogram",
+                  "Polygons containing the coordinate, per lookup.");
+    append_histogram(out, "spatial_lookup_lookup_hits", hits, kCountBounds, numCount, 1.0);
+
+    append_header(out, "spatial_lookup_stage_timing_enabled", "gauge",
+                  "Whether /lookup requests are timing their stages.");
+    append_sample(out, "spatial_lookup_stage_timing_enabled", stageTiming() ? 1.0 : 0.0);
+    append_header(out, "spatial_lookup_stage_duration_seconds", "histogram",
+                  "Time a /lookup request spent in each stage, while stage timing is on.");
+    for (std::size_t i = 0; i < kStages; i++) {
+        std::string label = std::string("stage=\"") + stage_name(static_cast<Stage>(i)) + "\"";
+        append_histogram(out, "spatial_lookup_stage_duration_seconds",
+                         stages[i], kLatencyBounds, numLatency, 1e9, label);
+    }
+
+    append_header(out, "spatial_lookup_dataset_features", "gauge",
+                  "Polygonal features indexed.");
+    append_sample(out, "spatial_lookup_dataset_features", static_cast<double>(splu.numFeatures()));
+    append_header(out, "spatial_lookup_dataset_vertices", "gauge",
+                  "Vertices in the indexed polygons.");
+    append_sample(out, "spatial_lookup_dataset_vertices", static_cast<double>(splu.numVertices()));
+    append_header(out, "spatial_lookup_dataset_values", "gauge",
+                  "Distinct property values.");
+    append_sample(out, "spatial_lookup_dataset_values", static_cast<double>(splu.numValues()));
+
+    if (m_slowLog) {
+        append_header(out, "spatial_lookup_slow_queries_total", "counter",
+                      "Lookups written to the slow query log.");
+        append_sample(out, "spatial_lookup_slow_queries_total", static_cast<double>(m_slowLog->logged()));
+        append_header(out, "spatial_lookup_slow_queries_dropped_total", "counter",
+                      "Slow lookups not logged because the log could not keep up.");
+        append_sample(out, "spatial_lookup_slow_queries_dropped_total", static_cast<double>(m_slowLog->dropped()));
+    }
+    if (m_capture) {
+        append_header(out, "spatial_lookup_captured_queries_total", "counter",
+                      "Lookups written to the query capture.");
+        append_sample(out, "spatial_lookup_captured_queries_total", static_cast<double>(m_capture->captured()));
+        append_header(out, "spatial_lookup_captured_queries_dropped_total", "counter",
+                      "Sampled lookups not captured because the capture could not keep up.");
+        append_sample(out, "spatial_lookup_captured_queries_dropped_total", static_cast<double>(m_capture->dropped()));
+    }
+
+    uint64_t resident, virt;
+    if (process_memory(resident, virt)) {
+        append_header(out, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+        append_sample(out, "process_resident_memory_bytes", static_cast<double>(resident));
+        append_header(out, "process_virtual_memory_bytes", "gauge", "Virtual memory size in bytes.");
+        append_sample(out, "process_virtual_memory_bytes", static_cast<double>(virt));
+    }
+
+    if (admission) {
+        AdmissionControl::Snapshot a = admission->snapshot();
+        append_header(out, "spatial_lookup_queue_depth", "gauge",
+                      "Lookups waiting for a worker thread.");
+        append_sample(out, "spatial_lookup_queue_depth", static_cast<double>(a.depth));
+        append_header(out, "spatial_lookup_queue_limit", "gauge",
+                      "Most lookups allowed to wait, or 0 for no limit.");
+        append_sample(out, "spatial_lookup_queue_limit", static_cast<double>(a.maxQueue));
+        append_header(out, "spatial_lookup_admitted_total", "counter",
+                      "Lookups that went through the queue to a worker.");
+        append_sample(out, "spatial_lookup_admitted_total", static_cast<double>(a.admitted));
+        append_header(out, "spatial_lookup_shed_total", "counter",
+                      "Lookups turned away with 503 because the queue was full.");
+        append_sample(out, "spatial_lookup_shed_total", static_cast<double>(a.shed));
+        append_header(out, "spatial_lookup_rate_limited_total", "counter",
+                      "Requests turned away with 429 for going over the client rate limit.");
+        append_sample(out, "spatial_lookup_rate_limited_total", static_cast<double>(a.limited));
+        append_header(out, "spatial_lookup_queue_wait_seconds_total", "counter",
+                      "Total time lookups spent waiting for a worker.");
+        append_sample(out, "spatial_lookup_queue_wait_seconds_total", a.queueNanos / 1e9);
+        append_header(out, "spatial_lookup_queue_wait_max_seconds", "gauge",
+                      "Longest time a lookup has waited for a worker.");
+        append_sample(out, "spatial_lookup_queue_wait_max_seconds", a.queueMaxNanos / 1e9);
+    }
+    return out;
+}
+
+
+std::string
+lookup_debug_json(const std::string& hitsJson, const LookupStats& stats,
+                  const StageTicks& stages)
+{
+    // hits_to_json() ends its array with a newline
+    std::string hits = hitsJson;
+    while (!hits.empty() && hits.back() == '\n')
+        hits.pop_back();
+
+    std::string out = "{\"hits\":";
+    out += hits;
+    out += ",\"candidates\":";
+    out += std::to_string(stats.candidates);
+    out += ",\"tests\":";
+    out += std::to_string(stats.tests);
+    out += ",\"stages_us\":";
+    out += stages_json(stages);
+    out += "}\n";
+    return out;
+}
+
@@ -0,0 +1,258 @@
+/*
+*  Metrics.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// App headers
+#include "SpatialLookup.h"
+#include "AdmissionControl.h"
+#include "FeatureProfile.h"
+#include "QueryCapture.h"
+#include "SlowQueryLog.h"
+#include "StageTimer.h"
+
+
+/**
+ * Bump a counter that only one thread ever writes. A plain
+ * load and store is enough, and unlike fetch_add it needs no
+ * locked instruction, while readers still see a whole value.
+ */
+inline void
+bump(std::atomic<uint64_t>& counter, uint64_t n = 1)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/**
+ * A log-linear histogram of non-negative integers, in the
+ * manner of HdrHistogram. Values below 8 get a bucket each,
+ * and every power of two above that is split into 8 equal
+ * buckets, so any value is held to within 1/8 of itself
+ * with a fixed, small number of buckets and no floating
+ * point on the way in. Values of 2^44 and up (nearly five
+ * hours, in nanoseconds) all land in the top bucket.
+ *
+ * Only one thread may record into a histogram; any thread
+ * may read it.
+ */
+class Histogram {
+
+public:
+
+    static const int kSubBits = 3;
+    static const int kMaxBits = 44;
+    static const std::size_t kSubCount = std::size_t(1) << kSubBits;
+    static const std::size_t kBuckets = (kMaxBits - kSubBits + 1) * kSubCount;
+
+    static std::size_t
+    bucketOf(uint64_t v)
+    {
+        if (v < kSubCount)
+            return static_cast<std::size_t>(v);
+        if (v >> kMaxBits)
+            return kBuckets - 1;
+        int shift = 63 - __builtin_clzll(v) - kSubBits;
+        return (shift + 1) * kSubCount + ((v >> shift) & (kSubCount - 1));
+    }
+
+    /**
+     * The smallest and largest values that land in bucket i.
+     */
+    static uint64_t bucketLow(std::size_t i);
+    static uint64_t bucketHigh(std::size_t i);
+
+    void
+    record(uint64_t v)
+    {
+        bump(m_counts[bucketOf(v)]);
+        bump(m_sum, v);
+    }
+
+    /**
+     * A plain copy of the counts, for adding up and reading.
+     */
+    struct Totals {
+        uint64_t counts[kBuckets] = {};
+        uint64_t sum = 0;
+        uint64_t count = 0;
+
+        /**
+         * How many values are no more than v. Exact when v is
+         * the top of a bucket; otherwise the bucket that
+         * straddles v is left out.
+         */
+        uint64_t atMost(uint64_t v) const;
+
+        /**
+         * The value below which fraction q of values fall,
+         * as the top of the bucket it lands in.
+         */
+        uint64_t quantile(double q) const;
+    };
+
+    void addTo(Totals& totals) const;
+
+private:
+
+    std::atomic<uint64_t> m_counts[kBuckets] = {};
+    std::atomic<uint64_t> m_sum{0};
+
+};
+
+
+/**
+ * Counters and histograms for the /metrics endpoint, in the
+ * Prometheus text format.
+ *
+ * Recording has to cost next to nothing next to a lookup, so
+ * every thread that records gets a shard of its own: it never
+ * shares a cache line or takes a lock to record, only the first
+ * time it records at all. A scrape adds the shards up.
+ */
+class Metrics {
+
+public:
+
+    /**
+     * The routes requests are counted under. Anything not
+     * served is OTHER, so that scanners can't blow up the
+     * number of series.
+     */
+    enum class Route {
+        LOOKUP,
+        STREAM,
+        HEALTH,
+        METRICS,
+        ADMIN,
+        OTHER
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Nanoseconds from start until now, for recordLookup().
+     */
+    static uint64_t
+    nanosSince(Clock::time_point start)
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count());
+    }
+
+    static Route route(const char* begin, const char* end);
+
+    static Route
+    route(const std::string& path)
+    {
+        return route(path.data(), path.data() + path.size());
+    }
+
+    Metrics();
+    ~Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /**
+     * Count a response sent on the route with the status.
+     */
+    void countRequest(Route route, int status);
+
+    /**
+     * Record one coordinate looked up, the time it took, and
+     * what the index and polygon tests had to do for it. Slow
+     * ones also go to the slow query log, if there is one, and
+     * a sample of all of them to the query capture, if any.
+     */
+    void recordLookup(const Coordinate& coord, uint64_t nanos, const LookupStats& stats);
+
+    /**
+     * Send lookups over the log's threshold to it, and
+     * report its counts.
+     */
+    void setSlowQueryLog(SlowQueryLog* log) { m_slowLog = log; }
+
+    /**
+     * Offer every lookup to the capture, and report its counts.
+     */
+    void setQueryCapture(QueryCapture* capture) { m_capture = capture; }
+
+    /**
+     * The feature profile lookups should count themselves
+     * into, via LookupStats::profile, or nullptr if there is
+     * none or it is switched off.
+     */
+    FeatureProfile*
+    featureProfile() const
+    {
+        return m_profile && m_profile->enabled() ? m_profile : nullptr;
+    }
+    void setFeatureProfile(FeatureProfile* profile) { m_profile = profile; }
+
+    /**
+     * Whether /lookup requests should time their stages
+     * and record them with recordStages(). Off by default,
+     * and can be switched at any time.
+     */
+    bool stageTiming() const { return m_stageTiming.load(std::memory_order_relaxed); }
+    void setStageTiming(bool on) { m_stageTiming.store(on, std::memory_order_relaxed); }
+
+    /**
+     * Record the time one /lookup request spent in each stage.
+     */
+    void recordStages(const StageTicks& stages);
+
+    /**
+     * Everything, in the Prometheus text format, along with the
+     * size of the data set, the process memory, and the
+     * admission counters if there is admission control.
+     */
+    std::string exposition(const SpatialLookup& splu, const AdmissionControl* admission) const;
+
+private:
+
+    static const std::size_t kRoutes = 6;
+    static const std::size_t kCodes = 15;
+
+    struct Shard {
+        std::atomic<uint64_t> requests[kRoutes][kCodes] = {};
+        Histogram latency;
+        Histogram candidates;
+        Histogram hits;
+        Histogram stages[kStages];
+    };
+
+    Shard& shard();
+
+    // Members
+    const uint64_t m_serial;
+    const double m_nanosPerCycle;
+    std::atomic<bool> m_stageTiming;
+    SlowQueryLog* m_slowLog;
+    QueryCapture* m_capture;
+    FeatureProfile* m_profile;
+    mutable std::mutex m_mutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<Shard>> m_shards;
+
+};
+
+/**
+ * The body of /lookup?debug=1: the hits as usual, along with
+ * what the lookup had to do and the time each stage took.
+ */
+std::string lookup_debug_json(const std::string& hitsJson, const LookupStats& stats,
+                              const StageTicks& stages);
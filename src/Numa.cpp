@@ -0,0 +1,188 @@
+/*
+*  Numa.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+// App headers
+#include "Numa.h"
+
+static const char* kNodeDir = "/sys/devices/system/node";
+
+static std::atomic<bool> s_pinning(false);
+static std::atomic<std::size_t> s_nextWorker(0);
+
+// The calling thread's node, -1 until first asked for
+static thread_local long t_node = -1;
+
+
+/**
+ * Parse a sysfs CPU list, such as "0-3,8-11".
+ */
+static std::vector<int>
+parse_cpu_list(const std::string& list)
+{
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || range == "\n")
+            continue;
+        char* end;
+        long lo = std::strtol(range.c_str(), &end, 10);
+        long hi = *end == '-' ? std::strtol(end + 1, nullptr, 10) : lo;
+        for (long c = lo; c <= hi; c++)
+            cpus.push_back(static_cast<int>(c));
+    }
+    return cpus;
+}
+
+static bool
+pin_to_cpus(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus)
+        CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+
+/*************************************************************************
+ * NumaTopology
+ */
+
+NumaTopology::NumaTopology()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool haveAllowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto usable = [&](int c) {
+        return !haveAllowed || (c < CPU_SETSIZE && CPU_ISSET(c, &allowed));
+    };
+
+    std::vector<long> ids;
+    if (DIR* dir = opendir(kNodeDir)) {
+        while (dirent* e = readdir(dir)) {
+            if (strncmp(e->d_name, "node", 4) == 0 && isdigit(static_cast<unsigned char>(e->d_name[4])))
+                ids.push_back(std::strtol(e->d_name + 4, nullptr, 10));
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    for (long id : ids) {
+        std::ifstream in(std::string(kNodeDir) + "/node" + std::to_string(id) + "/cpulist");
+        std::string list;
+        std::getline(in, list);
+        std::vector<int> cpus;
+        for (int c : parse_cpu_list(list)) {
+            if (usable(c))
+                cpus.push_back(c);
+        }
+        if (!cpus.empty())
+            m_nodeCpus.push_back(cpus);
+    }
+
+    if (m_nodeCpus.empty()) {
+        std::vector<int> cpus;
+        unsigned n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned c = 0; c < n; c++) {
+            if (usable(static_cast<int>(c)))
+                cpus.push_back(static_cast<int>(c));
+        }
+        m_nodeCpus.push_back(cpus);
+    }
+
+    for (std::size_t node = 0; node < m_nodeCpus.size(); node++) {
+        for (int c : m_nodeCpus[node]) {
+            if (static_cast<std::size_t>(c) >= m_cpuNode.size())
+                m_cpuNode.resize(c + 1, 0);
+            m_cpuNode[c] = node;
+        }
+    }
+}
+
+
+const NumaTopology&
+NumaTopology::get()
+{
+    static const NumaTopology topology;
+    return topology;
+}
+
+
+std::size_t
+NumaTopology::nodeOfCpu(int cpu) const
+{
+    return cpu >= 0 && static_cast<std::size_t>(cpu) < m_cpuNode.size() ? m_cpuNode[cpu] : 0;
+}
+
+
+/*************************************************************************
+ * Threads
+ */
+
+std::size_t
+numa_current_node()
+{
+    if (t_node < 0)
+        t_node = static_cast<long>(NumaTopology::get().nodeOfCpu(sched_getcpu()));
+    return static_cast<std::size_t>(t_node);
+}
+
+
+void
+numa_enable_pinning()
+{
+    s_pinning = true;
+}
+
+
+void
+numa_pin_worker()
+{
+    thread_local bool pinned = false;
+    if (pinned || !s_pinning.load(std::memory_order_relaxed))
+        return;
+    pinned = true;
+
+    // Worker i goes to node i % nodes, and within it to the
+    // next core along, wrapping round once every core has one
+    const NumaTopology& topo = NumaTopology::get();
+    std::size_t i = s_nextWorker.fetch_add(1);
+    std::size_t node = i % topo.numNodes();
+    const std::vector<int>& cpus = topo.cpus(node);
+    if (cpus.empty())
+        return;
+    if (pin_to_cpus({cpus[(i / topo.numNodes()) % cpus.size()]}))
+        t_node = static_cast<long>(node);
+}
+
+
+void
+numa_run_on_node(std::size_t node, const std::function<void()>& fn)
+{
+    std::thread t([node, &fn] {
+        if (pin_to_cpus(NumaTopology::get().cpus(node)))
+            t_node = static_cast<long>(node);
+        fn();
+    });
+    t.join();
+}
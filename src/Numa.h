@@ -0,0 +1,73 @@
+/*
+*  Numa.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+
+/**
+ * The NUMA nodes of this machine and the CPUs of each that
+ * this process may run on, read from sysfs. Nodes are
+ * numbered from 0 in the order found, skipping any with no
+ * CPUs for us, so under numactl --cpunodebind only the nodes
+ * bound to are seen. A machine without NUMA, or without
+ * sysfs, is one node holding every CPU.
+ */
+class NumaTopology {
+
+public:
+
+    static const NumaTopology& get();
+
+    std::size_t numNodes() const {
+        return m_nodeCpus.size();
+    }
+    const std::vector<int>& cpus(std::size_t node) const {
+        return m_nodeCpus[node];
+    }
+
+    /**
+     * The node of a CPU, 0 for any not known.
+     */
+    std::size_t nodeOfCpu(int cpu) const;
+
+private:
+
+    NumaTopology();
+
+    // Members
+    std::vector<std::vector<int>> m_nodeCpus;
+    std::vector<std::size_t> m_cpuNode;
+
+};
+
+
+/**
+ * The node the calling thread runs on: the one it was pinned
+ * to, or else the node of the CPU it first asked from.
+ */
+std::size_t numa_current_node();
+
+/**
+ * Once enabled, each thread calling numa_pin_worker() is
+ * bound to a core of its own, taken in turn from each node,
+ * so lookup workers spread evenly over the nodes and stay
+ * next to their memory. Further calls from a thread already
+ * pinned do nothing, so it is cheap to call per request.
+ */
+void numa_enable_pinning();
+void numa_pin_worker();
+
+/**
+ * Run fn on a thread bound to the CPUs of node, and wait for
+ * it, so that memory it touches first is allocated there.
+ */
+void numa_run_on_node(std::size_t node, const std::function<void()>& fn);
@@ -0,0 +1,195 @@
+/*
+*  QueryCapture.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+// App headers
+#include "QueryCapture.h"
+
+// How often the writing thread looks for new records
+static const std::chrono::milliseconds kDrainInterval(100);
+
+
+static int64_t
+now_micros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * A random number for the sampling, from a generator of the
+ * calling thread's own, so lookup threads share nothing.
+ */
+static uint64_t
+thread_random()
+{
+    // splitmix64, seeded by where this thread's state lives
+    thread_local uint64_t state = reinterpret_cast<uintptr_t>(&state) * 0x9e3779b97f4a7c15ull;
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t
+sample_threshold(double rate)
+{
+    if (rate >= 1.0)
+        return std::numeric_limits<uint64_t>::max();
+    if (rate <= 0.0)
+        return 0;
+    return static_cast<uint64_t>(rate * 18446744073709551616.0);
+}
+
+
+QueryCapture::QueryCapture(double sampleRate, uint64_t limit, std::size_t capacity)
+    : m_threshold(sample_threshold(sampleRate))
+    , m_limit(limit)
+    , m_queue(capacity)
+    , m_sampled(0)
+    , m_captured(0)
+    , m_dropped(0)
+    , m_last(0)
+    , m_running(false)
+{}
+
+
+QueryCapture::~QueryCapture()
+{
+    stop();
+}
+
+
+bool
+QueryCapture::start(const std::string& path)
+{
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    if (!m_file) {
+        std::cerr << "spatial_lookup: unable to write query capture '" << path << "'" << std::endl;
+        return false;
+    }
+    m_last = now_micros();
+    char header[kCaptureHeaderSize];
+    memcpy(header, kCaptureMagic, sizeof(kCaptureMagic));
+    memcpy(header + sizeof(kCaptureMagic), &m_last, sizeof(m_last));
+    m_file.write(header, sizeof(header));
+    m_file.flush();
+
+    m_running = true;
+    m_thread = std::thread(&QueryCapture::run, this);
+    return true;
+}
+
+
+void
+QueryCapture::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+
+void
+QueryCapture::sample(const Coordinate& coord)
+{
+    if (m_threshold != std::numeric_limits<uint64_t>::max() && thread_random() >= m_threshold)
+        return;
+    if (m_sampled.load(std::memory_order_relaxed) >= m_limit ||
+        m_sampled.fetch_add(1, std::memory_order_relaxed) >= m_limit)
+        return;
+    if (!m_queue.push({coord.x, coord.y, now_micros()}))
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+void
+QueryCapture::run()
+{
+    Entry entry;
+    for (;;) {
+        bool running;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait_for(lock, kDrainInterval, [this] { return !m_running; });
+            running = m_running;
+        }
+        std::size_t n = 0;
+        while (m_queue.pop(entry)) {
+            write(entry);
+            n++;
+        }
+        if (n)
+            m_file.flush();
+        if (!running)
+            return;
+    }
+}
+
+
+void
+QueryCapture::write(const Entry& e)
+{
+    // Threads can hand over their queries a little out of
+    // order, and gaps over an hour or so are cut short
+    int64_t gap = e.when - m_last;
+    if (gap < 0)
+        gap = 0;
+    if (gap > std::numeric_limits<uint32_t>::max())
+        gap = std::numeric_limits<uint32_t>::max();
+    m_last += gap;
+
+    uint32_t delta = static_cast<uint32_t>(gap);
+    char record[kCaptureRecordSize];
+    memcpy(record, &delta, sizeof(delta));
+    memcpy(record + 4, &e.x, sizeof(e.x));
+    memcpy(record + 12, &e.y, sizeof(e.y));
+    m_file.write(record, sizeof(record));
+    m_captured.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+bool
+read_capture(const std::string& path, std::vector<CapturedQuery>& queries, std::string& err)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        err = "unable to read '" + path + "'";
+        return false;
+    }
+    char header[kCaptureHeaderSize];
+    if (!in.read(header, sizeof(header)) || memcmp(header, kCaptureMagic, sizeof(kCaptureMagic)) != 0) {
+        err = "'" + path + "' is not a query capture";
+        return false;
+    }
+
+    char record[kCaptureRecordSize];
+    int64_t micros = 0;
+    while (in.read(record, sizeof(record))) {
+        uint32_t delta;
+        CapturedQuery q;
+        memcpy(&delta, record, sizeof(delta));
+        memcpy(&q.x, record + 4, sizeof(q.x));
+        memcpy(&q.y, record + 12, sizeof(q.y));
+        micros += delta;
+        q.micros = micros;
+        queries.push_back(q);
+    }
+    // A capture still being written can end part way
+    // through a record, which is no reason to give up
+    return true;
+}
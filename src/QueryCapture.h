@@ -0,0 +1,136 @@
+/*
+*  QueryCapture.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// App headers
+#include "BoundedQueue.h"
+#include "SpatialLookup.h"
+
+/*
+ * File format of a query capture, shared by the server and
+ * the replay tool.
+ *
+ * A 16 byte header: the 8 bytes of kCaptureMagic, then an
+ * int64 of microseconds since the epoch when capture started.
+ * Then a 20 byte record per query: a uint32 of microseconds
+ * since the query before it (or since the start, for the
+ * first), then the x and y as doubles.
+ *
+ * All numbers are little-endian, as in the binary protocol.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Query captures assume a little-endian host"
+#endif
+
+static const char kCaptureMagic[8] = {'S', 'L', 'Q', 'C', 'A', 'P', '0', '1'};
+static const std::size_t kCaptureHeaderSize = 16;
+static const std::size_t kCaptureRecordSize = 20;
+
+/**
+ * A query read back from a capture, at its time since the
+ * start of the capture.
+ */
+struct CapturedQuery {
+    int64_t micros;
+    double x;
+    double y;
+};
+
+/**
+ * Read a whole capture, or return false with the reason in err.
+ */
+bool read_capture(const std::string& path, std::vector<CapturedQuery>& queries, std::string& err);
+
+
+/**
+ * Writes a sample of the coordinates looked up, with their
+ * timing, to a capture file, so real traffic, skew and all,
+ * can be replayed later against a changed build.
+ *
+ * As with the slow query log, the lookup threads only copy the
+ * coordinate into a lock-free ring, and a background thread
+ * does the writing. Queries that find the ring full are
+ * counted as dropped, and capture stops after a limit so a
+ * forgotten capture can't fill the disk.
+ */
+class QueryCapture {
+
+public:
+
+    /**
+     * Capture each lookup with probability sampleRate, up to
+     * limit queries in all.
+     */
+    QueryCapture(double sampleRate, uint64_t limit, std::size_t capacity = 65536);
+
+    ~QueryCapture();
+
+    QueryCapture(const QueryCapture&) = delete;
+    QueryCapture& operator=(const QueryCapture&) = delete;
+
+    /**
+     * Create the capture file at path, replacing any there,
+     * and start the writing thread. Returns false if the
+     * file can't be written.
+     */
+    bool start(const std::string& path);
+
+    /**
+     * Write out whatever is waiting and stop the thread.
+     */
+    void stop();
+
+    /**
+     * Maybe capture a lookup of coord. Never blocks.
+     */
+    void sample(const Coordinate& coord);
+
+    /**
+     * Queries written, and queries sampled but dropped for
+     * want of room.
+     */
+    uint64_t captured() const { return m_captured.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+
+    struct Entry {
+        double x;
+        double y;
+        int64_t when;       // microseconds since the epoch
+    };
+
+    void run();
+    void write(const Entry& entry);
+
+    // Members
+    const uint64_t m_threshold;     // sample when a random uint64 is below this
+    const uint64_t m_limit;
+    BoundedQueue<Entry> m_queue;
+    std::atomic<uint64_t> m_sampled;
+    std::atomic<uint64_t> m_captured;
+    std::atomic<uint64_t> m_dropped;
+
+    std::ofstream m_file;
+    int64_t m_last;                 // time of the last record written
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_running;
+
+};
@@ -0,0 +1,312 @@
+/*
+*  ServerOptions.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <thread>
+
+#include <getopt.h>
+
+// App headers
+#include "ServerOptions.h"
+
+
+/**
+ * Read a whole non-negative integer from an option argument.
+ */
+static bool
+parse_count(const char* name, const char* arg, unsigned long& value)
+{
+    char* end = nullptr;
+    errno = 0;
+    value = std::strtoul(arg, &end, 10);
+    if (errno || end == arg || *end || arg[0] == '-') {
+        std::cerr << "spatial_lookup: invalid value '" << arg << "' for --" << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read a fraction, from 0 to 1, from an option argument.
+ */
+static bool
+parse_fraction(const char* name, const char* arg, double& value)
+{
+    char* end = nullptr;
+    value = std::strtod(arg, &end);
+    if (end == arg || *end || !(value >= 0.0 && value <= 1.0)) {
+        std::cerr << "spatial_lookup: invalid value '" << arg << "' for --" << name
+                  << ", must be from 0 to 1" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+void
+ServerOptions::usage(std::ostream& os)
+{
+    os << "Usage: spatial_lookup [options] geojson.json property" << std::endl
+       << "       spatial_lookup [options] --shared NAME" << std::endl
+       << std::endl
+       << "Options:" << std::endl
+       << "  --host ADDR               address to listen on (default localhost)" << std::endl
+       << "  --port N                  port to listen on (default 8080)" << std::endl
+       << "  --unix PATH               serve HTTP on a Unix domain socket instead" << std::endl
+       << "  --threads N               lookup worker threads (default depends on front end)" << std::endl
+       << "  --io-threads N            epoll I/O threads (default from core count)" << std::endl
+       << "  --keepalive-max N         requests per keep-alive connection (default 5)" << std::endl
+       << "  --keepalive-timeout SEC   idle keep-alive timeout (default 5)" << std::endl
+       << "  --no-nodelay              leave Nagle's algorithm on for client sockets" << std::endl
+       << "  --compress-min N          compress responses of N bytes or more (default 1024)" << std::endl
+       << "  --no-compress             never compress responses" << std::endl
+       << "  --max-queue N             answer 503 once N lookups are waiting (default no limit)" << std::endl
+       << "  --rate-limit N            requests per second per client (default no limit)" << std::endl
+       << "  --rate-burst N            burst allowance per client (default the rate limit)" << std::endl
+       << "  --stage-timing            time the stages of each lookup, for /metrics" << std::endl
+       << "  --slow-query-us N         log lookups taking N microseconds or more" << std::endl
+       << "  --slow-query-log PATH     file for the slow query log (default standard error)" << std::endl
+       << "  --profile-features        count the cost of each feature, for /admin/features" << std::endl
+       << "  --capture PATH            write a sample of the queries to a capture file for replay" << std::endl
+       << "  --capture-rate F          fraction of queries to capture (default 0.01)" << std::endl
+       << "  --capture-limit N         stop capturing after N queries (default 1000000)" << std::endl
+       << "  --epoll                   serve from the epoll front end" << std::endl
+       << "  --reuseport               one SO_REUSEPORT listener per core" << std::endl
+       << "  --binary-port N           also serve the binary protocol on this port" << std::endl
+       << "  --binary-unix PATH        also serve the binary protocol on a Unix domain socket" << std::endl
+       << "  --shared NAME             serve the data set published to shared memory as NAME" << std::endl
+       << "  --numa                    copy the data set to each NUMA node and pin lookup threads" << std::endl;
+}
+
+
+bool
+ServerOptions::parse(int argc, char* argv[])
+{
+    enum {
+        OPT_HOST = 1000,
+        OPT_PORT,
+        OPT_UNIX,
+        OPT_THREADS,
+        OPT_IO_THREADS,
+        OPT_KEEPALIVE_MAX,
+        OPT_KEEPALIVE_TIMEOUT,
+        OPT_NO_NODELAY,
+        OPT_COMPRESS_MIN,
+        OPT_NO_COMPRESS,
+        OPT_MAX_QUEUE,
+        OPT_RATE_LIMIT,
+        OPT_RATE_BURST,
+        OPT_STAGE_TIMING,
+        OPT_SLOW_QUERY_US,
+        OPT_SLOW_QUERY_LOG,
+        OPT_PROFILE_FEATURES,
+        OPT_CAPTURE,
+        OPT_CAPTURE_RATE,
+        OPT_CAPTURE_LIMIT,
+        OPT_EPOLL,
+        OPT_REUSEPORT,
+        OPT_BINARY_PORT,
+        OPT_BINARY_UNIX,
+        OPT_SHARED,
+        OPT_NUMA,
+        OPT_HELP
+    };
+
+    static const option longopts[] = {
+        {"host",              required_argument, nullptr, OPT_HOST},
+        {"port",              required_argument, nullptr, OPT_PORT},
+        {"unix",              required_argument, nullptr, OPT_UNIX},
+        {"threads",           required_argument, nullptr, OPT_THREADS},
+        {"io-threads",        required_argument, nullptr, OPT_IO_THREADS},
+        {"keepalive-max",     required_argument, nullptr, OPT_KEEPALIVE_MAX},
+        {"keepalive-timeout", required_argument, nullptr, OPT_KEEPALIVE_TIMEOUT},
+        {"no-nodelay",        no_argument,       nullptr, OPT_NO_NODELAY},
+        {"compress-min",      required_argument, nullptr, OPT_COMPRESS_MIN},
+        {"no-compress",       no_argument,       nullptr, OPT_NO_COMPRESS},
+        {"max-queue",         required_argument, nullptr, OPT_MAX_QUEUE},
+        {"rate-limit",        required_argument, nullptr, OPT_RATE_LIMIT},
+        {"rate-burst",        required_argument, nullptr, OPT_RATE_BURST},
+        {"stage-timing",      no_argument,       nullptr, OPT_STAGE_TIMING},
+        {"slow-query-us",     required_argument, nullptr, OPT_SLOW_QUERY_US},
+        {"slow-query-log",    required_argument, nullptr, OPT_SLOW_QUERY_LOG},
+        {"profile-features",  no_argument,       nullptr, OPT_PROFILE_FEATURES},
+        {"capture",           required_argument, nullptr, OPT_CAPTURE},
+        {"capture-rate",      required_argument, nullptr, OPT_CAPTURE_RATE},
+        {"capture-limit",     required_argument, nullptr, OPT_CAPTURE_LIMIT},
+        {"epoll",             no_argument,       nullptr, OPT_EPOLL},
+        {"reuseport",         no_argument,       nullptr, OPT_REUSEPORT},
+        {"binary-port",       required_argument, nullptr, OPT_BINARY_PORT},
+        {"binary-unix",       required_argument, nullptr, OPT_BINARY_UNIX},
+        {"shared",            required_argument, nullptr, OPT_SHARED},
+        {"numa",              no_argument,       nullptr, OPT_NUMA},
+        {"help",              no_argument,       nullptr, OPT_HELP},
+        {nullptr,             0,                 nullptr, 0}
+    };
+
+    int opt;
+    unsigned long n;
+    while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (opt) {
+        case OPT_HOST:
+            host = optarg;
+            break;
+        case OPT_PORT:
+            if (!parse_count("port", optarg, n))
+                return false;
+            if (n == 0 || n > 65535) {
+                std::cerr << "spatial_lookup: port must be between 1 and 65535" << std::endl;
+                return false;
+            }
+            port = static_cast<unsigned int>(n);
+            break;
+        case OPT_UNIX:
+            unixPath = optarg;
+            break;
+        case OPT_THREADS:
+            if (!parse_count("threads", optarg, n))
+                return false;
+            threads = n;
+            break;
+        case OPT_IO_THREADS:
+            if (!parse_count("io-threads", optarg, n))
+                return false;
+            ioThreads = n;
+            break;
+        case OPT_KEEPALIVE_MAX:
+            if (!parse_count("keepalive-max", optarg, n))
+                return false;
+            if (n == 0) {
+                std::cerr << "spatial_lookup: keepalive-max must be at least 1" << std::endl;
+                return false;
+            }
+            keepAliveMaxCount = n;
+            break;
+        case OPT_KEEPALIVE_TIMEOUT:
+            if (!parse_count("keepalive-timeout", optarg, n))
+                return false;
+            keepAliveTimeout = static_cast<time_t>(n);
+            break;
+        case OPT_NO_NODELAY:
+            tcpNoDelay = false;
+            break;
+        case OPT_COMPRESS_MIN:
+            if (!parse_count("compress-min", optarg, n))
+                return false;
+            compressMin = n;
+            break;
+        case OPT_NO_COMPRESS:
+            compress = false;
+            break;
+        case OPT_MAX_QUEUE:
+            if (!parse_count("max-queue", optarg, n))
+                return false;
+            maxQueue = n;
+            break;
+        case OPT_RATE_LIMIT:
+            if (!parse_count("rate-limit", optarg, n))
+                return false;
+            rateLimit = n;
+            break;
+        case OPT_RATE_BURST:
+            if (!parse_count("rate-burst", optarg, n))
+                return false;
+            rateBurst = n;
+            break;
+        case OPT_STAGE_TIMING:
+            stageTiming = true;
+            break;
+        case OPT_SLOW_QUERY_US:
+            if (!parse_count("slow-query-us", optarg, n))
+                return false;
+            slowQueryMicros = n;
+            break;
+        case OPT_SLOW_QUERY_LOG:
+            slowQueryLog = optarg;
+            break;
+        case OPT_PROFILE_FEATURES:
+            profileFeatures = true;
+            break;
+        case OPT_CAPTURE:
+            capturePath = optarg;
+            break;
+        case OPT_CAPTURE_RATE:
+            if (!parse_fraction("capture-rate", optarg, captureRate))
+                return false;
+            break;
+        case OPT_CAPTURE_LIMIT:
+            if (!parse_count("capture-limit", optarg, n))
+                return false;
+            captureLimit = n;
+            break;
+        case OPT_EPOLL:
+            epoll = true;
+            break;
+        case OPT_REUSEPORT:
+            reusePort = true;
+            break;
+        case OPT_BINARY_PORT:
+            if (!parse_count("binary-port", optarg, n))
+                return false;
+            if (n == 0 || n > 65535) {
+                std::cerr << "spatial_lookup: port must be between 1 and 65535" << std::endl;
+                return false;
+            }
+            binaryPort = static_cast<unsigned int>(n);
+            break;
+        case OPT_BINARY_UNIX:
+            binaryUnixPath = optarg;
+            break;
+        case OPT_SHARED:
+            shared = optarg;
+            break;
+        case OPT_NUMA:
+            numa = true;
+            break;
+        case OPT_HELP:
+        default:
+            usage(std::cerr);
+            return false;
+        }
+    }
+
+    // Two positional arguments are required: the geojson
+    // file, and the property to respond with. A shared data
+    // set brings its own.
+    if (!shared.empty() && argc == optind)
+        return true;
+    if (!shared.empty() || argc - optind != 2) {
+        usage(std::cerr);
+        return false;
+    }
+    filename = argv[optind];
+    property = argv[optind + 1];
+    return true;
+}
+
+
+std::size_t
+ServerOptions::workerThreads() const
+{
+    if (threads)
+        return threads;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+std::size_t
+ServerOptions::epollIoThreads() const
+{
+    if (ioThreads)
+        return ioThreads;
+    // With a listener per core, give every core an I/O thread,
+    // otherwise a couple are plenty to keep the workers busy
+    std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    return reusePort ? cores : std::max<std::size_t>(1, cores / 4);
+}
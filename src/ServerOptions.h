@@ -0,0 +1,108 @@
+/*
+*  ServerOptions.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+
+/**
+ * Run-time settings for the server, read from the command
+ * line, so that a deployment can be tuned without a rebuild.
+ * The defaults match what the server did when these were
+ * all hard-coded.
+ */
+struct ServerOptions {
+
+    // Listen address
+    std::string host = "localhost";
+    unsigned int port = 8080;
+    // Unix domain socket for HTTP, in place of host:port
+    std::string unixPath;
+
+    // Threads running lookups, 0 leaves it to the front end
+    std::size_t threads = 0;
+    // Epoll I/O threads, 0 picks from the core count
+    std::size_t ioThreads = 0;
+
+    // Connection handling
+    std::size_t keepAliveMaxCount = 5;
+    time_t keepAliveTimeout = 5;
+    bool tcpNoDelay = true;
+
+    // Compress responses of at least compressMin bytes for
+    // clients that accept gzip or zstd
+    bool compress = true;
+    std::size_t compressMin = 1024;
+
+    // Admission control: most lookups waiting for a thread
+    // before new ones get 503, and requests per second per
+    // client (bursts of rateBurst) before 429; 0 for no limit
+    std::size_t maxQueue = 0;
+    std::size_t rateLimit = 0;
+    std::size_t rateBurst = 0;
+
+    // Time the stages of each /lookup request into
+    // /metrics; can also be switched on and off at
+    // /admin/stage-timing
+    bool stageTiming = false;
+
+    // Log lookups taking at least slowQueryMicros, 0 for
+    // none, to slowQueryLog, or standard error if empty
+    std::size_t slowQueryMicros = 0;
+    std::string slowQueryLog;
+
+    // Count the candidates, hits and test time of each
+    // feature for /admin/features; can also be switched
+    // on and off there
+    bool profileFeatures = false;
+
+    // Capture a captureRate sample of the queries looked
+    // up, up to captureLimit of them, to capturePath for
+    // replay; empty for no capture
+    std::string capturePath;
+    double captureRate = 0.01;
+    std::size_t captureLimit = 1000000;
+
+    // Front end selection
+    bool epoll = false;
+    bool reusePort = false;
+
+    // Port for the binary protocol, 0 for none, and
+    // optionally a Unix domain socket for it too
+    unsigned int binaryPort = 0;
+    std::string binaryUnixPath;
+
+    // Data to serve: a file and property, or the name of a
+    // data set published to shared memory
+    std::string filename;
+    std::string property;
+    std::string shared;
+
+    // Copy the data set to each NUMA node, and pin lookup
+    // threads to cores, each reading its node's copy
+    bool numa = false;
+
+    /**
+     * Fill in the options from the command line. Prints a
+     * message and returns false on bad or missing arguments.
+     */
+    bool parse(int argc, char* argv[]);
+
+    static void usage(std::ostream& os);
+
+    /**
+     * Thread counts for the epoll front end, with the
+     * 0 defaults resolved from the core count.
+     */
+    std::size_t workerThreads() const;
+    std::size_t epollIoThreads() const;
+};
@@ -0,0 +1,637 @@
+/*
+*  SharedDataset.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// GEOS headers
+#include <geos/geom/CoordinateSequence.h>
+#include <geos/geom/LinearRing.h>
+#include <geos/geom/Polygon.h>
+
+// App headers
+#include "SharedDataset.h"
+#include "SpatialLookup.h"
+
+using geos::geom::CoordinateSequence;
+using geos::geom::LineString;
+using geos::geom::Polygon;
+
+// Segments per band that the point in polygon index aims for,
+// the most bands any one feature is cut into, and the most
+// band entries, on average, any one segment may take
+static const std::size_t kSegmentsPerBand = 4;
+static const std::size_t kMaxBands = 65536;
+static const std::size_t kMaxEntriesPerSegment = 8;
+
+// Where Linux keeps POSIX shared memory, for the rename that
+// swaps a new data set in under the old one's name
+static const char* kShmDir = "/dev/shm";
+
+
+static std::string
+shm_name(const std::string& name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+static uint64_t
+align_up(uint64_t n)
+{
+    return (n + kSharedAlign - 1) & ~static_cast<uint64_t>(kSharedAlign - 1);
+}
+
+/**
+ * The band of a feature a y falls in. Both building and
+ * testing go through here, so a segment is always filed under
+ * every band a point on it can fall in.
+ */
+static uint32_t
+band_of(const SharedFeature& f, double y)
+{
+    if (f.numBands == 1)
+        return 0;
+    double b = (y - f.minY) / f.bandHeight;
+    if (!(b > 0))
+        return 0;
+    if (b >= f.numBands)
+        return f.numBands - 1;
+    return static_cast<uint32_t>(b);
+}
+
+static bool
+section_fits(uint64_t offset, uint64_t count, uint64_t itemSize, uint64_t size)
+{
+    return offset <= size && count <= (size - offset) / itemSize;
+}
+
+
+/*************************************************************************
+ * SharedDataset
+ */
+
+SharedDataset::SharedDataset()
+    : m_base(nullptr)
+    , m_size(0)
+    , m_header(nullptr)
+    , m_nodes(nullptr)
+    , m_features(nullptr)
+    , m_coords(nullptr)
+    , m_bands(nullptr)
+    , m_bandSegs(nullptr)
+    , m_valueOffsets(nullptr)
+    , m_text(nullptr)
+{}
+
+
+SharedDataset::~SharedDataset()
+{
+    if (m_base)
+        munmap(m_base, m_size);
+}
+
+
+bool
+SharedDataset::attach(const std::string& name)
+{
+    m_name = shm_name(name);
+    int fd = shm_open(m_name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cerr << "spatial_lookup: unable to open shared data set '" << m_name << "': "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) < sizeof(SharedHeader)) {
+        close(fd);
+        std::cerr << "spatial_lookup: '" << m_name << "' is not a shared data set" << std::endl;
+        return false;
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cerr << "spatial_lookup: unable to map shared data set '" << m_name << "': "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    m_base = base;
+    m_size = st.st_size;
+    if (!mapped()) {
+        std::cerr << "spatial_lookup: '" << m_name << "' is not a shared data set" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+bool
+SharedDataset::copy(const SharedDataset& from)
+{
+    void* base = mmap(nullptr, from.m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        std::cerr << "spatial_lookup: unable to allocate " << from.m_size << " bytes: "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    // Fewer TLB misses walking the tree, where the kernel
+    // allows it; this is only advice
+    madvise(base, from.m_size, MADV_HUGEPAGE);
+    memcpy(base, from.m_base, from.m_size);
+    mprotect(base, from.m_size, PROT_READ);
+    m_name = from.m_name;
+    m_base = base;
+    m_size = from.m_size;
+    return mapped();
+}
+
+
+/**
+ * Check the header of the image at m_base, and point the
+ * sections into it.
+ */
+bool
+SharedDataset::mapped()
+{
+    // The publisher is trusted to get the contents right, but
+    // every section has to be inside the segment
+    const SharedHeader* h = static_cast<const SharedHeader*>(m_base);
+    uint64_t size = m_size;
+    if (memcmp(h->magic, kSharedMagic, sizeof(kSharedMagic)) != 0 || h->size != size ||
+        !section_fits(h->nodesOffset, h->nodes, sizeof(SharedNode), size) ||
+        !section_fits(h->featuresOffset, h->features, sizeof(SharedFeature), size) ||
+        !section_fits(h->coordsOffset, h->coords, 2 * sizeof(double), size) ||
+        !section_fits(h->bandsOffset, h->bands, sizeof(uint64_t), size) ||
+        !section_fits(h->bandSegsOffset, h->bandSegs, sizeof(uint32_t), size) ||
+        !section_fits(h->valuesOffset, h->values + 1, sizeof(uint64_t), size) ||
+        !section_fits(h->textOffset, h->textBytes, 1, size) ||
+        h->leafNodes > h->nodes || h->filenameOffset >= h->textBytes ||
+        h->propertyOffset >= h->textBytes)
+        return false;
+
+    const char* bytes = static_cast<const char*>(m_base);
+    m_header = h;
+    m_nodes = reinterpret_cast<const SharedNode*>(bytes + h->nodesOffset);
+    m_features = reinterpret_cast<const SharedFeature*>(bytes + h->featuresOffset);
+    m_coords = reinterpret_cast<const double*>(bytes + h->coordsOffset);
+    m_bands = reinterpret_cast<const uint64_t*>(bytes + h->bandsOffset);
+    m_bandSegs = reinterpret_cast<const uint32_t*>(bytes + h->bandSegsOffset);
+    m_valueOffsets = reinterpret_cast<const uint64_t*>(bytes + h->valuesOffset);
+    m_text = bytes + h->textOffset;
+    return true;
+}
+
+
+/**
+ * Count the crossings of a ray from the point off to the
+ * right, as GEOS's RayCrossingCounter does, over just the
+ * segments in the point's band, stopping early for a point
+ * on a segment.
+ */
+bool
+SharedDataset::intersects(uint32_t featureId, const geos::geom::Coordinate& p) const
+{
+    const SharedFeature& f = m_features[featureId];
+    if (p.x < f.minX || p.x > f.maxX || p.y < f.minY || p.y > f.maxY)
+        return false;
+
+    const double* xy = m_coords + 2 * f.firstCoord;
+    const uint64_t* bands = m_bands + f.firstBand;
+    uint32_t band = band_of(f, p.y);
+    bool inside = false;
+    for (uint64_t i = bands[band]; i < bands[band + 1]; i++) {
+        const double* seg = xy + 2 * static_cast<uint64_t>(m_bandSegs[i]);
+        double x1 = seg[0], y1 = seg[1], x2 = seg[2], y2 = seg[3];
+
+        if (x1 < p.x && x2 < p.x)
+            continue;
+        if (p.x == x2 && p.y == y2)
+            return true;
+        if (y1 == p.y && y2 == p.y) {
+            if (p.x >= std::min(x1, x2) && p.x <= std::max(x1, x2))
+                return true;
+            continue;
+        }
+        if ((y1 > p.y && y2 <= p.y) || (y2 > p.y && y1 <= p.y)) {
+            // Which side of the segment the point is on
+            double side = (x2 - x1) * (p.y - y1) - (y2 - y1) * (p.x - x1);
+            if (side == 0)
+                return true;
+            if (y2 < y1)
+                side = -side;
+            if (side > 0)
+                inside = !inside;
+        }
+    }
+    return inside;
+}
+
+
+/*************************************************************************
+ * Publishing
+ */
+
+namespace {
+
+struct Box {
+    double minX, minY, maxX, maxY;
+};
+
+/**
+ * Everything that goes in a segment but the header, gathered
+ * before the size of the segment can be known.
+ */
+struct SharedLayout {
+    std::vector<SharedNode> nodes;
+    uint64_t leafNodes = 0;
+    std::vector<SharedFeature> features;
+    std::vector<double> coords;
+    std::vector<uint64_t> bands;
+    std::vector<uint32_t> bandSegs;
+    std::vector<uint64_t> valueOffsets;
+    std::string text;
+    uint64_t filenameOffset = 0;
+    uint64_t propertyOffset = 0;
+};
+
+}
+
+
+/**
+ * Sort items, indexes into boxes, into sort-tile-recursive
+ * order: into vertical slices by x, and each slice by y, so
+ * each run of kSharedFanout makes a compact node.
+ */
+static void
+str_sort(std::vector<uint32_t>& items, const std::vector<Box>& boxes)
+{
+    auto cx = [&boxes](uint32_t i) { return boxes[i].minX + boxes[i].maxX; };
+    auto cy = [&boxes](uint32_t i) { return boxes[i].minY + boxes[i].maxY; };
+    std::sort(items.begin(), items.end(), [&cx](uint32_t a, uint32_t b) { return cx(a) < cx(b); });
+
+    std::size_t nodes = (items.size() + kSharedFanout - 1) / kSharedFanout;
+    std::size_t slices = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(nodes))));
+    std::size_t sliceItems = slices ? ((nodes + slices - 1) / slices) * kSharedFanout : items.size();
+    for (std::size_t i = 0; i < items.size(); i += sliceItems) {
+        auto end = items.begin() + std::min(items.size(), i + sliceItems);
+        std::sort(items.begin() + i, end, [&cy](uint32_t a, uint32_t b) { return cy(a) < cy(b); });
+    }
+}
+
+static SharedNode
+make_node(const std::vector<Box>& boxes, uint32_t first, uint32_t count)
+{
+    SharedNode node;
+    node.minX = node.minY = HUGE_VAL;
+    node.maxX = node.maxY = -HUGE_VAL;
+    for (uint32_t i = first; i < first + count; i++) {
+        node.minX = std::min(node.minX, boxes[i].minX);
+        node.minY = std::min(node.minY, boxes[i].minY);
+        node.maxX = std::max(node.maxX, boxes[i].maxX);
+        node.maxY = std::max(node.maxY, boxes[i].maxY);
+    }
+    node.first = first;
+    node.count = count;
+    return node;
+}
+
+/**
+ * Pack the tree over the feature boxes, leaving in order the
+ * features in the order the leaves hold them.
+ */
+static void
+build_tree(const std::vector<Box>& featureBoxes, std::vector<uint32_t>& order, SharedLayout& layout)
+{
+    order.resize(featureBoxes.size());
+    std::iota(order.begin(), order.end(), 0);
+    str_sort(order, featureBoxes);
+
+    std::vector<Box> boxes;
+    for (uint32_t id : order)
+        boxes.push_back(featureBoxes[id]);
+    for (std::size_t i = 0; i < boxes.size(); i += kSharedFanout) {
+        uint32_t count = static_cast<uint32_t>(std::min<std::size_t>(kSharedFanout, boxes.size() - i));
+        layout.nodes.push_back(make_node(boxes, static_cast<uint32_t>(i), count));
+    }
+    layout.leafNodes = layout.nodes.size();
+
+    // Each level above sorts the level below the same way
+    // (which keeps each node's children in one run) and
+    // groups it, until there is one node
+    std::size_t levelStart = 0;
+    while (layout.nodes.size() - levelStart > 1) {
+        std::size_t levelEnd = layout.nodes.size();
+        std::vector<SharedNode> level(layout.nodes.begin() + levelStart, layout.nodes.end());
+        std::vector<Box> levelBoxes;
+        for (const SharedNode& n : level)
+            levelBoxes.push_back({n.minX, n.minY, n.maxX, n.maxY});
+        std::vector<uint32_t> levelOrder(level.size());
+        std::iota(levelOrder.begin(), levelOrder.end(), 0);
+        str_sort(levelOrder, levelBoxes);
+
+        boxes.clear();
+        for (std::size_t i = 0; i < levelOrder.size(); i++) {
+            layout.nodes[levelStart + i] = level[levelOrder[i]];
+            boxes.push_back(levelBoxes[levelOrder[i]]);
+        }
+        for (std::size_t i = 0; i < boxes.size(); i += kSharedFanout) {
+            uint32_t count = static_cast<uint32_t>(std::min<std::size_t>(kSharedFanout, boxes.size() - i));
+            SharedNode node = make_node(boxes, static_cast<uint32_t>(i), count);
+            node.first += static_cast<uint32_t>(levelStart);
+            layout.nodes.push_back(node);
+        }
+        levelStart = levelEnd;
+    }
+}
+
+/**
+ * Append the coordinates of a ring, and the index of the
+ * first coordinate of each of its segments, counting from
+ * the start of the feature.
+ */
+static void
+append_ring(const LineString* ring, uint64_t featureStart, SharedLayout& layout,
+            std::vector<uint32_t>& segs)
+{
+    const CoordinateSequence* cs = ring->getCoordinatesRO();
+    std::size_t n = cs->size();
+    uint64_t start = layout.coords.size() / 2 - featureStart;
+    for (std::size_t i = 0; i < n; i++) {
+        layout.coords.push_back(cs->getAt(i).x);
+        layout.coords.push_back(cs->getAt(i).y);
+    }
+    for (std::size_t i = 0; i + 1 < n; i++)
+        segs.push_back(static_cast<uint32_t>(start + i));
+}
+
+static void
+append_rings(const Geometry& geom, uint64_t featureStart, SharedLayout& layout,
+             std::vector<uint32_t>& segs)
+{
+    const Polygon* poly = dynamic_cast<const Polygon*>(&geom);
+    if (!poly) {
+        for (std::size_t i = 0; i < geom.getNumGeometries(); i++)
+            append_rings(*geom.getGeometryN(i), featureStart, layout, segs);
+        return;
+    }
+    append_ring(poly->getExteriorRing(), featureStart, layout, segs);
+    for (std::size_t i = 0; i < poly->getNumInteriorRing(); i++)
+        append_ring(poly->getInteriorRingN(i), featureStart, layout, segs);
+}
+
+/**
+ * Copy a feature's rings into the layout and file each
+ * segment under the bands its y range reaches into.
+ */
+static void
+append_feature(const SpatialLookup& splu, uint32_t id, SharedLayout& layout)
+{
+    const Geometry* geom = splu.entry(id).getFeature().getGeometry();
+    const Envelope* env = geom->getEnvelopeInternal();
+    SharedFeature f;
+    memset(&f, 0, sizeof(f));
+    f.minX = env->getMinX();
+    f.minY = env->getMinY();
+    f.maxX = env->getMaxX();
+    f.maxY = env->getMaxY();
+    f.valueId = splu.entryValueId(id);
+    f.vertices = static_cast<uint32_t>(geom->getNumPoints());
+    f.firstCoord = layout.coords.size() / 2;
+
+    std::vector<uint32_t> segs;
+    append_rings(*geom, f.firstCoord, layout, segs);
+
+    double height = f.maxY - f.minY;
+    f.numBands = static_cast<uint32_t>(std::max<std::size_t>(1, std::min(kMaxBands, segs.size() / kSegmentsPerBand)));
+    if (!(height > 0))
+        f.numBands = 1;
+    f.bandHeight = height / f.numBands;
+
+    const double* xy = layout.coords.data() + 2 * f.firstCoord;
+    auto bandRange = [&f, xy](uint32_t seg) {
+        double y1 = xy[2 * seg + 1], y2 = xy[2 * seg + 3];
+        return std::make_pair(band_of(f, std::min(y1, y2)), band_of(f, std::max(y1, y2)));
+    };
+
+    // A segment is filed in every band it crosses, so a feature
+    // of many tall segments, such as a comb of long thin teeth,
+    // could take as many entries as segments times bands. Halve
+    // the bands until the filing fits, down to the one band of
+    // a plain scan over every segment.
+    uint64_t maxEntries = kMaxEntriesPerSegment * static_cast<uint64_t>(segs.size());
+    while (f.numBands > 1) {
+        uint64_t entries = 0;
+        for (uint32_t seg : segs) {
+            auto r = bandRange(seg);
+            entries += r.second - r.first + 1;
+        }
+        if (entries <= maxEntries)
+            break;
+        f.numBands /= 2;
+        f.bandHeight = height / f.numBands;
+    }
+
+    // Count the segments in each band, then place them
+    std::vector<uint64_t> counts(f.numBands + 1, 0);
+    for (uint32_t seg : segs) {
+        auto r = bandRange(seg);
+        for (uint32_t b = r.first; b <= r.second; b++)
+            counts[b + 1]++;
+    }
+    f.firstBand = layout.bands.size();
+    uint64_t base = layout.bandSegs.size();
+    for (uint32_t b = 0; b <= f.numBands; b++) {
+        if (b)
+            counts[b] += counts[b - 1];
+        layout.bands.push_back(base + counts[b]);
+    }
+    layout.bandSegs.resize(base + counts[f.numBands]);
+    for (uint32_t seg : segs) {
+        auto r = bandRange(seg);
+        for (uint32_t b = r.first; b <= r.second; b++)
+            layout.bandSegs[base + counts[b]++] = seg;
+    }
+    layout.features.push_back(f);
+}
+
+
+/**
+ * Lay out the data set loaded in splu, and fill in a header
+ * for it, giving the size of the image.
+ */
+static void
+lay_out(const SpatialLookup& splu, SharedLayout& layout, SharedHeader& h)
+{
+    // The tree, then the features in the order it holds them
+    std::vector<Box> boxes;
+    for (std::size_t i = 0; i < splu.numFeatures(); i++) {
+        const Envelope* env = splu.entry(static_cast<uint32_t>(i)).getEnvelopeInternal();
+        boxes.push_back({env->getMinX(), env->getMinY(), env->getMaxX(), env->getMaxY()});
+    }
+    std::vector<uint32_t> order;
+    build_tree(boxes, order, layout);
+    for (uint32_t id : order)
+        append_feature(splu, id, layout);
+
+    for (std::size_t i = 0; i < splu.numValues(); i++) {
+        layout.valueOffsets.push_back(layout.text.size());
+        layout.text += splu.value(static_cast<uint32_t>(i));
+        layout.text += '\0';
+    }
+    layout.valueOffsets.push_back(layout.text.size());
+    layout.filenameOffset = layout.text.size();
+    layout.text += splu.loadReport().filename;
+    layout.text += '\0';
+    layout.propertyOffset = layout.text.size();
+    layout.text += splu.loadReport().property;
+    layout.text += '\0';
+
+    memset(&h, 0, sizeof(h));
+    h.features = layout.features.size();
+    h.nodes = layout.nodes.size();
+    h.leafNodes = layout.leafNodes;
+    h.coords = layout.coords.size() / 2;
+    h.bands = layout.bands.size();
+    h.bandSegs = layout.bandSegs.size();
+    h.values = splu.numValues();
+    h.vertices = splu.numVertices();
+    h.textBytes = layout.text.size();
+    h.filenameOffset = layout.filenameOffset;
+    h.propertyOffset = layout.propertyOffset;
+
+    uint64_t size = align_up(sizeof(SharedHeader));
+    auto place = [&size](uint64_t bytes) {
+        uint64_t offset = size;
+        size = align_up(size + bytes);
+        return offset;
+    };
+    h.nodesOffset = place(layout.nodes.size() * sizeof(SharedNode));
+    h.featuresOffset = place(layout.features.size() * sizeof(SharedFeature));
+    h.coordsOffset = place(layout.coords.size() * sizeof(double));
+    h.bandsOffset = place(layout.bands.size() * sizeof(uint64_t));
+    h.bandSegsOffset = place(layout.bandSegs.size() * sizeof(uint32_t));
+    h.valuesOffset = place(layout.valueOffsets.size() * sizeof(uint64_t));
+    h.textOffset = place(layout.text.size());
+    h.size = size;
+}
+
+/**
+ * Copy the layout into an image of h.size bytes, the header
+ * last so the magic only appears once the rest is in place.
+ */
+static void
+write_image(char* bytes, const SharedLayout& layout, SharedHeader h)
+{
+    auto copy = [bytes](uint64_t offset, const void* data, std::size_t len) {
+        if (len)
+            memcpy(bytes + offset, data, len);
+    };
+    copy(h.nodesOffset, layout.nodes.data(), layout.nodes.size() * sizeof(SharedNode));
+    copy(h.featuresOffset, layout.features.data(), layout.features.size() * sizeof(SharedFeature));
+    copy(h.coordsOffset, layout.coords.data(), layout.coords.size() * sizeof(double));
+    copy(h.bandsOffset, layout.bands.data(), layout.bands.size() * sizeof(uint64_t));
+    copy(h.bandSegsOffset, layout.bandSegs.data(), layout.bandSegs.size() * sizeof(uint32_t));
+    copy(h.valuesOffset, layout.valueOffsets.data(), layout.valueOffsets.size() * sizeof(uint64_t));
+    copy(h.textOffset, layout.text.data(), layout.text.size());
+    memcpy(h.magic, kSharedMagic, sizeof(kSharedMagic));
+    copy(0, &h, sizeof(h));
+}
+
+
+bool
+SharedDataset::build(const SpatialLookup& splu)
+{
+    if (!splu.hasEntries()) {
+        std::cerr << "spatial_lookup: only a data set loaded from a file can be laid out" << std::endl;
+        return false;
+    }
+    SharedLayout layout;
+    SharedHeader h;
+    lay_out(splu, layout, h);
+
+    void* base = mmap(nullptr, h.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        std::cerr << "spatial_lookup: unable to allocate " << h.size << " bytes: "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    write_image(static_cast<char*>(base), layout, h);
+    mprotect(base, h.size, PROT_READ);
+    m_name = splu.loadReport().filename;
+    m_base = base;
+    m_size = h.size;
+    return mapped();
+}
+
+
+bool
+publish_shared_dataset(const SpatialLookup& splu, const std::string& name)
+{
+    if (!splu.hasEntries()) {
+        std::cerr << "spatial_lookup: only a data set loaded from a file can be published" << std::endl;
+        return false;
+    }
+    SharedLayout layout;
+    SharedHeader h;
+    lay_out(splu, layout, h);
+    uint64_t size = h.size;
+
+    // Write under a name of our own, then rename it into place,
+    // so a server never attaches to a half written data set
+    std::string shmName = shm_name(name);
+    std::string tmpName = shmName + ".publishing." + std::to_string(getpid());
+    int fd = shm_open(tmpName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        std::cerr << "spatial_lookup: unable to create shared memory '" << tmpName << "': "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+    // Reserve the memory now, rather than fault on a full
+    // /dev/shm part way through
+    int rc = posix_fallocate(fd, 0, size);
+    void* base = rc == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cerr << "spatial_lookup: unable to allocate " << size << " bytes of shared memory: "
+                  << strerror(rc ? rc : errno) << std::endl;
+        shm_unlink(tmpName.c_str());
+        return false;
+    }
+    write_image(static_cast<char*>(base), layout, h);
+    munmap(base, size);
+
+    std::string from = kShmDir + tmpName;
+    std::string to = kShmDir + shmName;
+    if (rename(from.c_str(), to.c_str()) != 0) {
+        std::cerr << "spatial_lookup: unable to publish '" << shmName << "': " << strerror(errno) << std::endl;
+        shm_unlink(tmpName.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+bool
+remove_shared_dataset(const std::string& name)
+{
+    std::string shmName = shm_name(name);
+    if (shm_unlink(shmName.c_str()) != 0) {
+        std::cerr << "spatial_lookup: unable to remove '" << shmName << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
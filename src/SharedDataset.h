@@ -0,0 +1,239 @@
+/*
+*  SharedDataset.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// GEOS headers
+#include <geos/geom/Coordinate.h>
+
+class SpatialLookup;
+
+/*
+ * Layout of a data set published to POSIX shared memory.
+ *
+ * A header, then sections found by their byte offset from the
+ * start of the segment, never by pointer, so every process can
+ * map the segment wherever it likes. Each section starts on a
+ * kSharedAlign boundary.
+ *
+ * The index is a packed R-tree of SharedNode, built bottom up:
+ * the first leafNodes nodes each cover a run of features, the
+ * rest a run of nodes on the level below, and the last node is
+ * the root. Features are stored in tree order.
+ *
+ * Each feature's rings are stored one after another in coords,
+ * each closed, and for the point in polygon test the height of
+ * the feature is cut into bands, each listing the segments that
+ * reach into it: band b of a feature lists bandSegs[bands[b]]
+ * up to bandSegs[bands[b+1]], counting from the feature's
+ * firstBand, and each is the index, from the feature's
+ * firstCoord, of the first coordinate of a segment. A
+ * segment is filed in every band it reaches into, so features
+ * of tall segments are cut into fewer bands, to keep the
+ * entries to a few per segment.
+ *
+ * A segment never leaves the host that wrote it, so numbers
+ * are stored native, and the version in the magic changes
+ * whenever the layout does.
+ */
+static const char kSharedMagic[8] = {'S', 'L', 'S', 'H', 'M', '0', '0', '1'};
+static const std::size_t kSharedAlign = 64;
+static const uint32_t kSharedFanout = 16;
+
+struct SharedHeader {
+    char magic[8];
+    uint64_t size;              // bytes in the whole segment
+    uint64_t features;
+    uint64_t nodes;
+    uint64_t leafNodes;
+    uint64_t coords;
+    uint64_t bands;
+    uint64_t bandSegs;
+    uint64_t values;
+    uint64_t vertices;
+    uint64_t nodesOffset;       // SharedNode[nodes]
+    uint64_t featuresOffset;    // SharedFeature[features]
+    uint64_t coordsOffset;      // double[2 * coords]
+    uint64_t bandsOffset;       // uint64_t[bands]
+    uint64_t bandSegsOffset;    // uint32_t[bandSegs]
+    uint64_t valuesOffset;      // uint64_t[values + 1], offsets into the text
+    uint64_t textOffset;        // values, then file name and property, NUL terminated
+    uint64_t textBytes;
+    uint64_t filenameOffset;    // from textOffset
+    uint64_t propertyOffset;    // from textOffset
+};
+
+struct SharedNode {
+    double minX, minY, maxX, maxY;
+    uint32_t first;             // first feature, or node on the level below
+    uint32_t count;
+};
+
+struct SharedFeature {
+    double minX, minY, maxX, maxY;
+    uint64_t firstCoord;
+    uint64_t firstBand;         // numBands + 1 entries in bands
+    double bandHeight;
+    uint32_t numBands;
+    uint32_t valueId;
+    uint32_t vertices;
+    uint32_t pad;
+};
+
+
+/**
+ * A data set published to shared memory by another process,
+ * mapped read-only. Every process attached to the same segment
+ * shares the one copy of the polygons and index, so any number
+ * of servers cost the memory of one, and a new one is ready as
+ * soon as it has mapped the segment, with nothing to parse or
+ * build.
+ *
+ * The same layout also serves as a private copy, in memory of
+ * this process alone, such as the per NUMA node replicas of
+ * SpatialLookup::replicate().
+ *
+ * The point in polygon test follows GEOS: points on a boundary
+ * are inside. Points within rounding error of a boundary can
+ * come out differently from the GEOS test, which is exact.
+ */
+class SharedDataset {
+
+public:
+
+    SharedDataset();
+    ~SharedDataset();
+
+    SharedDataset(const SharedDataset&) = delete;
+    SharedDataset& operator=(const SharedDataset&) = delete;
+
+    /**
+     * Map the segment of this name, as given to
+     * publish_shared_dataset(). Returns false, having said
+     * why, if there is none or it isn't a data set.
+     */
+    bool attach(const std::string& name);
+
+    /**
+     * Lay out the data set loaded in splu in private memory,
+     * as publish_shared_dataset() would in shared memory.
+     */
+    bool build(const SpatialLookup& splu);
+
+    /**
+     * Copy another data set into private memory. The pages
+     * are allocated on the NUMA node of the calling thread.
+     */
+    bool copy(const SharedDataset& from);
+
+    const std::string& name() const { return m_name; }
+    std::size_t bytes() const { return m_size; }
+    std::size_t numFeatures() const { return m_header->features; }
+    std::size_t numVertices() const { return m_header->vertices; }
+    std::size_t numValues() const { return m_header->values; }
+
+    /**
+     * Size of the band index of the point in polygon test:
+     * the segment entries filed in the bands of all features,
+     * and the bytes it takes, offsets and entries.
+     */
+    std::size_t bandEntries() const { return m_header->bandSegs; }
+    std::size_t bandIndexBytes() const {
+        return m_header->bands * sizeof(uint64_t) + m_header->bandSegs * sizeof(uint32_t);
+    }
+
+    /**
+     * Value text by id, and the file and property the data
+     * set was published from.
+     */
+    const char* value(uint32_t id, std::size_t& len) const {
+        len = m_valueOffsets[id + 1] - m_valueOffsets[id] - 1;
+        return m_text + m_valueOffsets[id];
+    }
+    const char* filename() const { return m_text + m_header->filenameOffset; }
+    const char* property() const { return m_text + m_header->propertyOffset; }
+
+    uint32_t valueId(uint32_t featureId) const { return m_features[featureId].valueId; }
+    uint32_t vertices(uint32_t featureId) const { return m_features[featureId].vertices; }
+
+    /**
+     * Call fn(featureId) for each feature whose bounding box
+     * holds the coordinate.
+     */
+    template<typename Fn>
+    void query(const geos::geom::Coordinate& c, Fn&& fn) const
+    {
+        if (!m_header->nodes)
+            return;
+        // Deep enough for any tree of 2^32 features
+        uint32_t stack[kSharedFanout * 10];
+        std::size_t top = 0;
+        stack[top++] = static_cast<uint32_t>(m_header->nodes - 1);
+        while (top) {
+            uint32_t n = stack[--top];
+            const SharedNode& node = m_nodes[n];
+            if (c.x < node.minX || c.x > node.maxX || c.y < node.minY || c.y > node.maxY)
+                continue;
+            if (n < m_header->leafNodes) {
+                for (uint32_t f = node.first; f < node.first + node.count; f++) {
+                    const SharedFeature& feature = m_features[f];
+                    if (c.x >= feature.minX && c.x <= feature.maxX &&
+                        c.y >= feature.minY && c.y <= feature.maxY)
+                        fn(f);
+                }
+            }
+            else {
+                for (uint32_t i = node.count; i > 0; i--)
+                    stack[top++] = node.first + i - 1;
+            }
+        }
+    }
+
+    /**
+     * Whether the feature holds the coordinate, boundary
+     * included.
+     */
+    bool intersects(uint32_t featureId, const geos::geom::Coordinate& c) const;
+
+private:
+
+    bool mapped();
+
+    // Members
+    std::string m_name;
+    void* m_base;
+    std::size_t m_size;
+    const SharedHeader* m_header;
+    const SharedNode* m_nodes;
+    const SharedFeature* m_features;
+    const double* m_coords;
+    const uint64_t* m_bands;
+    const uint32_t* m_bandSegs;
+    const uint64_t* m_valueOffsets;
+    const char* m_text;
+
+};
+
+
+/**
+ * Lay out the data set loaded in splu in shared memory under
+ * the given name, replacing any segment already there. Servers
+ * already attached to the old one keep it until they exit.
+ * Returns false, having said why, on failure.
+ */
+bool publish_shared_dataset(const SpatialLookup& splu, const std::string& name);
+
+/**
+ * Remove a published data set. Servers attached to it keep
+ * their mapping.
+ */
+bool remove_shared_dataset(const std::string& name);
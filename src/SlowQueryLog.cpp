@@ -0,0 +1,152 @@
+/*
+*  SlowQueryLog.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+
+// App headers
+#include "SlowQueryLog.h"
+
+// How often the writing thread looks for new records
+static const std::chrono::milliseconds kDrainInterval(100);
+
+
+SlowQueryLog::SlowQueryLog(const SpatialLookup& splu, uint64_t thresholdNanos,
+                           std::size_t capacity)
+    : m_splu(splu)
+    , m_threshold(thresholdNanos)
+    , m_queue(capacity)
+    , m_logged(0)
+    , m_dropped(0)
+    , m_out(&std::cerr)
+    , m_running(false)
+{}
+
+
+SlowQueryLog::~SlowQueryLog()
+{
+    stop();
+}
+
+
+bool
+SlowQueryLog::start(const std::string& path)
+{
+    if (!path.empty()) {
+        m_file.open(path, std::ios::app);
+        if (!m_file) {
+            std::cerr << "spatial_lookup: unable to open slow query log '" << path << "'" << std::endl;
+            return false;
+        }
+        m_out = &m_file;
+    }
+    m_running = true;
+    m_thread = std::thread(&SlowQueryLog::run, this);
+    return true;
+}
+
+
+void
+SlowQueryLog::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+
+bool
+SlowQueryLog::record(const Coordinate& coord, uint64_t nanos, const LookupStats& stats)
+{
+    Entry e;
+    e.x = coord.x;
+    e.y = coord.y;
+    e.nanos = nanos;
+    e.when = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    e.stats = stats;
+    if (!m_queue.push(e)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+
+void
+SlowQueryLog::run()
+{
+    Entry entry;
+    for (;;) {
+        bool running;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait_for(lock, kDrainInterval, [this] { return !m_running; });
+            running = m_running;
+        }
+        std::size_t n = 0;
+        while (m_queue.pop(entry)) {
+            write(entry);
+            n++;
+        }
+        if (n)
+            m_out->flush();
+        if (!running)
+            return;
+    }
+}
+
+
+void
+SlowQueryLog::write(const Entry& e)
+{
+    // UTC time, to the microsecond
+    time_t secs = static_cast<time_t>(e.when / 1000000);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    char when[64];
+    std::size_t len = strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(when + len, sizeof(when) - len, ".%06dZ", static_cast<int>(e.when % 1000000));
+
+    char head[256];
+    snprintf(head, sizeof(head),
+             "{\"time\":\"%s\",\"x\":%.17g,\"y\":%.17g,\"us\":%.1f,\"candidates\":%u,\"tests\":%u,\"hits\":%u,\"tested\":[",
+             when, e.x, e.y, e.nanos / 1000.0,
+             e.stats.candidates, e.stats.tests, e.stats.hits);
+
+    std::string line = head;
+    uint32_t traced = std::min<uint32_t>(e.stats.tests, LookupStats::kMaxTested);
+    for (uint32_t i = 0; i < traced; i++) {
+        uint32_t id = e.stats.tested[i];
+        if (i)
+            line += ',';
+        line += "{\"feature\":";
+        line += std::to_string(id);
+        line += ",\"value\":";
+        append_json_string(line, m_splu.value(m_splu.entryValueId(id)));
+        line += ",\"vertices\":";
+        line += std::to_string(m_splu.entryVertices(id));
+        line += '}';
+    }
+    line += ']';
+    if (e.stats.tests > traced) {
+        line += ",\"untraced\":";
+        line += std::to_string(e.stats.tests - traced);
+    }
+    line += "}\n";
+    *m_out << line;
+    m_logged.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,108 @@
+/*
+*  SlowQueryLog.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+// App headers
+#include "BoundedQueue.h"
+#include "SpatialLookup.h"
+
+
+/**
+ * Logs every lookup that takes longer than a threshold, one
+ * line of JSON each, with the coordinate, the time taken, and
+ * the polygons that were tested along with their vertex counts,
+ * so the shapes that make some coordinates slow can be found.
+ *
+ * The threads running lookups only ever copy a record into a
+ * fixed size lock-free ring; a background thread takes records
+ * off the ring, looks up the details and does the writing. If
+ * the ring fills up, because slow queries are arriving faster
+ * than they can be written, new ones are counted as dropped
+ * rather than making a lookup thread wait.
+ */
+class SlowQueryLog {
+
+public:
+
+    /**
+     * Log lookups of at least thresholdNanos, holding up to
+     * capacity (rounded up to a power of two) waiting to be
+     * written.
+     */
+    SlowQueryLog(const SpatialLookup& splu, uint64_t thresholdNanos,
+                 std::size_t capacity = 4096);
+
+    ~SlowQueryLog();
+
+    SlowQueryLog(const SlowQueryLog&) = delete;
+    SlowQueryLog& operator=(const SlowQueryLog&) = delete;
+
+    /**
+     * Write to the file at path, appending, or to standard
+     * error if path is empty, and start the writing thread.
+     * Returns false if the file can't be opened.
+     */
+    bool start(const std::string& path);
+
+    /**
+     * Write out whatever is waiting and stop the thread.
+     */
+    void stop();
+
+    uint64_t threshold() const { return m_threshold; }
+
+    /**
+     * Queue a slow lookup for writing. Never blocks; returns
+     * false, and counts it as dropped, if the ring is full.
+     */
+    bool record(const Coordinate& coord, uint64_t nanos, const LookupStats& stats);
+
+    /**
+     * Records written, and records dropped for want of room.
+     */
+    uint64_t logged() const { return m_logged.load(std::memory_order_relaxed); }
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+
+    struct Entry {
+        double x;
+        double y;
+        uint64_t nanos;
+        int64_t when;       // microseconds since the epoch
+        LookupStats stats;
+    };
+
+    void run();
+    void write(const Entry& entry);
+
+    // Members
+    const SpatialLookup& m_splu;
+    const uint64_t m_threshold;
+    BoundedQueue<Entry> m_queue;
+    std::atomic<uint64_t> m_logged;
+    std::atomic<uint64_t> m_dropped;
+
+    std::ofstream m_file;
+    std::ostream* m_out;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_running;
+
+};
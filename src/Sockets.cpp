@@ -0,0 +1,176 @@
+/*
+*  Sockets.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cerrno>
+#include <cstring>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// App headers
+#include "Sockets.h"
+
+
+int
+listen_tcp(const std::string& host, unsigned int port, bool reusePort)
+{
+    addrinfo hints;
+    addrinfo* result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &result))
+        return -1;
+
+    int fd = -1;
+    for (addrinfo* rp = result; rp; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+        if (fd < 0)
+            continue;
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (reusePort)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+        if (bind(fd, rp->ai_addr, rp->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+
+/**
+ * Fill in a Unix domain socket address, if the path fits.
+ */
+static bool
+unix_address(const std::string& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+
+int
+listen_unix(const std::string& path, std::string& errmsg)
+{
+    sockaddr_un addr;
+    if (!unix_address(path, addr)) {
+        errmsg = "invalid socket path '" + path + "'";
+        return -1;
+    }
+
+    // Only clear away an old socket, never a regular file, and
+    // only once nothing answers on it: a socket file outlives
+    // the server that made it, but may as well belong to one
+    // still running
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (probe < 0) {
+            errmsg = "unable to bind " + path + ": " + strerror(errno);
+            return -1;
+        }
+        bool stale = connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+            && errno == ECONNREFUSED;
+        close(probe);
+        if (!stale) {
+            errmsg = "unable to bind " + path + ": another server is listening there";
+            return -1;
+        }
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) || listen(fd, SOMAXCONN)) {
+        errmsg = "unable to bind " + path + ": " + strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+void
+unlink_unix(const std::string& path)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+}
+
+
+int
+connect_tcp(const std::string& host, unsigned int port, std::string& errmsg)
+{
+    addrinfo hints;
+    addrinfo* result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    std::string service = std::to_string(port);
+    int rv = getaddrinfo(host.c_str(), service.c_str(), &hints, &result);
+    if (rv) {
+        errmsg = "unable to resolve " + host + ": " + gai_strerror(rv);
+        return -1;
+    }
+
+    int fd = -1;
+    for (addrinfo* rp = result; rp; rp = rp->ai_next) {
+        fd = socket(rp->ai_family, rp->ai_socktype | SOCK_CLOEXEC, rp->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        errmsg = "unable to connect to " + host + ":" + service;
+        return -1;
+    }
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    return fd;
+}
+
+
+int
+connect_unix(const std::string& path, std::string& errmsg)
+{
+    sockaddr_un addr;
+    if (!unix_address(path, addr)) {
+        errmsg = "invalid socket path '" + path + "'";
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        errmsg = "unable to connect to " + path + ": " + strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
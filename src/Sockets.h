@@ -0,0 +1,42 @@
+/*
+*  Sockets.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <string>
+
+
+/**
+ * Open a non-blocking TCP socket listening on the host and
+ * port, optionally with SO_REUSEPORT so several sockets can
+ * share the address. Returns the descriptor, or -1.
+ */
+int listen_tcp(const std::string& host, unsigned int port, bool reusePort);
+
+/**
+ * Open a non-blocking Unix domain socket listening at path,
+ * replacing any stale socket file left there by an earlier
+ * run. A socket some other server still answers on is left
+ * alone. Returns the descriptor, or -1 with the reason in
+ * errmsg.
+ */
+int listen_unix(const std::string& path, std::string& errmsg);
+
+/**
+ * Remove the socket file at path, as a server listening on
+ * it shuts down, so the next run finds the path clear.
+ */
+void unlink_unix(const std::string& path);
+
+/**
+ * Open a blocking connection to a TCP host and port, or to a
+ * Unix domain socket path. Return the descriptor, or -1 with
+ * the reason in errmsg.
+ */
+int connect_tcp(const std::string& host, unsigned int port, std::string& errmsg);
+int connect_unix(const std::string& path, std::string& errmsg);
@@ -5,9 +5,37 @@
 *  MIT License
 */
 
+// System headers
+#include <chrono>
+#include <map>
+
+// GEOS headers
+#include <geos/geom/CoordinateSequence.h>
+#include <geos/geom/LinearRing.h>
+#include <geos/geom/Location.h>
+#include <geos/geom/MultiPolygon.h>
+#include <geos/geom/Polygon.h>
+#include <geos/geom/prep/PreparedPolygon.h>
+
+// What the heap holds is only to be had from glibc 2.33 on
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#define SPATIAL_LOOKUP_MALLINFO2
+#include <malloc.h>
+#endif
+
 // App headers
 #include "SpatialLookup.h"
 
+using geos::geom::CoordinateSequence;
+using geos::geom::LinearRing;
+using geos::geom::Location;
+using geos::geom::LineString;
+using geos::geom::MultiPolygon;
+using geos::geom::Polygon;
+using geos::geom::prep::PreparedPolygon;
+
+using LoadClock = std::chrono::steady_clock;
+
 /*************************************************************************
  * SpatialLookup::LookupEntry
  */
@@ -18,9 +46,22 @@ SpatialLookup::LookupEntry::getEnvelopeInternal() const
     return m_prepgeom->getGeometry().getEnvelopeInternal();
 }
 
+PointOnGeometryLocator*
+SpatialLookup::LookupEntry::pointLocator(const PreparedGeometry& prepgeom)
+{
+    const PreparedPolygon* polygon = dynamic_cast<const PreparedPolygon*>(&prepgeom);
+    return polygon ? polygon->getPointLocator() : nullptr;
+}
+
 bool
 SpatialLookup::LookupEntry::intersects(const Coordinate& coord) const
 {
+    // A polygon intersects a point unless the point is outside
+    // it, which its locator answers with no Point to allocate
+    if (m_locator) {
+        return getEnvelopeInternal()->contains(coord) &&
+               m_locator->locate(&coord) != Location::EXTERIOR;
+    }
     const GeometryFactory* gf = m_prepgeom->getGeometry().getFactory();
     std::unique_ptr<Point> pt(gf->createPoint(coord));
     return m_prepgeom->intersects(pt.get());
@@ -33,14 +74,197 @@ SpatialLookup::LookupEntry::getFeature() const
 }
 
 
+/*************************************************************************
+ * Load accounting
+ */
+
+static double
+seconds_since(LoadClock::time_point start)
+{
+    return std::chrono::duration<double>(LoadClock::now() - start).count();
+}
+
+/**
+ * Bytes in use on the heap, to measure the GEOS structures
+ * we can't see into by how much they grow it. Zero where
+ * the allocator won't say.
+ */
+static std::size_t
+heap_in_use()
+{
+#ifdef SPATIAL_LOOKUP_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+static std::size_t
+heap_growth(std::size_t before)
+{
+    std::size_t after = heap_in_use();
+    return after > before ? after - before : 0;
+}
+
+static std::size_t
+ring_bytes(const LineString* ring)
+{
+    return sizeof(LinearRing) + sizeof(CoordinateSequence) +
+           ring->getNumPoints() * sizeof(Coordinate);
+}
+
+/**
+ * About what a polygonal geometry takes: its coordinates,
+ * and the objects holding its rings and polygons.
+ */
+static std::size_t
+geometry_bytes(const Geometry& geom)
+{
+    const Polygon* poly = dynamic_cast<const Polygon*>(&geom);
+    if (!poly) {
+        std::size_t bytes = sizeof(MultiPolygon);
+        for (std::size_t i = 0; i < geom.getNumGeometries(); i++)
+            bytes += geometry_bytes(*geom.getGeometryN(i));
+        return bytes;
+    }
+    std::size_t bytes = sizeof(Polygon) + ring_bytes(poly->getExteriorRing());
+    for (std::size_t i = 0; i < poly->getNumInteriorRing(); i++)
+        bytes += ring_bytes(poly->getInteriorRingN(i));
+    return bytes;
+}
+
+// Strings this long or shorter are held inside the string
+static const std::size_t kShortString = std::string().capacity();
+
+// Links and colour of a std::map node, beyond its pair
+static const std::size_t kMapNodeOverhead = 4 * sizeof(void*);
+
+static std::size_t
+string_bytes(const std::string& s)
+{
+    return s.capacity() > kShortString ? s.capacity() + 1 : 0;
+}
+
+static std::size_t properties_bytes(const std::map<std::string, GeoJSONValue>& props);
+
+static std::size_t
+value_bytes(const GeoJSONValue& v)
+{
+    std::size_t bytes = 0;
+    if (v.isString()) {
+        bytes += string_bytes(v.getString());
+    }
+    else if (v.isArray()) {
+        for (const GeoJSONValue& e : v.getArray())
+            bytes += sizeof(GeoJSONValue) + value_bytes(e);
+    }
+    else if (v.isObject()) {
+        bytes += properties_bytes(v.getObject());
+    }
+    return bytes;
+}
+
+/**
+ * About what a feature's properties take. Each entry keeps
+ * all of them, not just the one we look up.
+ */
+static std::size_t
+properties_bytes(const std::map<std::string, GeoJSONValue>& props)
+{
+    std::size_t bytes = 0;
+    for (const auto& kv : props)
+        bytes += kMapNodeOverhead + sizeof(kv) + string_bytes(kv.first) + value_bytes(kv.second);
+    return bytes;
+}
+
+
 /*************************************************************************
  * SpatialLookup
  */
 
+SpatialLookup::SpatialLookup(std::unique_ptr<SharedDataset> shared)
+    : m_filename(shared->filename())
+    , m_property(shared->property())
+    , m_index(nullptr)
+    , m_numVertices(shared->numVertices())
+    , m_dataready(true)
+    , m_shared(std::move(shared))
+{
+    // The values are copied out, small beside the polygons,
+    // so value() can go on handing out strings
+    LoadClock::time_point start = LoadClock::now();
+    m_values.reserve(m_shared->numValues());
+    for (std::size_t i = 0; i < m_shared->numValues(); i++) {
+        std::size_t len;
+        const char* v = m_shared->value(static_cast<uint32_t>(i), len);
+        m_values.emplace_back(v, len);
+    }
+
+    m_report.filename = m_filename;
+    m_report.property = m_property;
+    m_report.shared = m_shared->name();
+    m_report.sharedBytes = m_shared->bytes();
+    m_report.indexed = m_shared->numFeatures();
+    m_report.vertices = m_numVertices;
+    m_report.values = m_values.size();
+    m_report.attachSeconds = seconds_since(start);
+}
+
+
+std::size_t
+SpatialLookup::replicate()
+{
+    const NumaTopology& topo = NumaTopology::get();
+    if (topo.numNodes() < 2) {
+        std::cerr << "spatial_lookup: one NUMA node, nothing to replicate" << std::endl;
+        return 0;
+    }
+    if (!m_dataready || !m_replicas.empty())
+        return m_replicas.size();
+
+    LoadClock::time_point start = LoadClock::now();
+    std::unique_ptr<SharedDataset> built;
+    const SharedDataset* from = m_shared.get();
+    if (!from) {
+        built.reset(new SharedDataset);
+        if (!built->build(*this))
+            return 0;
+        from = built.get();
+    }
+
+    // Each copy is made by a thread on its node, so the pages
+    // it touches first are that node's
+    std::vector<std::unique_ptr<SharedDataset>> replicas;
+    for (std::size_t node = 0; node < topo.numNodes(); node++) {
+        std::unique_ptr<SharedDataset> replica(new SharedDataset);
+        bool ok = false;
+        numa_run_on_node(node, [&replica, from, &ok] {
+            ok = replica->copy(*from);
+        });
+        if (!ok)
+            return 0;
+        replicas.push_back(std::move(replica));
+    }
+    m_replicas = std::move(replicas);
+
+    // Entry ids now count in the replicas' tree order, and
+    // nothing reads the GEOS structures any more
+    m_index.reset();
+    std::vector<LookupEntry>().swap(m_lookups);
+
+    m_report.replicas = m_replicas.size();
+    m_report.replicaBytes = from->bytes();
+    m_report.replicateSeconds = seconds_since(start);
+    return m_replicas.size();
+}
+
+
 bool
 SpatialLookup::readGeoJsonFile()
 {
     // Load the filename into an in-memory string
+    LoadClock::time_point start = LoadClock::now();
     std::ifstream ifs(m_filename);
 
     // File is not readable / does not exist
@@ -51,11 +275,15 @@ SpatialLookup::readGeoJsonFile()
 
     std::string content((std::istreambuf_iterator<char>(ifs) ),
                         (std::istreambuf_iterator<char>()    ));
+    m_report.fileBytes = content.size();
+    m_report.readSeconds = seconds_since(start);
 
     try {
         // Parse the GeoJSON string into a feature collection
+        start = LoadClock::now();
         GeoJSONReader reader;
         GeoJSONFeatureCollection fc = reader.readFeatures(content);
+        m_report.parseSeconds = seconds_since(start);
 
         // Just stop if there are no features
         if (fc.getFeatures().empty()) {
@@ -63,14 +291,61 @@ SpatialLookup::readGeoJsonFile()
             return false;
         }
 
-        // We can't easily hold a reference to the collection
-        // so we copy out what we care about, the vector of features
+        // First pick out the features we care about. The
+        // property values are interned as we go, so each
+        // distinct value is stored once and features refer to
+        // it by number.
+        start = LoadClock::now();
+        std::unordered_map<std::string, uint32_t> valueIds;
+        std::vector<std::pair<const GeoJSONFeature*, uint32_t>> keep;
+        std::size_t missing = 0;
         for (auto& feature: fc.getFeatures()) {
             const Geometry* geom = feature.getGeometry();
-            if (geom && geom->isPolygonal()) {
-                m_lookups.emplace_back(feature);
+            m_report.featureTypes[geom ? geom->getGeometryType() : "null"]++;
+            if (!(geom && geom->isPolygonal())) {
+                m_report.notPolygonal++;
+                continue;
             }
-        }        
+
+            auto& props = feature.getProperties();
+            auto it = props.find(m_property);
+            if (it == props.end() || !it->second.isString()) {
+                missing++;
+                continue;
+            }
+            const std::string& v = it->second.getString();
+            auto ins = valueIds.emplace(v, static_cast<uint32_t>(m_values.size()));
+            if (ins.second)
+                m_values.push_back(v);
+            keep.emplace_back(&feature, ins.first->second);
+            m_numVertices += geom->getNumPoints();
+        }
+        m_report.extractSeconds = seconds_since(start);
+        if (missing) {
+            std::cerr << "spatial_lookup: skipped " << missing << " polygonal features with no string '"
+                      << m_property << "' property" << std::endl;
+        }
+
+        // We can't easily hold a reference to the collection
+        // so we copy out what we care about, and prepare the
+        // geometry of each.
+        start = LoadClock::now();
+        m_lookups.reserve(keep.size());
+        for (auto& k : keep)
+            m_lookups.emplace_back(*k.first, k.second);
+        m_report.prepareSeconds = seconds_since(start);
+
+        m_report.featuresRead = fc.getFeatures().size();
+        m_report.missingProperty = missing;
+        m_report.indexed = m_lookups.size();
+        m_report.vertices = m_numVertices;
+        m_report.values = m_values.size();
+        for (const std::string& v : m_values)
+            m_report.propertyBytes += sizeof(v) + string_bytes(v);
+        for (const LookupEntry& e : m_lookups) {
+            m_report.geometryBytes += geometry_bytes(*e.getFeature().getGeometry());
+            m_report.propertyBytes += properties_bytes(e.getFeature().getProperties());
+        }
     }
     catch (std::exception& e) {
         std::string what(e.what());
@@ -86,6 +361,9 @@ SpatialLookup::readGeoJsonFile()
 bool
 SpatialLookup::createIndex()
 {
+    LoadClock::time_point start = LoadClock::now();
+    std::size_t heap = heap_in_use();
+
     // Set up a new empty spatial index. Pre-reserving the 
     // size will make building a tiny bit faster.
     m_index.reset(new TemplateSTRtree<LookupEntry*, EnvelopeTraits>(m_lookups.size()));
@@ -96,116 +374,171 @@ SpatialLookup::createIndex()
     for (auto& entry: m_lookups) {
         m_index->insert(&entry);
     }
+
+    // The tree builds itself lazily on the first query, which
+    // is not safe when several threads query at once, so build
+    // it up front while we are still single threaded.
+    m_index->build();
+    m_report.indexSeconds = seconds_since(start);
+    m_report.indexBytes = heap_growth(heap);
     return true;
 }
 
 
+/**
+ * Prepared geometries build their own indexes lazily, on the
+ * first test against them, which would leave the first lookup
+ * to hit each polygon paying for it, and several threads
+ * racing to build it. One test apiece builds them all up front.
+ */
+void
+SpatialLookup::warmUp()
+{
+    LoadClock::time_point start = LoadClock::now();
+    std::size_t heap = heap_in_use();
+    for (const LookupEntry& e : m_lookups) {
+        Coordinate c;
+        e.getEnvelopeInternal()->centre(c);
+        e.intersects(c);
+    }
+    m_report.warmUpSeconds = seconds_since(start);
+    m_report.preparedBytes = m_lookups.size() * sizeof(PreparedPolygon) + heap_growth(heap);
+}
+
+
 std::vector<std::string>
-SpatialLookup::lookup(const Coordinate& coord) const
+SpatialLookup::lookup(const Coordinate& coord, LookupStats* stats) const
 {
     // Return value
     std::vector<std::string> properties;
-    // In unfortunate case we're running without data, just return
+    visitHits(coord, [&properties, this](uint32_t valueId) {
+        properties.push_back(m_values[valueId]);
+    }, stats);
+    return properties;
+}
+
+
+void
+SpatialLookup::lookupIds(const Coordinate& coord, std::vector<uint32_t>& ids,
+                         LookupStats* stats) const
+{
+    visitHits(coord, [&ids](uint32_t valueId) {
+        ids.push_back(valueId);
+    }, stats);
+}
+
+
+std::size_t
+SpatialLookup::lookupIds(const Coordinate& coord, uint32_t* ids,
+                         std::size_t capacity) const
+{
     if (!m_dataready)
-        return properties;
-
-    // Lambda for the STRtree index search. If we've got a hit that 
-    // intersects with the underlying polygon, then look into
-    // the feature and read back the desired property.
-    auto visitor = [&properties, &coord, this](const LookupEntry* e) {
-        if (e->intersects(coord)) {
-            const GeoJSONFeature& feature = e->getFeature();
-            auto& props = feature.getProperties();
-            GeoJSONValue v = props.at(m_property);
-            properties.push_back(v.getString());
+        return 0;
+    const SharedDataset* ds = dataset();
+    std::size_t n = 0;
+    queryIndex(ds, coord, [ds, &coord, ids, capacity, &n, this](uint32_t id) {
+        if (entryIntersects(ds, id, coord)) {
+            if (n < capacity)
+                ids[n] = entryValueId(ds, id);
+            n++;
         }
-    };
+    });
+    return n;
+}
 
-    // Run the query with the callback.
-    Envelope qe(coord.x, coord.x, coord.y, coord.y);
-    m_index->query(qe, visitor);
-    return properties;
+
+void
+SpatialLookup::lookupBatch(const Coordinate* coords, std::size_t count,
+                           std::vector<uint32_t>& ids,
+                           std::vector<std::size_t>& ends) const
+{
+    ends.reserve(ends.size() + count);
+    if (!m_dataready) {
+        ends.insert(ends.end(), count, ids.size());
+        return;
+    }
+    // Straight to the index, skipping the stats kept by visitHits()
+    const SharedDataset* ds = dataset();
+    for (std::size_t i = 0; i < count; i++) {
+        const Coordinate& coord = coords[i];
+        queryIndex(ds, coord, [ds, &coord, &ids, this](uint32_t id) {
+            if (entryIntersects(ds, id, coord))
+                ids.push_back(entryValueId(ds, id));
+        });
+        ends.push_back(ids.size());
+    }
 }
 
 
-/*************************************************************************
- * main
- */
+std::size_t
+SpatialLookup::entryVertices(uint32_t entryId) const
+{
+    if (const SharedDataset* ds = dataset())
+        return ds->vertices(entryId);
+    return m_lookups[entryId].getFeature().getGeometry()->getNumPoints();
+}
 
-/*
- * HTTP library is from 
- * https://github.com/yhirose/cpp-httplib 
+
+void
+SpatialLookup::candidates(const Coordinate& coord, std::vector<uint32_t>& entryIds) const
+{
+    if (!m_dataready)
+        return;
+    queryIndex(dataset(), coord, [&entryIds](uint32_t id) {
+        entryIds.push_back(id);
+    });
+}
+
+
+/*************************************************************************
+ * Output
  */
-#include "vend/httplib.h"
-using namespace httplib;
 
 /**
  * Convert a vector of strings into a JSON array.
- * Must be a nicer way to do this.
  */
-static std::string
-hits_to_json(std::vector<std::string>& hits)
+std::string
+hits_to_json(const std::vector<std::string>& hits)
 {
-    std::stringstream ss;
-    ss << "[";
-    std::size_t count = 0;
-    std::size_t length = std::distance(hits.begin(), hits.end());
-    for (auto it = hits.begin(); it != hits.end(); ++it, ++count) {
-        ss << '"' << *it << '"';
-        if (count < length - 1)
-            ss << ",";
+    std::string out = "[";
+    for (std::size_t i = 0; i < hits.size(); i++) {
+        if (i)
+            out += ',';
+        append_json_string(out, hits[i]);
     }
-    ss << "]" << std::endl;
-    return ss.str();
+    out += "]\n";
+    return out;
 }
 
-/**
- * Run it!
- */
-int
-main(int argc, char* argv[])
-{
-    // Default listen address
-    unsigned int port = 8080;
-    const std::string host = "localhost";
-
-    // Two commandline arguments are required:
-    // The geojson file, and the property to respond with.
-    if (argc != 3) {
-        std::cerr << "Usage: spatial_lookup geojson.json property" << std::endl;
-        exit(1);
-    }
-
-    // Load the file and build the indexes
-    SpatialLookup splu(argv[1], argv[2]);
-    if (!splu.ready()) {
-        std::cerr << "spatial_lookup: data load failed" << std::endl;
-        return 1;
-    }
-    std::cerr << "spatial_lookup: loaded and indexed " << argv[1] << std::endl;
-
-    // Set up HTTP end point, read the 'x' and 'y' HTTP request
-    // parameters
-    Server svr;
-    svr.Get("/lookup", [&splu](const Request& req, Response& res) {
-        // Only respond to a request with both parameters
-        if(req.has_param("x") && req.has_param("y")) {
-            std::string sX = req.get_param_value("x");
-            std::string sY = req.get_param_value("y");
-            // Unparsable numbers result in 0.0 so Null Island
-            // may be a common query request
-            double x = std::atof(sX.c_str());
-            double y = std::atof(sY.c_str());
-            // Indexed lookup of the coordinate against the data!
-            std::vector<std::string> hits = splu.lookup(Coordinate(x, y));
-            res.set_content(hits_to_json(hits), "application/json");
-        }
-    });
 
-    // Start the server
-    std::cerr << "spatial_lookup: listening on " << host << ":" << port << std::endl;
-    svr.listen("localhost", 8080);
-    return 0;
+void
+append_json_string(std::string& out, const std::string& value)
+{
+    static const char* kHex = "0123456789abcdef";
+    out += '"';
+    // Copy the runs that need no escape in one go
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < value.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(value[i]);
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        out.append(value, run, i - run);
+        run = i + 1;
+        out += '\\';
+        switch (c) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '\b': out += 'b'; break;
+        case '\f': out += 'f'; break;
+        case '\n': out += 'n'; break;
+        case '\r': out += 'r'; break;
+        case '\t': out += 't'; break;
+        default:
+            out += "u00";
+            out += kHex[c >> 4];
+            out += kHex[c & 0xf];
+        }
+    }
+    out.append(value, run, std::string::npos);
+    out += '"';
 }
-
-
@@ -11,12 +11,16 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include <cstdlib>
+#include <cstdint>
 
 // GEOS headers
+#include <geos/algorithm/locate/PointOnGeometryLocator.h>
 #include <geos/geom/Coordinate.h>
 #include <geos/geom/Envelope.h>
 #include <geos/geom/Geometry.h>
@@ -28,7 +32,15 @@
 #include <geos/io/GeoJSON.h>
 #include <geos/io/GeoJSONReader.h>
 
+// App headers
+#include "FeatureProfile.h"
+#include "LoadReport.h"
+#include "Numa.h"
+#include "SharedDataset.h"
+#include "StageTimer.h"
+
 // Short names
+using geos::algorithm::locate::PointOnGeometryLocator;
 using geos::geom::GeometryFactory;
 using geos::geom::Coordinate;
 using geos::geom::Envelope;
@@ -44,6 +56,33 @@ using geos::io::GeoJSONReader;
 using geos::io::GeoJSONValue;
 
 
+/**
+ * What a single lookup cost: the index entries whose bounding
+ * boxes hold the coordinate, the point in polygon tests run on
+ * them, and how many of those tests hit.
+ *
+ * The entries tested are listed in tested, as far as there is
+ * room, by the ids that SpatialLookup::entryValueId() and
+ * entryVertices() take.
+ *
+ * Set timeStages beforehand to also have the INDEX, INTERSECTS
+ * and PROPERTIES stages timed into stages, which costs a few
+ * cycle_count() reads per candidate. Set profile to have each
+ * test timed and counted against its entry as well.
+ */
+struct LookupStats {
+    static constexpr uint32_t kMaxTested = 16;
+
+    uint32_t candidates = 0;
+    uint32_t tests = 0;
+    uint32_t hits = 0;
+    uint32_t tested[kMaxTested];
+    bool timeStages = false;
+    StageTicks stages;
+    FeatureProfile* profile = nullptr;
+};
+
+
 /**
  * This class wraps up the functionality needed to provide an
  * in-memory reverse geocoder. At start-up, the class reads in
@@ -75,9 +114,11 @@ public:
     public:
 
         // Constructor
-        LookupEntry(const GeoJSONFeature& feature)
+        LookupEntry(const GeoJSONFeature& feature, uint32_t valueId)
             : m_feature(feature) // take a copy of feature first, then use it next
             , m_prepgeom(PreparedGeometryFactory::prepare(m_feature.getGeometry()))
+            , m_locator(pointLocator(*m_prepgeom))
+            , m_valueId(valueId)
             {};
 
         /**
@@ -90,11 +131,26 @@ public:
         const GeoJSONFeature& getFeature() const;
         bool intersects(const Coordinate& coord) const;
 
+        /**
+         * The interned id of this feature's value for the
+         * property of interest, see SpatialLookup::value().
+         */
+        uint32_t getValueId() const { return m_valueId; }
+
     private:
 
+        /**
+         * The point locator of a prepared polygon, which tests
+         * a coordinate without making a Point of it first, or
+         * null for any other kind of prepared geometry.
+         */
+        static PointOnGeometryLocator* pointLocator(const PreparedGeometry& prepgeom);
+
         // Members
         GeoJSONFeature m_feature;
         std::unique_ptr<PreparedGeometry> m_prepgeom;
+        PointOnGeometryLocator* m_locator;  // owned by m_prepgeom
+        uint32_t m_valueId;
 
     };
 
@@ -109,19 +165,131 @@ public:
         : m_filename(filename)
         , m_property(property)
         , m_index(nullptr)
+        , m_numVertices(0)
         , m_dataready(false)
     {
+        m_report.filename = filename;
+        m_report.property = property;
         m_dataready = readGeoJsonFile() && createIndex();
+        if (m_dataready)
+            warmUp();
     }
 
+    /**
+     * Serve a data set another process has published to
+     * shared memory, rather than loading one of our own.
+     */
+    explicit SpatialLookup(std::unique_ptr<SharedDataset> shared);
+
     /**
      * Given a coordinate, search the spatial index and
      * return a list of values for the property of interest.
+     * If stats is given, it is filled in with what the
+     * lookup had to do.
+     */
+    std::vector<std::string> lookup(const Coordinate& coord,
+                                    LookupStats* stats = nullptr) const;
+
+    /**
+     * As lookup(), but append the interned ids of the values
+     * to the ids vector, rather than returning copies of the
+     * strings. Distinct property values are stored only once,
+     * and value() turns an id back into its string.
+     */
+    void lookupIds(const Coordinate& coord, std::vector<uint32_t>& ids,
+                   LookupStats* stats = nullptr) const;
+
+    /**
+     * As lookupIds(), but write the ids into the caller's
+     * array, as many as fit in capacity, and allocate
+     * nothing. Returns the number of hits, which may be more
+     * than capacity, in which case the rest are left out.
+     */
+    std::size_t lookupIds(const Coordinate& coord, uint32_t* ids,
+                          std::size_t capacity) const;
+
+    /**
+     * Look up count coordinates in one call, appending the
+     * value ids of the hits of each to ids, and then the size
+     * of ids to ends, so the hits of coords[i] run from
+     * ends[i-1] (or where ids started, for the first) to
+     * ends[i]. Saves the per call overheads of lookupIds()
+     * for callers with many points to hand at once.
+     */
+    void lookupBatch(const Coordinate* coords, std::size_t count,
+                     std::vector<uint32_t>& ids,
+                     std::vector<std::size_t>& ends) const;
+
+    const std::string& value(uint32_t id) const {
+        return m_values[id];
+    }
+    std::size_t numValues() const {
+        return m_values.size();
+    }
+
+    /**
+     * Size of the indexed data: polygonal features,
+     * and the vertices in them.
      */
-    std::vector<std::string> lookup(const Coordinate& coord) const;
+    std::size_t numFeatures() const {
+        const SharedDataset* ds = dataset();
+        return ds ? ds->numFeatures() : m_lookups.size();
+    }
+    std::size_t numVertices() const {
+        return m_numVertices;
+    }
+
+    /**
+     * Details of an entry listed in LookupStats::tested.
+     */
+    uint32_t entryValueId(uint32_t entryId) const {
+        return entryValueId(dataset(), entryId);
+    }
+    std::size_t entryVertices(uint32_t entryId) const;
+
+    /**
+     * The indexed entry itself, and the ids of the entries
+     * whose bounding boxes hold the coordinate, before any
+     * polygon test, so the parts of a lookup can be measured
+     * on their own. There are no entries to a shared or
+     * replicated data set, only candidates.
+     */
+    const LookupEntry& entry(uint32_t entryId) const {
+        return m_lookups[entryId];
+    }
+    void candidates(const Coordinate& coord, std::vector<uint32_t>& entryIds) const;
+
     bool ready(void) const {
         return m_dataready;
     }
+    bool hasEntries() const {
+        return m_index != nullptr;
+    }
+
+    /**
+     * The shared memory data set served, if any.
+     */
+    const SharedDataset* shared() const {
+        return m_shared.get();
+    }
+
+    /**
+     * Copy the data set into the memory of each NUMA node, for
+     * lookups to read from the copy on the node they run on,
+     * rather than across the interconnect. A data set loaded
+     * from a file is laid out as for shared memory first, and
+     * its GEOS structures freed. Does nothing on a machine of
+     * one node. Call before serving any lookups. Returns the
+     * number of copies, or zero having said why.
+     */
+    std::size_t replicate();
+
+    /**
+     * What loading took: times, feature counts and memory.
+     */
+    const LoadReport& loadReport() const {
+        return m_report;
+    }
 
 private:
 
@@ -130,11 +298,151 @@ private:
     const std::string m_property;
     std::unique_ptr<TemplateSTRtree<LookupEntry*, EnvelopeTraits>> m_index;
     std::vector<LookupEntry> m_lookups;
+    std::vector<std::string> m_values;
+    std::size_t m_numVertices;
     bool m_dataready;
+    LoadReport m_report;
+    std::unique_ptr<SharedDataset> m_shared;
+    std::vector<std::unique_ptr<SharedDataset>> m_replicas;
 
     // Methods
     bool readGeoJsonFile();
     bool createIndex();
+    void warmUp();
+
+    uint32_t entryId(const LookupEntry* e) const {
+        return static_cast<uint32_t>(e - m_lookups.data());
+    }
+
+    /**
+     * The flat data set to read, if any: the replica on this
+     * thread's node, or the shared memory one. Finding the node
+     * isn't free, so a lookup asks once and passes the answer
+     * to the methods below.
+     */
+    const SharedDataset* dataset() const {
+        if (!m_replicas.empty())
+            return m_replicas[numa_current_node() % m_replicas.size()].get();
+        return m_shared.get();
+    }
+
+    /**
+     * Call fn(entryId) for each entry whose bounding box holds
+     * the coordinate, from the flat data set ds if there is one
+     * or else the GEOS index, and test an entry against the
+     * coordinate, or get its value, from the same.
+     */
+    template<typename Fn>
+    void queryIndex(const SharedDataset* ds, const Coordinate& coord, Fn&& fn) const
+    {
+        if (ds) {
+            ds->query(coord, fn);
+            return;
+        }
+        Envelope qe(coord.x, coord.x, coord.y, coord.y);
+        m_index->query(qe, [&fn, this](const LookupEntry* e) {
+            fn(entryId(e));
+        });
+    }
+
+    bool entryIntersects(const SharedDataset* ds, uint32_t id, const Coordinate& coord) const {
+        return ds ? ds->intersects(id, coord) : m_lookups[id].intersects(coord);
+    }
+
+    uint32_t entryValueId(const SharedDataset* ds, uint32_t id) const {
+        return ds ? ds->valueId(id) : m_lookups[id].getValueId();
+    }
+
+    /**
+     * Run the index query and call visitor(valueId) for
+     * each entry that really contains the coordinate,
+     * counting the work into stats if it is given.
+     */
+    template<typename Visitor>
+    void visitHits(const Coordinate& coord, Visitor&& visitor, LookupStats* stats) const
+    {
+        LookupStats unused;
+        LookupStats& st = stats ? *stats : unused;
+        bool timeStages = st.timeStages;
+        FeatureProfile* profile = st.profile;
+        st = LookupStats();
+        st.timeStages = timeStages;
+        st.profile = profile;
+
+        // In unfortunate case we're running without data, just return
+        if (!m_dataready)
+            return;
+
+        const SharedDataset* ds = dataset();
+        if (timeStages || profile) {
+            visitHitsTimed(ds, coord, visitor, st);
+            return;
+        }
+
+        // Lambda for the index search. If we've got a hit that
+        // intersects with the underlying polygon, pass it on.
+        auto filter = [ds, &coord, &visitor, &st, this](uint32_t id) {
+            st.candidates++;
+            if (st.tests < LookupStats::kMaxTested)
+                st.tested[st.tests] = id;
+            st.tests++;
+            if (entryIntersects(ds, id, coord)) {
+                st.hits++;
+                visitor(entryValueId(ds, id));
+            }
+        };
+
+        // Run the query with the callback.
+        queryIndex(ds, coord, filter);
+    }
+
+    /**
+     * As visitHits(), timing the tests and the visitor as they
+     * go, and charging the rest of the query to the index.
+     * Each test also goes to the feature profile, if any.
+     */
+    template<typename Visitor>
+    void visitHitsTimed(const SharedDataset* ds, const Coordinate& coord, Visitor& visitor, LookupStats& st) const
+    {
+        uint64_t testTicks = 0;
+        uint64_t valueTicks = 0;
+        auto filter = [&](uint32_t id) {
+            st.candidates++;
+            if (st.tests < LookupStats::kMaxTested)
+                st.tested[st.tests] = id;
+            st.tests++;
+            uint64_t t0 = cycle_count();
+            bool hit = entryIntersects(ds, id, coord);
+            uint64_t t1 = cycle_count();
+            testTicks += t1 - t0;
+            if (st.profile)
+                st.profile->record(id, hit, t1 - t0);
+            if (hit) {
+                st.hits++;
+                visitor(entryValueId(ds, id));
+                valueTicks += cycle_count() - t1;
+            }
+        };
+
+        uint64_t start = cycle_count();
+        queryIndex(ds, coord, filter);
+        uint64_t total = cycle_count() - start;
+        st.stages[Stage::INTERSECTS] = testTicks;
+        st.stages[Stage::PROPERTIES] = valueTicks;
+        st.stages[Stage::INDEX] = total > testTicks + valueTicks ? total - testTicks - valueTicks : 0;
+    }
 
 };
 
+/**
+ * Convert the list of hits returned by SpatialLookup::lookup()
+ * into the JSON array returned to HTTP clients.
+ */
+std::string hits_to_json(const std::vector<std::string>& hits);
+
+/**
+ * Append a property value to out as a JSON string, quoted and
+ * escaped. Values come from the data file as they are, so any
+ * of them may hold a quote, a backslash or a control character.
+ */
+void append_json_string(std::string& out, const std::string& value);
@@ -0,0 +1,127 @@
+/*
+*  SpatialLookupC.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <exception>
+#include <iostream>
+#include <memory>
+
+// App headers
+#include "SpatialLookup.h"
+#include "SpatialLookupC.h"
+
+struct sl_handle {
+    SpatialLookup splu;
+
+    sl_handle(const char* filename, const char* property)
+        : splu(filename, property)
+    {}
+
+    explicit sl_handle(std::unique_ptr<SharedDataset> shared)
+        : splu(std::move(shared))
+    {}
+};
+
+
+sl_handle*
+sl_open(const char* filename, const char* property)
+{
+    if (!filename || !property)
+        return nullptr;
+
+    // Nothing may be thrown back into C, so anything that
+    // goes wrong loading is a failure like any other
+    sl_handle* sl = nullptr;
+    try {
+        sl = new sl_handle(filename, property);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "spatial_lookup: " << e.what() << std::endl;
+        return nullptr;
+    }
+    if (!sl->splu.ready()) {
+        delete sl;
+        return nullptr;
+    }
+    return sl;
+}
+
+
+sl_handle*
+sl_attach(const char* name)
+{
+    if (!name)
+        return nullptr;
+    try {
+        std::unique_ptr<SharedDataset> shared(new SharedDataset);
+        if (!shared->attach(name))
+            return nullptr;
+        return new sl_handle(std::move(shared));
+    }
+    catch (const std::exception& e) {
+        std::cerr << "spatial_lookup: " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+
+void
+sl_close(sl_handle* sl)
+{
+    delete sl;
+}
+
+
+sl_status
+sl_lookup(const sl_handle* sl, double x, double y,
+          uint32_t* ids, size_t capacity, size_t* count)
+{
+    if (!sl || !count || (!ids && capacity))
+        return SL_INVALID;
+    *count = sl->splu.lookupIds(Coordinate(x, y), ids, capacity);
+    return *count > capacity ? SL_TRUNCATED : SL_OK;
+}
+
+
+sl_status
+sl_lookup_batch(const sl_handle* sl, const double* xy, size_t count,
+                uint32_t* ids, size_t capacity, size_t* offsets)
+{
+    if (!sl || !offsets || (!xy && count) || (!ids && capacity))
+        return SL_INVALID;
+
+    // Once ids is full, keep looking up with no room left,
+    // just to count what the rest would need
+    size_t n = 0;
+    offsets[0] = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t room = n < capacity ? capacity - n : 0;
+        n += sl->splu.lookupIds(Coordinate(xy[2 * i], xy[2 * i + 1]),
+                                room ? ids + n : nullptr, room);
+        offsets[i + 1] = n;
+    }
+    return n > capacity ? SL_TRUNCATED : SL_OK;
+}
+
+
+const char*
+sl_value(const sl_handle* sl, uint32_t id, size_t* len)
+{
+    if (!sl || id >= sl->splu.numValues())
+        return nullptr;
+    const std::string& value = sl->splu.value(id);
+    if (len)
+        *len = value.size();
+    return value.c_str();
+}
+
+
+size_t
+sl_num_values(const sl_handle* sl)
+{
+    return sl ? sl->splu.numValues() : 0;
+}
@@ -0,0 +1,97 @@
+/*
+*  SpatialLookupC.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+/*
+ * A plain C interface to the lookup engine, for programs in
+ * other languages to link and call through their foreign
+ * function interfaces instead of going over HTTP.
+ *
+ * Lookups write the interned ids of the values they find into
+ * arrays the caller provides, and allocate nothing. sl_value()
+ * turns an id back into its string. A handle is read-only once
+ * open, so any number of threads can look up through it at
+ * once, until sl_close().
+ */
+
+#ifndef SPATIAL_LOOKUP_C_H
+#define SPATIAL_LOOKUP_C_H
+
+// System headers
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct sl_handle sl_handle;
+
+/**
+ * Results of the lookup calls. SL_TRUNCATED means the ids
+ * did not all fit in the array given, and the counts say how
+ * big an array would have held them.
+ */
+typedef enum {
+    SL_OK = 0,
+    SL_TRUNCATED = 1,
+    SL_INVALID = -1
+} sl_status;
+
+/**
+ * Load and index the polygons of a GeoJSON file, to look up
+ * the given property of. Returns NULL, having written the
+ * reason to standard error, if the file can't be loaded.
+ */
+sl_handle* sl_open(const char* filename, const char* property);
+
+/**
+ * Take up a data set published to shared memory by
+ * spatial_lookup_publish, under the given name, rather than
+ * loading one. Returns NULL, as sl_open() does, on failure.
+ */
+sl_handle* sl_attach(const char* name);
+
+/**
+ * Free everything belonging to the handle, including the
+ * strings returned by sl_value(). NULL is ignored.
+ */
+void sl_close(sl_handle* sl);
+
+/**
+ * Look up the point x, y. Up to capacity value ids are
+ * written to ids, and the number of hits to *count.
+ */
+sl_status sl_lookup(const sl_handle* sl, double x, double y,
+                    uint32_t* ids, size_t capacity, size_t* count);
+
+/**
+ * Look up count points, given as x, y pairs in xy. The ids
+ * found are written to ids one point after another, so the
+ * hits of point i are ids[offsets[i]] up to ids[offsets[i+1]];
+ * offsets must have room for count + 1 entries. If ids fills
+ * up, the offsets go on counting, so offsets[count] is the
+ * capacity needed to try again.
+ */
+sl_status sl_lookup_batch(const sl_handle* sl, const double* xy, size_t count,
+                          uint32_t* ids, size_t capacity, size_t* offsets);
+
+/**
+ * The string of a value id, NUL terminated, with its length
+ * in *len if len is not NULL. NULL for an unknown id.
+ */
+const char* sl_value(const sl_handle* sl, uint32_t id, size_t* len);
+
+/**
+ * Number of distinct values, so ids run from 0 to one less.
+ */
+size_t sl_num_values(const sl_handle* sl);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+/*
+*  StageTimer.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <cstdio>
+#include <thread>
+
+// App headers
+#include "StageTimer.h"
+
+
+double
+nanos_per_cycle()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    // Count ticks across a short sleep. Modern x86 parts tick
+    // at a constant rate whatever the clock speed, so once is
+    // enough.
+    static const double ratio = [] {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point t0 = Clock::now();
+        uint64_t c0 = cycle_count();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t c1 = cycle_count();
+        Clock::time_point t1 = Clock::now();
+        double nanos = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+        return c1 > c0 ? nanos / static_cast<double>(c1 - c0) : 1.0;
+    }();
+    return ratio;
+#else
+    return 1.0;
+#endif
+}
+
+
+const char*
+stage_name(Stage stage)
+{
+    switch (stage) {
+    case Stage::PARSE:
+        return "parse";
+    case Stage::INDEX:
+        return "index";
+    case Stage::INTERSECTS:
+        return "intersects";
+    case Stage::PROPERTIES:
+        return "properties";
+    case Stage::RENDER:
+        return "render";
+    }
+    return "unknown";
+}
+
+
+std::string
+stages_json(const StageTicks& stages)
+{
+    double scale = nanos_per_cycle() / 1000.0;
+    std::string out = "{";
+    for (std::size_t i = 0; i < kStages; i++) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s\"%s\":%.3f", i ? "," : "",
+                 stage_name(static_cast<Stage>(i)), stages.ticks[i] * scale);
+        out += buf;
+    }
+    out += "}";
+    return out;
+}
@@ -0,0 +1,76 @@
+/*
+*  StageTimer.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/**
+ * A cheap, monotonic tick count for timing stages of a single
+ * lookup: the time stamp counter where there is one, which
+ * costs a few nanoseconds to read rather than a clock_gettime
+ * call, and nanoseconds from steady_clock elsewhere.
+ */
+inline uint64_t
+cycle_count()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/**
+ * Nanoseconds per cycle_count() tick. Measured against
+ * steady_clock on the first call, which takes a few
+ * milliseconds, so call it once at start up.
+ */
+double nanos_per_cycle();
+
+/**
+ * The stages a /lookup request goes through: reading the
+ * request, descending the index, the point in polygon tests,
+ * gathering the property values of the hits, and writing out
+ * the response.
+ */
+enum class Stage {
+    PARSE,
+    INDEX,
+    INTERSECTS,
+    PROPERTIES,
+    RENDER
+};
+
+static const std::size_t kStages = 5;
+
+const char* stage_name(Stage stage);
+
+/**
+ * Ticks spent in each stage of one request.
+ */
+struct StageTicks {
+    uint64_t ticks[kStages] = {};
+
+    uint64_t& operator[](Stage s) { return ticks[static_cast<std::size_t>(s)]; }
+    uint64_t operator[](Stage s) const { return ticks[static_cast<std::size_t>(s)]; }
+};
+
+/**
+ * The stages as a JSON object of microseconds, for
+ * /lookup?debug=1.
+ */
+std::string stages_json(const StageTicks& stages);
@@ -0,0 +1,624 @@
+/*
+*  main.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <atomic>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+// App headers
+#include "SpatialLookup.h"
+#include "AdmissionControl.h"
+#include "Admin.h"
+#include "BinaryServer.h"
+#include "Compression.h"
+#include "EpollServer.h"
+#include "LookupQuery.h"
+#include "LookupStream.h"
+#include "Metrics.h"
+#include "Numa.h"
+#include "QueryCapture.h"
+#include "ServerOptions.h"
+#include "SlowQueryLog.h"
+#include "Sockets.h"
+
+/*
+ * HTTP library is from
+ * https://github.com/yhirose/cpp-httplib
+ */
+#include "vend/httplib.h"
+using namespace httplib;
+
+// Set on the accept thread while it disposes of a connection
+// that there is no room even to turn away properly
+static thread_local bool t_dropping = false;
+
+/**
+ * httplib only binds TCP addresses, so hand it a Unix domain
+ * socket we opened ourselves. Everything past accept() works
+ * the same on either kind of stream socket.
+ *
+ * It also lets the accept thread drop a connection without
+ * reading from it, which httplib has no way to do.
+ */
+class UnixSocketServer : public Server {
+
+public:
+
+    ~UnixSocketServer()
+    {
+        if (!m_path.empty())
+            unlink_unix(m_path);
+    }
+
+    bool
+    bindUnix(const std::string& path)
+    {
+        std::string errmsg;
+        int fd = listen_unix(path, errmsg);
+        if (fd < 0) {
+            std::cerr << "spatial_lookup: " << errmsg << std::endl;
+            return false;
+        }
+        // The httplib accept loop expects a blocking socket
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        svr_sock_ = fd;
+        m_path = path;
+        return true;
+    }
+
+private:
+
+    bool
+    process_and_close_socket(socket_t sock) override
+    {
+        bool ret = true;
+        if (t_dropping) {
+            // Whatever the client sends, we never wait on it:
+            // one write that can't block, and it is gone
+            static const std::string kBody = "{\"error\":\"server is overloaded\"}\n";
+            static const std::string kResponse =
+                "HTTP/1.1 503 Service Unavailable\r\n"
+                "Retry-After: 1\r\n"
+                "Connection: close\r\n"
+                "Content-Type: application/json\r\n"
+                "Content-Length: " + std::to_string(kBody.size()) + "\r\n"
+                "\r\n" + kBody;
+            ssize_t sent = send(sock, kResponse.data(), kResponse.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            (void)sent;
+        }
+        else {
+            // As httplib's own, which is private to it
+            ret = detail::process_server_socket(svr_sock_, sock, keep_alive_max_count_, keep_alive_timeout_sec_,
+                read_timeout_sec_, read_timeout_usec_, write_timeout_sec_, write_timeout_usec_,
+                [this](Stream& strm, bool closeConnection, bool& connectionClosed) {
+                    return process_request(strm, closeConnection, connectionClosed, nullptr);
+                });
+        }
+        detail::shutdown_socket(sock);
+        detail::close_socket(sock);
+        return ret;
+    }
+
+    std::string m_path;
+
+};
+
+// Set while a pool thread is answering a connection that
+// admission control has turned away
+static thread_local bool t_shedding = false;
+
+// Threads answering turned away connections. httplib only hands
+// over a connection along with its request loop, so each of
+// these still reads one request before it can answer 503.
+static const std::size_t kShedThreads = 2;
+
+// Turned away connections queued for those threads, past which
+// the accept thread drops them
+static const std::size_t kMaxShedQueue = 256;
+
+// The fewest pool threads each SO_REUSEPORT listener gets
+static const std::size_t kMinListenerThreads = 4;
+
+/**
+ * httplib's ThreadPool queues connections without limit. This
+ * one asks AdmissionControl first, and sends connections it
+ * won't admit to a small side pool that only answers 503, so
+ * they are told to go elsewhere at once instead of waiting for
+ * a lookup thread. Time spent waiting in the main queue is
+ * recorded on the way out.
+ *
+ * The side pool's queue is bounded too. Once it is full, the
+ * accept thread drops the connection with a canned 503,
+ * never reading from it, so a flood costs no memory and a
+ * slow client can't stall the accept loop.
+ */
+class AdmissionTaskQueue : public TaskQueue {
+
+public:
+
+    AdmissionTaskQueue(std::size_t poolSize, AdmissionControl& admission)
+        : m_pool(poolSize)
+        , m_shedPool(kShedThreads)
+        , m_shedQueued(0)
+        , m_admission(admission)
+    {}
+
+    void
+    enqueue(std::function<void()> fn) override
+    {
+        if (!m_admission.tryEnqueue()) {
+            auto shed = [fn] {
+                t_shedding = true;
+                fn();
+                t_shedding = false;
+            };
+            if (m_shedQueued.fetch_add(1) >= kMaxShedQueue) {
+                m_shedQueued--;
+                t_dropping = true;
+                fn();
+                t_dropping = false;
+                return;
+            }
+            m_shedPool.enqueue([this, shed] {
+                m_shedQueued--;
+                shed();
+            });
+            return;
+        }
+        AdmissionControl::Clock::time_point queued = AdmissionControl::Clock::now();
+        m_pool.enqueue([this, fn, queued] {
+            m_admission.dequeued(1, AdmissionControl::Clock::now() - queued);
+            fn();
+        });
+    }
+
+    void
+    shutdown() override
+    {
+        m_pool.shutdown();
+        m_shedPool.shutdown();
+    }
+
+private:
+
+    ThreadPool m_pool;
+    ThreadPool m_shedPool;
+    std::atomic<std::size_t> m_shedQueued;
+    AdmissionControl& m_admission;
+
+};
+
+/**
+ * Where the HTTP front end listens, for log messages.
+ */
+static std::string
+http_address(const ServerOptions& opts)
+{
+    if (!opts.unixPath.empty())
+        return opts.unixPath;
+    return opts.host + ":" + std::to_string(opts.port);
+}
+
+/**
+ * Apply the connection settings from the command line
+ * to an httplib server.
+ */
+static void
+configure_server(Server& svr, const ServerOptions& opts, std::size_t poolSize,
+                 AdmissionControl& admission)
+{
+    svr.new_task_queue = [poolSize, &admission] { return new AdmissionTaskQueue(poolSize, admission); };
+    svr.set_keep_alive_max_count(opts.keepAliveMaxCount);
+    svr.set_keep_alive_timeout(opts.keepAliveTimeout);
+    svr.set_tcp_nodelay(opts.tcpNoDelay);
+    if (opts.reusePort) {
+        svr.set_socket_options([](socket_t sock) {
+            int yes = 1;
+            setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+        });
+    }
+}
+
+/**
+ * How to encode a response to this request, given its
+ * Accept-Encoding and the command line settings.
+ */
+static ContentEncoding
+response_encoding(const Request& req, const ServerOptions& opts)
+{
+    if (!opts.compress || !req.has_header("Accept-Encoding"))
+        return ContentEncoding::IDENTITY;
+    return negotiate_encoding(req.get_header_value("Accept-Encoding"));
+}
+
+/**
+ * Set a response body, compressed if the client takes it
+ * and it is big enough to be worth the effort.
+ */
+static void
+set_encoded_content(const Request& req, Response& res, const std::string& body,
+                    const char* contentType, const ServerOptions& opts)
+{
+    ContentEncoding encoding = ContentEncoding::IDENTITY;
+    if (body.size() >= opts.compressMin)
+        encoding = response_encoding(req, opts);
+
+    // Compress straight into the response body, rather than
+    // into a copy that set_content() would copy again
+    if (encoding != ContentEncoding::IDENTITY) {
+        res.body.clear();
+        if (compress_body(encoding, body, res.body)) {
+            res.set_header("Content-Type", contentType);
+            res.set_header("Content-Encoding", encoding_name(encoding));
+            res.set_header("Vary", "Accept-Encoding");
+            return;
+        }
+    }
+    res.set_content(body, contentType);
+}
+
+/**
+ * Serve /lookup from the epoll front end.
+ */
+static int
+serve_epoll(const SpatialLookup& splu, const ServerOptions& opts, AdmissionControl& admission,
+            Metrics& metrics, Admin& admin)
+{
+    EpollServer esvr(splu, opts.epollIoThreads(), opts.workerThreads());
+    esvr.setReusePort(opts.reusePort);
+    esvr.setKeepAlive(opts.keepAliveMaxCount, opts.keepAliveTimeout);
+    esvr.setTcpNoDelay(opts.tcpNoDelay);
+    esvr.setCompression(opts.compress, opts.compressMin);
+    esvr.setAdmission(&admission);
+    esvr.setMetrics(&metrics);
+    esvr.setAdmin(&admin);
+    std::cerr << "spatial_lookup: listening on " << http_address(opts) << " (epoll)" << std::endl;
+    if (!opts.unixPath.empty())
+        return esvr.listenUnix(opts.unixPath) ? 0 : 1;
+    return esvr.listen(opts.host, opts.port) ? 0 : 1;
+}
+
+/**
+ * Serve /lookup from one or more httplib servers.
+ */
+static int
+serve_httplib(const SpatialLookup& splu, const ServerOptions& opts, AdmissionControl& admission,
+              Metrics& metrics, Admin& admin)
+{
+    // Set up HTTP end point, read the 'x' and 'y' HTTP request
+    // parameters
+    auto route = [&splu, &opts, &admission, &metrics, &admin](Server& svr) {
+        // Every response, whichever handler wrote it, passes
+        // through the logger once it has been sent
+        svr.set_logger([&metrics](const Request& req, const Response& res) {
+            metrics.countRequest(Metrics::route(req.path), res.status);
+        });
+
+        // Turn away connections that admission control has shed,
+        // and clients over their rate, before any real work
+        svr.set_pre_routing_handler([&admission](const Request& req, Response& res) {
+            if (t_shedding) {
+                // httplib only closes a connection for a request
+                // header, or a failed response, so the body is
+                // sent by a provider that then reports failure,
+                // ending the connection once the 503 is out
+                static const std::string kBody = "{\"error\":\"server is overloaded\"}\n";
+                res.status = 503;
+                res.set_header("Retry-After", "1");
+                res.set_header("Connection", "close");
+                res.set_content_provider(kBody.size(), "application/json",
+                    [](std::size_t, std::size_t, DataSink& sink) {
+                        sink.write(kBody.data(), kBody.size());
+                        return false;
+                    });
+                return Server::HandlerResponse::Handled;
+            }
+            if (req.path != "/health" && !admission.allowClient(req.remote_addr)) {
+                res.status = 429;
+                res.set_header("Retry-After", "1");
+                res.set_content("{\"error\":\"too many requests\"}\n", "application/json");
+                return Server::HandlerResponse::Handled;
+            }
+            return Server::HandlerResponse::Unhandled;
+        });
+
+        // httplib adds its keep-alive terms to every response it
+        // doesn't know is the last, which a shed one always is
+        svr.set_post_routing_handler([](const Request&, Response& res) {
+            if (t_shedding)
+                res.headers.erase("Keep-Alive");
+        });
+
+        // For load balancer health checks: 503 while the
+        // queue is full, with the admission counters
+        svr.Get("/health", [&admission](const Request&, Response& res) {
+            if (admission.saturated())
+                res.status = 503;
+            res.set_content(admission.statusJson(), "application/json");
+        });
+
+        svr.Get("/metrics", [&splu, &opts, &admission, &metrics](const Request& req, Response& res) {
+            set_encoded_content(req, res, metrics.exposition(splu, &admission),
+                        "text/plain; version=0.0.4", opts);
+        });
+
+        svr.Get("/lookup", [&splu, &opts, &metrics](const Request& req, Response& res) {
+            // httplib's pool threads are only ours to pin once
+            // they pick up a lookup
+            numa_pin_worker();
+
+            // With debug=1, or stage timing on, time each stage
+            const char* target = req.target.data();
+            const char* targetEnd = target + req.target.size();
+            bool debug = query_switch(target, targetEnd, "debug") == 1;
+            bool timed = debug || metrics.stageTiming();
+            uint64_t parseStart = timed ? cycle_count() : 0;
+
+            // Read the coordinate straight from the raw target,
+            // rather than through the params map, and refuse
+            // anything that is not a pair of numbers
+            double x, y;
+            LookupQueryStatus qs = parse_lookup_query(target, targetEnd, x, y);
+            if (qs != LookupQueryStatus::OK) {
+                res.status = 400;
+                res.set_content(lookup_query_error(qs), "application/json");
+                return;
+            }
+            uint64_t parseEnd = timed ? cycle_count() : 0;
+
+            // Indexed lookup of the coordinate against the data!
+            Coordinate coord(x, y);
+            LookupStats stats;
+            stats.timeStages = timed;
+            stats.profile = metrics.featureProfile();
+            Metrics::Clock::time_point start = Metrics::Clock::now();
+            std::vector<std::string> hits = splu.lookup(coord, &stats);
+            metrics.recordLookup(coord, Metrics::nanosSince(start), stats);
+            if (!timed) {
+                set_encoded_content(req, res, hits_to_json(hits), "application/json", opts);
+                return;
+            }
+
+            StageTicks stages = stats.stages;
+            stages[Stage::PARSE] = parseEnd - parseStart;
+            uint64_t renderStart = cycle_count();
+            std::string body = hits_to_json(hits);
+            stages[Stage::RENDER] = cycle_count() - renderStart;
+            if (metrics.stageTiming())
+                metrics.recordStages(stages);
+            if (debug)
+                body = lookup_debug_json(body, stats, stages);
+            set_encoded_content(req, res, body, "application/json", opts);
+        });
+
+        // Stage timing, the feature profile, and whatever
+        // else is under /admin/, as Admin has it
+        auto adminRoute = [&admin](bool post, const Request& req, Response& res) {
+            std::string body;
+            res.status = admin.handle(post, req.target.data(), req.target.data() + req.target.size(), body);
+            res.set_content(body, "application/json");
+        };
+        svr.Get(R"(/admin/.*)", [adminRoute](const Request& req, Response& res) {
+            adminRoute(false, req, res);
+        });
+        svr.Post(R"(/admin/.*)", [adminRoute](const Request& req, Response& res) {
+            adminRoute(true, req, res);
+        });
+
+        // Bulk lookups: coordinates one per line in the body,
+        // results one per line back, as each line arrives. The
+        // body is read from inside the chunked response, which
+        // httplib writes on the same connection before it moves
+        // on, so reading, lookup and writing take turns a chunk
+        // at a time and nothing is held but the current chunk.
+        // Compression, if any, runs over the stream the same
+        // way, flushed after every chunk so results keep flowing.
+        svr.Post("/lookup/stream", [&splu, &opts, &metrics](const Request& req, Response& res, const ContentReader& reader) {
+            numa_pin_worker();
+            ContentEncoding encoding = response_encoding(req, opts);
+            if (encoding != ContentEncoding::IDENTITY) {
+                res.set_header("Content-Encoding", encoding_name(encoding));
+                res.set_header("Vary", "Accept-Encoding");
+            }
+            res.set_chunked_content_provider("application/x-ndjson", [&splu, &metrics, reader, encoding](std::size_t, DataSink& sink) {
+                LookupStream stream(splu, &metrics);
+                std::unique_ptr<Compressor> compressor;
+                if (encoding != ContentEncoding::IDENTITY)
+                    compressor.reset(new Compressor(encoding));
+                std::string out;
+                std::string packed;
+
+                // Send what the last step produced, through the
+                // compressor if there is one
+                auto send = [&](bool last) {
+                    if (!compressor)
+                        return out.empty() || sink.write(out.data(), out.size());
+                    packed.clear();
+                    bool ok = last ? compressor->write(out.data(), out.size(), packed) && compressor->finish(packed)
+                                   : compressor->write(out.data(), out.size(), packed, true);
+                    return ok && (packed.empty() || sink.write(packed.data(), packed.size()));
+                };
+
+                bool ok = reader([&](const char* data, std::size_t size) {
+                    out.clear();
+                    stream.feed(data, size, out);
+                    return out.empty() || send(false);
+                });
+                if (!ok)
+                    return false;
+                out.clear();
+                stream.finish(out);
+                if (!send(true))
+                    return false;
+                sink.done();
+                return true;
+            });
+        });
+    };
+
+    // httplib serves each connection from one pool thread
+    // for its whole life, so by default keep its usual pool
+    std::size_t poolSize = opts.threads ? opts.threads : CPPHTTPLIB_THREAD_POOL_COUNT;
+
+    // One server per core, each with its own SO_REUSEPORT
+    // listening socket and accept loop, and an equal share
+    // of the worker threads. The kernel spreads incoming
+    // connections across the listeners. A Unix domain
+    // socket has no such option, so it gets just the one.
+    //
+    // The kernel picks a listener by hashing the connection,
+    // not by which has a thread free, so a listener with a
+    // single thread leaves everything hashed to it waiting
+    // behind one keep-alive client. Each gets a few threads
+    // at least: the default pool grows to give them, and an
+    // explicit --threads too small for that many listeners
+    // gets fewer listeners instead.
+    bool unixSocket = !opts.unixPath.empty();
+    std::size_t listeners = 1;
+    if (opts.reusePort && !unixSocket) {
+        listeners = std::max(1u, std::thread::hardware_concurrency());
+        if (!opts.threads)
+            poolSize = std::max(poolSize, listeners * kMinListenerThreads);
+        else
+            listeners = std::max<std::size_t>(1, std::min(listeners, poolSize / kMinListenerThreads));
+    }
+    poolSize = (poolSize + listeners - 1) / listeners;
+
+    std::vector<std::unique_ptr<UnixSocketServer>> servers;
+    for (std::size_t i = 0; i < listeners; i++) {
+        servers.emplace_back(new UnixSocketServer);
+        UnixSocketServer& svr = *servers.back();
+        route(svr);
+        configure_server(svr, opts, poolSize, admission);
+        bool bound = unixSocket
+            ? svr.bindUnix(opts.unixPath)
+            : svr.bind_to_port(opts.host.c_str(), static_cast<int>(opts.port));
+        if (!bound) {
+            // bindUnix() has said why already
+            if (!unixSocket)
+                std::cerr << "spatial_lookup: unable to bind " << http_address(opts) << std::endl;
+            return 1;
+        }
+    }
+
+    // Start the server
+    std::cerr << "spatial_lookup: listening on " << http_address(opts);
+    if (listeners > 1)
+        std::cerr << " (" << listeners << " listeners of " << poolSize << " threads)";
+    std::cerr << std::endl;
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < listeners; i++)
+        threads.emplace_back([&servers, i] { servers[i]->listen_after_bind(); });
+    servers[0]->listen_after_bind();
+    for (auto& t : threads)
+        t.join();
+    return 0;
+}
+
+/**
+ * Run it!
+ */
+int
+main(int argc, char* argv[])
+{
+    ServerOptions opts;
+    if (!opts.parse(argc, argv))
+        exit(1);
+
+    // Load the file and build the indexes, or take up a
+    // data set another process has already built
+    std::unique_ptr<SpatialLookup> data;
+    if (opts.shared.empty()) {
+        data.reset(new SpatialLookup(opts.filename, opts.property));
+        if (!data->ready()) {
+            std::cerr << "spatial_lookup: data load failed" << std::endl;
+            return 1;
+        }
+        std::cerr << "spatial_lookup: loaded and indexed " << opts.filename << std::endl;
+    }
+    else {
+        std::unique_ptr<SharedDataset> shared(new SharedDataset);
+        if (!shared->attach(opts.shared))
+            return 1;
+        data.reset(new SpatialLookup(std::move(shared)));
+    }
+    // Lookup threads pin themselves as they start, or on
+    // their first request, to read the copy on their node
+    if (opts.numa) {
+        data->replicate();
+        numa_enable_pinning();
+    }
+    const SpatialLookup& splu = *data;
+    print_load_report(std::cerr, splu.loadReport());
+
+    // Counters and histograms shared by every front end
+    Metrics metrics;
+    metrics.setStageTiming(opts.stageTiming);
+
+    std::unique_ptr<SlowQueryLog> slowLog;
+    if (opts.slowQueryMicros) {
+        slowLog.reset(new SlowQueryLog(splu, opts.slowQueryMicros * 1000));
+        if (!slowLog->start(opts.slowQueryLog))
+            return 1;
+        metrics.setSlowQueryLog(slowLog.get());
+    }
+
+    std::unique_ptr<QueryCapture> capture;
+    if (!opts.capturePath.empty()) {
+        capture.reset(new QueryCapture(opts.captureRate, opts.captureLimit));
+        if (!capture->start(opts.capturePath))
+            return 1;
+        metrics.setQueryCapture(capture.get());
+    }
+
+    FeatureProfile profile(splu.numFeatures());
+    profile.setEnabled(opts.profileFeatures);
+    metrics.setFeatureProfile(&profile);
+    Admin admin(splu, metrics, profile);
+
+    // The binary protocol runs alongside whichever HTTP
+    // front end is in use, from the same SpatialLookup, on
+    // a TCP port, a Unix domain socket, or both
+    std::vector<std::unique_ptr<BinaryServer>> bsvrs;
+    std::vector<std::thread> bthreads;
+    if (opts.binaryPort) {
+        bsvrs.emplace_back(new BinaryServer(splu, opts.epollIoThreads()));
+        if (!bsvrs.back()->bind(opts.host, opts.binaryPort) || !bsvrs.back()->start())
+            return 1;
+        std::cerr << "spatial_lookup: binary protocol on " << opts.host << ":" << opts.binaryPort << std::endl;
+    }
+    if (!opts.binaryUnixPath.empty()) {
+        bsvrs.emplace_back(new BinaryServer(splu, opts.epollIoThreads()));
+        if (!bsvrs.back()->bindUnix(opts.binaryUnixPath) || !bsvrs.back()->start())
+            return 1;
+        std::cerr << "spatial_lookup: binary protocol on " << opts.binaryUnixPath << std::endl;
+    }
+    // Each is started here, before its thread, so stopping
+    // them below always wakes their loops, however soon the
+    // HTTP front end returns
+    for (auto& bsvr : bsvrs) {
+        bsvr->setMetrics(&metrics);
+        bthreads.emplace_back([&bsvr] { bsvr->serve(); });
+    }
+
+    // Shared by every HTTP front end
+    AdmissionControl admission(opts.maxQueue, static_cast<double>(opts.rateLimit),
+                               static_cast<double>(opts.rateBurst ? opts.rateBurst : opts.rateLimit));
+
+    int rc = opts.epoll ? serve_epoll(splu, opts, admission, metrics, admin)
+                        : serve_httplib(splu, opts, admission, metrics, admin);
+
+    for (auto& bsvr : bsvrs)
+        bsvr->stop();
+    for (auto& t : bthreads)
+        t.join();
+    return rc;
+}
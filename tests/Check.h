@@ -0,0 +1,37 @@
+/*
+*  Check.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <iostream>
+
+
+/**
+ * The least a test needs: CHECK() reports each failure, with
+ * where it was, and carries on, and check_result() turns the
+ * count of failures into the exit status ctest looks at.
+ */
+static int s_checkFailures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": failed: " #cond << std::endl; \
+            s_checkFailures++; \
+        } \
+    } while (0)
+
+static inline int
+check_result(const char* name)
+{
+    if (s_checkFailures)
+        std::cerr << name << ": " << s_checkFailures << " checks failed" << std::endl;
+    else
+        std::cerr << name << ": ok" << std::endl;
+    return s_checkFailures ? 1 : 0;
+}
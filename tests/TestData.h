@@ -0,0 +1,64 @@
+/*
+*  TestData.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+
+// App headers
+#include "SpatialLookup.h"
+#include "Synthetic.h"
+
+
+/**
+ * A data set, synthetic or given as GeoJSON, loaded into a
+ * SpatialLookup by way of a temporary file, since the engine
+ * reads its data from one. The file goes when the data set
+ * does.
+ */
+struct TestData {
+
+    explicit TestData(const SyntheticOptions& opts)
+        : TestData(synthetic_geojson(opts))
+    {}
+
+    explicit TestData(const std::string& geojson)
+    {
+        char path[] = "/tmp/spatial_lookup_test_XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0)
+            return;
+        close(fd);
+        m_path = path;
+        {
+            std::ofstream ofs(m_path);
+            ofs << geojson;
+        }
+        splu.reset(new SpatialLookup(m_path, "name"));
+    }
+
+    ~TestData()
+    {
+        if (!m_path.empty())
+            std::remove(m_path.c_str());
+    }
+
+    bool ready() const { return splu && splu->ready(); }
+
+    std::unique_ptr<SpatialLookup> splu;
+
+private:
+
+    std::string m_path;
+
+};
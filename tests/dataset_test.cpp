@@ -0,0 +1,146 @@
+/*
+*  dataset_test.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*
+*  The flat data set layout, as published to shared memory
+*  and replicated per NUMA node, against the GEOS prepared
+*  geometry lookups it stands in for.
+*/
+
+// System headers
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// App headers
+#include "Check.h"
+#include "SharedDataset.h"
+#include "TestData.h"
+
+
+/**
+ * Look up every query in both, returning how many differ.
+ */
+static std::size_t
+mismatches(const SpatialLookup& geos, const SpatialLookup& flat,
+           const std::vector<Coordinate>& queries)
+{
+    std::size_t n = 0;
+    for (const Coordinate& c : queries) {
+        std::vector<std::string> want = geos.lookup(c);
+        std::vector<std::string> got = flat.lookup(c);
+        std::sort(want.begin(), want.end());
+        std::sort(got.begin(), got.end());
+        if (want != got)
+            n++;
+    }
+    return n;
+}
+
+/**
+ * Compare the lookups of the flat layout of a data set with
+ * the GEOS lookups of the data set itself.
+ */
+static void
+test_layout(const char* name, TestData& data)
+{
+    CHECK(data.ready());
+    if (!data.ready())
+        return;
+    const SpatialLookup& geos = *data.splu;
+
+    std::unique_ptr<SharedDataset> ds(new SharedDataset);
+    CHECK(ds->build(geos));
+    CHECK(ds->numFeatures() == geos.numFeatures());
+    CHECK(ds->numValues() == geos.numValues());
+    // Never more than a few band entries per segment, of
+    // which there are fewer than vertices
+    CHECK(ds->bandEntries() <= 8 * ds->numVertices());
+    SpatialLookup flat(std::move(ds));
+    CHECK(flat.ready());
+    CHECK(flat.numFeatures() == geos.numFeatures());
+
+    // Points placed at random must agree exactly
+    for (QueryDistribution dist : {QueryDistribution::UNIFORM, QueryDistribution::CLUSTERED}) {
+        std::size_t n = mismatches(geos, flat, make_queries(geos, dist, 20000, 7));
+        if (n)
+            std::cerr << name << ": " << n << " " << distribution_name(dist) << " mismatches" << std::endl;
+        CHECK(n == 0);
+    }
+
+    // Points just off the vertices can fall within rounding
+    // error of an edge, where the flat test may differ from
+    // the exact GEOS one, but only rarely
+    std::size_t n = mismatches(geos, flat, make_queries(geos, QueryDistribution::BOUNDARY, 20000, 7));
+    if (n)
+        std::cerr << name << ": " << n << " boundary mismatches" << std::endl;
+    CHECK(n <= 20);
+}
+
+
+static void
+test_coverage(const char* name, const SyntheticOptions& opts)
+{
+    TestData data(opts);
+    test_layout(name, data);
+}
+
+/**
+ * A comb: teeth of long vertical edges, every one reaching
+ * into every band of the feature, if it were cut into as many
+ * bands as it has segments over four.
+ */
+static void
+test_comb(std::size_t teeth)
+{
+    std::string ring = "[0,-10]";
+    for (std::size_t i = 0; i < teeth; i++) {
+        double x = static_cast<double>(i);
+        ring += ",[" + std::to_string(x) + ",1000],[" + std::to_string(x + 0.5) + ",1000]"
+                ",[" + std::to_string(x + 0.5) + ",0],[" + std::to_string(x + 1) + ",0]";
+    }
+    ring += ",[" + std::to_string(teeth) + ",-10],[0,-10]";
+    std::string geojson =
+        "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\","
+        "\"properties\":{\"name\":\"comb\"},"
+        "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[" + ring + "]]}}]}";
+    TestData data(geojson);
+    test_layout("comb", data);
+}
+
+
+int
+main()
+{
+    SyntheticOptions plain;
+    plain.columns = 16;
+    plain.rows = 16;
+    plain.jitter = 0.3;
+    test_coverage("plain", plain);
+
+    // Holes, enclaves, multipolygons and overlapping features
+    SyntheticOptions mixed = plain;
+    mixed.holes = 0.3;
+    mixed.multipart = 0.5;
+    mixed.overlap = 0.2;
+    mixed.skew = 2.0;
+    mixed.seed = 3;
+    test_coverage("mixed", mixed);
+
+    // Few features, each of many vertices, so each has many
+    // bands to its index
+    SyntheticOptions detailed;
+    detailed.columns = 4;
+    detailed.rows = 4;
+    detailed.depth = 9;
+    detailed.roughness = 0.3;
+    test_coverage("detailed", detailed);
+
+    test_comb(2000);
+
+    return check_result("dataset_test");
+}
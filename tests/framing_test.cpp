@@ -0,0 +1,187 @@
+/*
+*  framing_test.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*
+*  Request framing in the epoll front end: pipelining, a
+*  client that half-closes after its last request, and
+*  Content-Length values that can't be trusted.
+*/
+
+// System headers
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+// App headers
+#include "Check.h"
+#include "EpollServer.h"
+#include "Sockets.h"
+#include "TestData.h"
+
+
+/**
+ * Send the whole of a request stream, optionally half-close,
+ * and read everything the server sends until it closes.
+ */
+static std::string
+exchange(const std::string& path, const std::string& request, bool halfClose)
+{
+    std::string errmsg;
+    int fd = connect_unix(path, errmsg);
+    if (fd < 0)
+        return "";
+    for (std::size_t sent = 0; sent < request.size(); ) {
+        ssize_t n = ::send(fd, request.data() + sent, request.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        sent += static_cast<std::size_t>(n);
+    }
+    if (halfClose)
+        ::shutdown(fd, SHUT_WR);
+    std::string response;
+    char buf[16384];
+    ssize_t n;
+    while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0)
+        response.append(buf, static_cast<std::size_t>(n));
+    ::close(fd);
+    return response;
+}
+
+/**
+ * The status codes of a run of responses, -1 for any that
+ * can't be read, which ends the run.
+ */
+static std::vector<int>
+statuses(const std::string& responses)
+{
+    std::vector<int> codes;
+    std::size_t p = 0;
+    while (p < responses.size()) {
+        std::size_t headerEnd = responses.find("\r\n\r\n", p);
+        if (responses.compare(p, 9, "HTTP/1.1 ") != 0 || headerEnd == std::string::npos) {
+            codes.push_back(-1);
+            break;
+        }
+        codes.push_back(std::atoi(responses.c_str() + p + 9));
+        std::size_t body = headerEnd + 4;
+        std::size_t cl = responses.find("Content-Length: ", p);
+        std::size_t length = cl < headerEnd ? std::strtoul(responses.c_str() + cl + 16, nullptr, 10) : 0;
+        p = body + length;
+    }
+    return codes;
+}
+
+static std::string
+repeat(const std::string& s, std::size_t n)
+{
+    std::string r;
+    for (std::size_t i = 0; i < n; i++)
+        r += s;
+    return r;
+}
+
+
+int
+main()
+{
+    SyntheticOptions opts;
+    opts.columns = 4;
+    opts.rows = 4;
+    TestData data(opts);
+    CHECK(data.ready());
+    if (!data.ready())
+        return check_result("framing_test");
+
+    char dir[] = "/tmp/spatial_lookup_test_XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    std::string path = std::string(dir) + "/http.sock";
+
+    EpollServer server(*data.splu, 2, 2);
+    server.setKeepAlive(1000, 5);
+    std::thread serving([&server, &path] { server.listenUnix(path); });
+
+    // Wait for the socket to take connections
+    for (int i = 0; i < 500; i++) {
+        std::string errmsg;
+        int fd = connect_unix(path, errmsg);
+        if (fd >= 0) {
+            ::close(fd);
+            break;
+        }
+        usleep(10000);
+    }
+
+    static const std::string kLookup = "GET /lookup?x=50&y=50 HTTP/1.1\r\nHost: test\r\n\r\n";
+    static const std::string kHealth = "GET /health HTTP/1.1\r\nHost: test\r\n\r\n";
+
+    // Pipelined requests, then a half-close: every one is
+    // answered before the connection goes
+    CHECK(statuses(exchange(path, repeat(kLookup, 3), true)) == std::vector<int>(3, 200));
+
+    // More than one batch of them, some answered on the I/O
+    // thread and some by the workers
+    CHECK(statuses(exchange(path, repeat(kLookup + kHealth, 100), true)) == std::vector<int>(200, 200));
+
+    // A last request with Connection: close ends it, without
+    // the client having to close
+    std::string closing = "GET /health HTTP/1.1\r\nConnection: close\r\n\r\n";
+    CHECK(statuses(exchange(path, kLookup + closing, false)) == std::vector<int>({200, 200}));
+
+    // A request body is skipped over, to find the next request
+    std::string withBody = "GET /health HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello";
+    CHECK(statuses(exchange(path, withBody + kLookup, true)) == std::vector<int>({200, 200}));
+    std::string sameTwice = "GET /health HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\nhi";
+    CHECK(statuses(exchange(path, sameTwice + kLookup, true)) == std::vector<int>({200, 200}));
+
+    // A length that can't be trusted is a 400, and the end of
+    // the connection, whatever follows it
+    for (const char* length : {"-1", "abc", "12abc", "+5", "0x10", ""}) {
+        std::string bad = std::string("GET /health HTTP/1.1\r\nContent-Length: ") + length + "\r\n\r\n";
+        std::vector<int> got = statuses(exchange(path, kLookup + bad + kLookup, false));
+        CHECK(got == std::vector<int>({200, 400}));
+    }
+    std::string conflicting = "GET /health HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 3\r\n\r\nabc";
+    CHECK(statuses(exchange(path, conflicting + kLookup, false)) == std::vector<int>({400}));
+
+    // Chunked bodies aren't read, so the chunks must never be
+    // taken for another request: any Transfer-Encoding is a
+    // 501, or with a Content-Length as well a 400, and the
+    // connection ends either way
+    char chunkSize[16];
+    snprintf(chunkSize, sizeof(chunkSize), "%zx", kLookup.size());
+    std::string smuggled = "GET /health HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" +
+                           std::string(chunkSize) + "\r\n" + kLookup + "\r\n0\r\n\r\n";
+    CHECK(statuses(exchange(path, kLookup + smuggled, false)) == std::vector<int>({200, 501}));
+    std::string both = "GET /health HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "0\r\n\r\n" + kLookup;
+    CHECK(statuses(exchange(path, both, false)) == std::vector<int>({400}));
+
+    // One too big to take is a 413, even if it would overflow
+    std::string huge = "GET /health HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n";
+    CHECK(statuses(exchange(path, huge + kLookup, false)) == std::vector<int>({413}));
+
+    // Headers without an end
+    std::string endless = "GET /health HTTP/1.1\r\nX: " + std::string(10000, 'x');
+    CHECK(statuses(exchange(path, endless, false)) == std::vector<int>({431}));
+
+    // A second server on the same path is refused, and the
+    // first carries on
+    std::string errmsg;
+    CHECK(listen_unix(path, errmsg) < 0);
+    CHECK(statuses(exchange(path, kHealth, true)) == std::vector<int>({200}));
+
+    // The socket goes with the server
+    server.stop();
+    serving.join();
+    CHECK(access(path.c_str(), F_OK) != 0);
+    rmdir(dir);
+    return check_result("framing_test");
+}
@@ -0,0 +1,216 @@
+/*
+*  parse_test.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*
+*  The request parsers: /lookup query strings, streamed
+*  coordinate lines, Content-Length values and
+*  Accept-Encoding negotiation. Also the JSON strings that
+*  property values go back out as.
+*/
+
+// System headers
+#include <cstring>
+#include <string>
+#include <vector>
+
+// App headers
+#include "Check.h"
+#include "Compression.h"
+#include "LookupQuery.h"
+#include "SpatialLookup.h"
+
+
+static LookupQueryStatus
+query(const std::string& target, double& x, double& y)
+{
+    return parse_lookup_query(target.data(), target.data() + target.size(), x, y);
+}
+
+static LookupQueryStatus
+line(const std::string& text, double& x, double& y)
+{
+    return parse_coordinate_line(text.data(), text.data() + text.size(), x, y);
+}
+
+static bool
+content_length(const std::string& value, std::size_t limit, std::size_t& length)
+{
+    return parse_content_length(value.data(), value.data() + value.size(), limit, length);
+}
+
+
+static void
+test_lookup_query()
+{
+    double x = 0, y = 0;
+    CHECK(query("/lookup?x=-78.40&y=39.69", x, y) == LookupQueryStatus::OK);
+    CHECK(x == -78.40 && y == 39.69);
+
+    // Either order, other parameters ignored, a '+' allowed
+    CHECK(query("/lookup?debug=1&y=2.5&x=%2B1", x, y) == LookupQueryStatus::OK);
+    CHECK(x == 1.0 && y == 2.5);
+
+    // Percent-encoded values, in either case of hex digit
+    CHECK(query("/lookup?x=%2D78%2e5&y=1e%2B1", x, y) == LookupQueryStatus::OK);
+    CHECK(x == -78.5 && y == 10.0);
+    CHECK(query("/lookup?x=%2&y=1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=%zz&y=1", x, y) == LookupQueryStatus::MALFORMED);
+
+    // The first of a repeated parameter wins, and a fragment
+    // is not part of the query
+    CHECK(query("/lookup?x=1&x=junk&y=2#y=3", x, y) == LookupQueryStatus::OK);
+    CHECK(x == 1.0 && y == 2.0);
+
+    // Missing parameters
+    CHECK(query("/lookup", x, y) == LookupQueryStatus::MISSING);
+    CHECK(query("/lookup?x=1", x, y) == LookupQueryStatus::MISSING);
+    CHECK(query("/lookup?xx=1&y=2", x, y) == LookupQueryStatus::MISSING);
+    CHECK(query("/lookup?x=1#&y=2", x, y) == LookupQueryStatus::MISSING);
+
+    // Anything but a whole finite number is rejected, decoded
+    // or not
+    CHECK(query("/lookup?x=&y=1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=1abc&y=1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=nan&y=1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=1&y=inf", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=1&y=-infinity", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=1e999&y=1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=%6Ean&y=1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=1%20&y=1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(query("/lookup?x=" + std::string(100, '1') + "%30&y=1", x, y) == LookupQueryStatus::MALFORMED);
+}
+
+
+static void
+test_coordinate_line()
+{
+    double x = 0, y = 0;
+    CHECK(line("1.5,2.5", x, y) == LookupQueryStatus::OK);
+    CHECK(x == 1.5 && y == 2.5);
+    CHECK(line("  -3 \t4\r", x, y) == LookupQueryStatus::OK);
+    CHECK(x == -3.0 && y == 4.0);
+    CHECK(line("[ 5 , 6 ]", x, y) == LookupQueryStatus::OK);
+    CHECK(x == 5.0 && y == 6.0);
+
+    CHECK(line("", x, y) == LookupQueryStatus::MISSING);
+    CHECK(line(" \r", x, y) == LookupQueryStatus::MISSING);
+    CHECK(line("7", x, y) == LookupQueryStatus::MISSING);
+    CHECK(line("[]", x, y) == LookupQueryStatus::MISSING);
+
+    CHECK(line("1,", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(line("1,2,3", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(line("a,b", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(line("nan,1", x, y) == LookupQueryStatus::MALFORMED);
+    CHECK(line("1 inf", x, y) == LookupQueryStatus::MALFORMED);
+}
+
+
+static void
+test_content_length()
+{
+    std::size_t n = 0;
+    CHECK(content_length("0", 100, n) && n == 0);
+    CHECK(content_length(" 42\r", 100, n) && n == 42);
+    CHECK(content_length("100", 100, n) && n == 100);
+
+    // Over the limit comes back as limit + 1, however long
+    CHECK(content_length("101", 100, n) && n == 101);
+    CHECK(content_length("99999999999999999999999999999999", 100, n) && n == 101);
+
+    CHECK(!content_length("", 100, n));
+    CHECK(!content_length(" ", 100, n));
+    CHECK(!content_length("-1", 100, n));
+    CHECK(!content_length("+1", 100, n));
+    CHECK(!content_length("1 2", 100, n));
+    CHECK(!content_length("12abc", 100, n));
+    CHECK(!content_length("0x10", 100, n));
+}
+
+
+static void
+test_negotiate_encoding()
+{
+    bool zstd = false;
+    bool gzip = false;
+#ifdef SPATIAL_LOOKUP_ZSTD
+    zstd = true;
+#endif
+#ifdef SPATIAL_LOOKUP_ZLIB
+    gzip = true;
+#endif
+    const ContentEncoding kNone = ContentEncoding::IDENTITY;
+    const ContentEncoding kZstd = zstd ? ContentEncoding::ZSTD : kNone;
+    const ContentEncoding kGzip = gzip ? ContentEncoding::GZIP : kNone;
+    const ContentEncoding kBest = zstd ? kZstd : kGzip;
+
+    CHECK(negotiate_encoding("") == kNone);
+    CHECK(negotiate_encoding("identity") == kNone);
+    CHECK(negotiate_encoding("br, deflate") == kNone);
+    CHECK(negotiate_encoding("gzip") == kGzip);
+    CHECK(negotiate_encoding("x-gzip") == kGzip);
+    CHECK(negotiate_encoding("GZip") == kGzip);
+    CHECK(negotiate_encoding("zstd") == kZstd);
+    CHECK(negotiate_encoding("gzip, zstd") == kBest);
+    CHECK(negotiate_encoding(" gzip ;q=0.5 , zstd;q=1") == kBest);
+    CHECK(negotiate_encoding("*") == kBest);
+
+    // q=0 refuses a coding
+    CHECK(negotiate_encoding("gzip;q=0") == kNone);
+    CHECK(negotiate_encoding("gzip;q=0.0, zstd;q=0") == kNone);
+    CHECK(negotiate_encoding("zstd;q=0, gzip") == kGzip);
+    CHECK(negotiate_encoding("*;q=0") == kNone);
+    CHECK(negotiate_encoding("*;q=0, gzip") == kGzip);
+
+    // "*" covers only the codings not named, so it never
+    // overrides an explicit refusal
+    CHECK(negotiate_encoding("gzip;q=0, *") == kZstd);
+    CHECK(negotiate_encoding("*, gzip;q=0") == kZstd);
+    CHECK(negotiate_encoding("zstd;q=0, *") == kGzip);
+    CHECK(negotiate_encoding("gzip;q=0, zstd;q=0, *") == kNone);
+
+    // Names are matched whole
+    CHECK(negotiate_encoding("gzipx, zstd2") == kNone);
+
+    CHECK(std::strcmp(encoding_name(ContentEncoding::GZIP), "gzip") == 0);
+    CHECK(std::strcmp(encoding_name(ContentEncoding::ZSTD), "zstd") == 0);
+    CHECK(encoding_name(ContentEncoding::IDENTITY) == nullptr);
+}
+
+
+static std::string
+json_string(const std::string& value)
+{
+    std::string out;
+    append_json_string(out, value);
+    return out;
+}
+
+static void
+test_json_string()
+{
+    CHECK(json_string("") == "\"\"");
+    CHECK(json_string("21766") == "\"21766\"");
+    CHECK(json_string("Montr\xc3\xa9" "al") == "\"Montr\xc3\xa9" "al\"");
+    CHECK(json_string("say \"hi\"") == "\"say \\\"hi\\\"\"");
+    CHECK(json_string("C:\\tmp") == "\"C:\\\\tmp\"");
+    CHECK(json_string("a\nb\tc\r") == "\"a\\nb\\tc\\r\"");
+    CHECK(json_string(std::string("\x01\x1f\0", 3)) == "\"\\u0001\\u001f\\u0000\"");
+
+    // Whatever the values, the array around them still parses
+    CHECK(hits_to_json({}) == "[]\n");
+    CHECK(hits_to_json({"a", "b\"c"}) == "[\"a\",\"b\\\"c\"]\n");
+}
+
+
+int
+main()
+{
+    test_lookup_query();
+    test_coordinate_line();
+    test_content_length();
+    test_negotiate_encoding();
+    test_json_string();
+    return check_result("parse_test");
+}
@@ -0,0 +1,109 @@
+/*
+*  stream_test.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*
+*  The newline-delimited coordinate stream of POST /lookup:
+*  one result per line, however the input is split.
+*/
+
+// System headers
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// App headers
+#include "Check.h"
+#include "LookupStream.h"
+#include "TestData.h"
+
+
+/**
+ * What /lookup would answer for a coordinate.
+ */
+static std::string
+expected(const SpatialLookup& splu, double x, double y)
+{
+    return hits_to_json(splu.lookup(Coordinate(x, y)));
+}
+
+/**
+ * Run input through a stream in chunks of the given size.
+ */
+static std::string
+run(const SpatialLookup& splu, const std::string& input, std::size_t chunk, std::size_t& lines)
+{
+    LookupStream stream(splu);
+    std::string out;
+    for (std::size_t i = 0; i < input.size(); i += chunk)
+        stream.feed(input.data() + i, std::min(chunk, input.size() - i), out);
+    stream.finish(out);
+    lines = stream.lines();
+    return out;
+}
+
+
+int
+main()
+{
+    SyntheticOptions opts;
+    opts.columns = 8;
+    opts.rows = 8;
+    opts.overlap = 0.2;
+    TestData data(opts);
+    CHECK(data.ready());
+    if (!data.ready())
+        return check_result("stream_test");
+    const SpatialLookup& splu = *data.splu;
+
+    static const char* kError = "{\"error\":\"expected a coordinate as x,y\"}\n";
+
+    // Every accepted form of line, blank lines that get no
+    // answer, bad lines that get an error each, and a last
+    // line without a newline
+    std::string input =
+        "12.5,40.25\n"
+        "\n"
+        "  \r\n"
+        "[63.1, 7.9]\r\n"
+        "88 91.5\n"
+        "not a coordinate\n"
+        "1,nan\n"
+        "50,50";
+    std::string want =
+        expected(splu, 12.5, 40.25) +
+        expected(splu, 63.1, 7.9) +
+        expected(splu, 88, 91.5) +
+        kError +
+        kError +
+        expected(splu, 50, 50);
+
+    std::size_t lines = 0;
+    CHECK(run(splu, input, input.size(), lines) == want);
+    CHECK(lines == 6);
+
+    // Split anywhere, down to a byte at a time, the answer
+    // is the same
+    for (std::size_t chunk = 1; chunk < 64; chunk++) {
+        std::string got = run(splu, input, chunk, lines);
+        CHECK(got == want);
+        CHECK(lines == 6);
+    }
+
+    // Many lines, against single lookups
+    std::vector<Coordinate> queries = make_queries(splu, QueryDistribution::UNIFORM, 1000);
+    input.clear();
+    want.clear();
+    for (const Coordinate& c : queries) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.17g,%.17g\n", c.x, c.y);
+        input += buf;
+        want += expected(splu, c.x, c.y);
+    }
+    CHECK(run(splu, input, 4096, lines) == want);
+    CHECK(lines == queries.size());
+
+    return check_result("stream_test");
+}
@@ -0,0 +1,156 @@
+/*
+*  HttpConnection.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+// System headers
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// App headers
+#include "HttpConnection.h"
+#include "Sockets.h"
+
+// Longest to wait on a response before giving up on it
+static const int kReceiveTimeoutSeconds = 5;
+
+
+HttpConnection::HttpConnection(const std::string& host, unsigned int port, const std::string& unixPath)
+    : m_host(host)
+    , m_port(port)
+    , m_unixPath(unixPath)
+    , m_fd(-1)
+{}
+
+
+HttpConnection::~HttpConnection()
+{
+    disconnect();
+}
+
+
+bool
+HttpConnection::send(const std::string& request)
+{
+    if (m_fd < 0 && !connect())
+        return false;
+    if (::send(m_fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size())) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+
+bool
+HttpConnection::waitReadable(std::chrono::steady_clock::time_point until)
+{
+    if (!m_buffer.empty() || m_fd < 0)
+        return true;
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+        until - std::chrono::steady_clock::now()).count();
+    struct pollfd pfd = {m_fd, POLLIN, 0};
+    return ::poll(&pfd, 1, static_cast<int>(std::max<int64_t>(wait, 0))) > 0;
+}
+
+
+int
+HttpConnection::receive()
+{
+    if (m_fd < 0)
+        return 0;
+    std::size_t headerEnd;
+    while ((headerEnd = m_buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (!fill())
+            return 0;
+    }
+    headerEnd += 4;
+    std::string head = m_buffer.substr(0, headerEnd);
+    int status = std::atoi(head.c_str() + 9);
+    bool closing = strcasestr(head.c_str(), "Connection: close") != nullptr;
+
+    std::size_t end;
+    if (strcasestr(head.c_str(), "Transfer-Encoding: chunked")) {
+        // Walk the chunks up to the empty last one
+        std::size_t pos = headerEnd;
+        for (;;) {
+            std::size_t eol;
+            while ((eol = m_buffer.find("\r\n", pos)) == std::string::npos) {
+                if (!fill())
+                    return 0;
+            }
+            std::size_t size = std::strtoul(m_buffer.c_str() + pos, nullptr, 16);
+            std::size_t next = eol + 2 + size + 2;
+            while (m_buffer.size() < next) {
+                if (!fill())
+                    return 0;
+            }
+            pos = next;
+            if (size == 0)
+                break;
+        }
+        end = pos;
+    }
+    else {
+        std::size_t length = 0;
+        const char* cl = strcasestr(head.c_str(), "Content-Length:");
+        if (cl)
+            length = std::strtoul(cl + 15, nullptr, 10);
+        end = headerEnd + length;
+        while (m_buffer.size() < end) {
+            if (!fill())
+                return 0;
+        }
+    }
+    m_buffer.erase(0, end);
+    if (closing)
+        disconnect();
+    return status;
+}
+
+
+bool
+HttpConnection::connect()
+{
+    std::string err;
+    m_fd = m_unixPath.empty() ? connect_tcp(m_host, m_port, err)
+                              : connect_unix(m_unixPath, err);
+    if (m_fd < 0)
+        return false;
+    struct timeval tv = {kReceiveTimeoutSeconds, 0};
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return true;
+}
+
+
+void
+HttpConnection::disconnect()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_buffer.clear();
+}
+
+
+bool
+HttpConnection::fill()
+{
+    char buf[16384];
+    ssize_t n = ::recv(m_fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+        disconnect();
+        return false;
+    }
+    m_buffer.append(buf, static_cast<std::size_t>(n));
+    return true;
+}
@@ -0,0 +1,67 @@
+/*
+*  HttpConnection.h
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+#pragma once
+
+// System headers
+#include <chrono>
+#include <string>
+
+
+/**
+ * Just enough of an HTTP/1.1 client to pipeline requests and
+ * read back responses, with a Content-Length or chunked, for
+ * the load generator and the replay tool.
+ */
+class HttpConnection {
+
+public:
+
+    /**
+     * Connect to host and port, or to the Unix domain socket
+     * at unixPath if it is not empty, on the first send().
+     */
+    HttpConnection(const std::string& host, unsigned int port, const std::string& unixPath);
+    ~HttpConnection();
+
+    HttpConnection(const HttpConnection&) = delete;
+    HttpConnection& operator=(const HttpConnection&) = delete;
+
+    bool connected() const { return m_fd >= 0; }
+
+    /**
+     * Send a whole request, connecting first if need be.
+     */
+    bool send(const std::string& request);
+
+    /**
+     * Wait until there is something to read, or until the
+     * deadline, to the millisecond. Returns false on timing out.
+     */
+    bool waitReadable(std::chrono::steady_clock::time_point until);
+
+    /**
+     * Read the next whole response, and return its status
+     * code, or 0 on failure. If the server asked to close,
+     * the connection is dropped after it.
+     */
+    int receive();
+
+private:
+
+    bool connect();
+    void disconnect();
+    bool fill();
+
+    // Members
+    const std::string m_host;
+    const unsigned int m_port;
+    const std::string m_unixPath;
+    int m_fd;
+    std::string m_buffer;
+
+};
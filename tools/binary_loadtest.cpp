@@ -0,0 +1,299 @@
+/*
+*  binary_loadtest.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+/*
+ * Drives a running spatial_lookup with random points over both
+ * the HTTP /lookup route and the binary protocol, on loopback
+ * TCP and on Unix domain sockets, and reports throughput and
+ * latency for each, for a like-for-like comparison.
+ */
+
+// System headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+// App headers
+#include "HttpConnection.h"
+#include "LookupClient.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "localhost";
+    unsigned int httpPort = 8080;
+    unsigned int binaryPort = 8090;
+    std::string httpUnix;
+    std::string binaryUnix;
+    std::size_t connections = 4;
+    std::size_t seconds = 5;
+    std::size_t batch = 1;
+    std::size_t pipeline = 16;
+    std::size_t httpPipeline = 1;
+    double bbox[4] = {-180.0, -90.0, 180.0, 90.0};
+};
+
+/**
+ * What one connection measured: points looked up, and
+ * the latency of each request in nanoseconds.
+ */
+struct Tally {
+    std::size_t points = 0;
+    std::size_t errors = 0;
+    std::vector<int64_t> latencies;
+};
+
+
+static void
+usage()
+{
+    std::cerr << "Usage: spatial_lookup_loadtest [options]" << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --host ADDR                  server address (default localhost)" << std::endl
+              << "  --http-port N                HTTP port, 0 to skip (default 8080)" << std::endl
+              << "  --binary-port N              binary protocol port, 0 to skip (default 8090)" << std::endl
+              << "  --http-unix PATH             also test HTTP over this Unix domain socket" << std::endl
+              << "  --binary-unix PATH           also test the binary protocol over this Unix domain socket" << std::endl
+              << "  --connections N              concurrent connections (default 4)" << std::endl
+              << "  --seconds N                  duration of each run (default 5)" << std::endl
+              << "  --batch N                    points per binary request (default 1)" << std::endl
+              << "  --pipeline N                 binary requests in flight per connection (default 16)" << std::endl
+              << "  --http-pipeline N            HTTP requests in flight per connection (default 1)" << std::endl
+              << "  --bbox MINX,MINY,MAXX,MAXY   area to draw query points from" << std::endl;
+}
+
+
+static bool
+parse_options(int argc, char* argv[], Options& opts)
+{
+    static const option longopts[] = {
+        {"host",          required_argument, nullptr, 'h'},
+        {"http-port",     required_argument, nullptr, 'H'},
+        {"binary-port",   required_argument, nullptr, 'B'},
+        {"http-unix",     required_argument, nullptr, 'U'},
+        {"binary-unix",   required_argument, nullptr, 'u'},
+        {"connections",   required_argument, nullptr, 'c'},
+        {"seconds",       required_argument, nullptr, 's'},
+        {"batch",         required_argument, nullptr, 'b'},
+        {"pipeline",      required_argument, nullptr, 'p'},
+        {"http-pipeline", required_argument, nullptr, 'P'},
+        {"bbox",          required_argument, nullptr, 'x'},
+        {nullptr,         0,                 nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (opt) {
+        case 'h': opts.host = optarg; break;
+        case 'H': opts.httpPort = std::strtoul(optarg, nullptr, 10); break;
+        case 'B': opts.binaryPort = std::strtoul(optarg, nullptr, 10); break;
+        case 'U': opts.httpUnix = optarg; break;
+        case 'u': opts.binaryUnix = optarg; break;
+        case 'c': opts.connections = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 's': opts.seconds = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'b': opts.batch = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'p': opts.pipeline = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'P': opts.httpPipeline = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'x':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &opts.bbox[0], &opts.bbox[1],
+                       &opts.bbox[2], &opts.bbox[3]) != 4) {
+                std::cerr << "spatial_lookup_loadtest: bad --bbox '" << optarg << "'" << std::endl;
+                return false;
+            }
+            break;
+        default:
+            usage();
+            return false;
+        }
+    }
+    if (opts.batch > kBinaryMaxPoints) {
+        std::cerr << "spatial_lookup_loadtest: --batch is at most " << kBinaryMaxPoints << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+static void
+run_http(const Options& opts, bool unixSocket, Clock::time_point deadline, unsigned seed, Tally& tally)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> dx(opts.bbox[0], opts.bbox[2]);
+    std::uniform_real_distribution<double> dy(opts.bbox[1], opts.bbox[3]);
+
+    HttpConnection conn(opts.host, opts.httpPort, unixSocket ? opts.httpUnix : std::string());
+    std::deque<Clock::time_point> sent;
+    bool answered = false;
+
+    char request[192];
+    while (Clock::now() < deadline) {
+        // Top up the pipeline, then take one response
+        while (sent.size() < opts.httpPipeline) {
+            snprintf(request, sizeof(request),
+                     "GET /lookup?x=%.9f&y=%.9f HTTP/1.1\r\nHost: localhost\r\n\r\n", dx(rng), dy(rng));
+            sent.push_back(Clock::now());
+            if (!conn.send(request)) {
+                sent.pop_back();
+                break;
+            }
+        }
+        if (sent.empty()) {
+            // Never having got through, there is no server to
+            // test; after that, give it a moment to come back
+            tally.errors++;
+            if (!answered) {
+                std::cerr << "spatial_lookup_loadtest: unable to connect to "
+                          << (unixSocket ? opts.httpUnix : opts.host + ":" + std::to_string(opts.httpPort))
+                          << std::endl;
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        int status = conn.receive();
+        auto end = Clock::now();
+        answered = answered || status != 0;
+        if (status != 200) {
+            tally.errors++;
+            sent.pop_front();
+        }
+        else {
+            tally.points++;
+            tally.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - sent.front()).count());
+            sent.pop_front();
+        }
+
+        // Requests queued behind a close go unanswered, start over
+        if (!conn.connected())
+            sent.clear();
+    }
+}
+
+
+static void
+run_binary(const Options& opts, bool unixSocket, Clock::time_point deadline, unsigned seed, Tally& tally)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> dx(opts.bbox[0], opts.bbox[2]);
+    std::uniform_real_distribution<double> dy(opts.bbox[1], opts.bbox[3]);
+
+    LookupClient cli;
+    bool ok = unixSocket ? cli.connectUnix(opts.binaryUnix) : cli.connect(opts.host, opts.binaryPort);
+    if (!ok) {
+        std::cerr << "spatial_lookup_loadtest: " << cli.error() << std::endl;
+        tally.errors++;
+        return;
+    }
+
+    std::vector<double> xy(opts.batch * 2);
+    std::deque<Clock::time_point> sent;
+    BinaryHeader header;
+    std::string body;
+
+    auto sendOne = [&]() {
+        for (std::size_t i = 0; i < opts.batch; i++) {
+            xy[2 * i] = dx(rng);
+            xy[2 * i + 1] = dy(rng);
+        }
+        uint32_t id;
+        sent.push_back(Clock::now());
+        return cli.send(BINARY_LOOKUP_IDS, xy.data(), opts.batch, id);
+    };
+
+    // Keep the pipeline full until time is up, then drain it
+    for (std::size_t i = 0; i < opts.pipeline; i++) {
+        if (!sendOne())
+            break;
+    }
+    while (!sent.empty() && cli.connected()) {
+        if (!cli.receive(header, body)) {
+            tally.errors++;
+            break;
+        }
+        auto end = Clock::now();
+        tally.points += header.count;
+        tally.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - sent.front()).count());
+        sent.pop_front();
+        if (end < deadline && !sendOne())
+            break;
+    }
+}
+
+
+static void
+report(const char* name, const std::vector<Tally>& tallies, double seconds)
+{
+    std::vector<int64_t> all;
+    std::size_t points = 0;
+    std::size_t errors = 0;
+    for (auto& t : tallies) {
+        all.insert(all.end(), t.latencies.begin(), t.latencies.end());
+        points += t.points;
+        errors += t.errors;
+    }
+    if (all.empty()) {
+        std::cout << name << ": no successful requests (" << errors << " errors)" << std::endl;
+        return;
+    }
+    std::sort(all.begin(), all.end());
+    auto pct = [&all](double p) {
+        std::size_t i = static_cast<std::size_t>(p * (all.size() - 1));
+        return all[i] / 1000.0;
+    };
+
+    printf("%-12s %10.0f req/s %12.0f points/s   latency us: p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f  errors %zu\n",
+           name, all.size() / seconds, points / seconds,
+           pct(0.50), pct(0.90), pct(0.99), pct(0.999), all.back() / 1000.0, errors);
+}
+
+
+template<typename Runner>
+static void
+run(const char* name, const Options& opts, bool unixSocket, Runner runner)
+{
+    std::vector<Tally> tallies(opts.connections);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::seconds(opts.seconds);
+    for (std::size_t i = 0; i < opts.connections; i++)
+        threads.emplace_back(runner, std::cref(opts), unixSocket, deadline, static_cast<unsigned>(i + 1), std::ref(tallies[i]));
+    for (auto& t : threads)
+        t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    report(name, tallies, elapsed);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
+
+    if (opts.httpPort)
+        run("http-tcp", opts, false, run_http);
+    if (!opts.httpUnix.empty())
+        run("http-unix", opts, true, run_http);
+    if (opts.binaryPort)
+        run("binary-tcp", opts, false, run_binary);
+    if (!opts.binaryUnix.empty())
+        run("binary-unix", opts, true, run_binary);
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+*  generate_dataset.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+/*
+ * Writes a synthetic GeoJSON coverage, and optionally a file
+ * of query points over it, so that loading and lookup can be
+ * benchmarked at any scale without shipping real data. The
+ * same options always give the same files.
+ */
+
+// System headers
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+// App headers
+#include "Synthetic.h"
+
+struct Options {
+    SyntheticOptions synthetic;
+    std::size_t features = 4096;
+    std::size_t vertices = 64;
+    std::size_t queries = 0;
+    QueryDistribution distribution = QueryDistribution::UNIFORM;
+    std::string queriesOut;
+    std::string out;
+};
+
+
+static void
+usage()
+{
+    std::cerr << "Usage: spatial_lookup_generate [options] out.geojson" << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --features N                 cells in the coverage, about (default 4096)" << std::endl
+              << "  --vertices N                 vertices per cell, about (default 64)" << std::endl
+              << "  --roughness F                how far edges wander, 0 to 0.2 (default 0.1)" << std::endl
+              << "  --jitter F                   how irregular cells are, 0 to 0.2 (default 0.15)" << std::endl
+              << "  --skew F                     shrink cells in the middle, 1 for none (default 1)" << std::endl
+              << "  --holes F                    fraction of cells with a hole (default 0)" << std::endl
+              << "  --multipart F                fraction of holes filled by the next cell (default 0)" << std::endl
+              << "  --overlap F                  fraction of cells with an overlay (default 0)" << std::endl
+              << "  --bbox MINX,MINY,MAXX,MAXY   area to cover (default -125,24,-66,50)" << std::endl
+              << "  --seed N                     random seed (default 1)" << std::endl
+              << "  --queries N                  also write N query points" << std::endl
+              << "  --distribution NAME          uniform, clustered or boundary (default uniform)" << std::endl
+              << "  --queries-out PATH           file for the query points, one x,y per line" << std::endl;
+}
+
+
+static bool
+parse_options(int argc, char* argv[], Options& opts)
+{
+    static const option longopts[] = {
+        {"features",     required_argument, nullptr, 'f'},
+        {"vertices",     required_argument, nullptr, 'v'},
+        {"roughness",    required_argument, nullptr, 'r'},
+        {"jitter",       required_argument, nullptr, 'j'},
+        {"skew",         required_argument, nullptr, 'k'},
+        {"holes",        required_argument, nullptr, 'o'},
+        {"multipart",    required_argument, nullptr, 'm'},
+        {"overlap",      required_argument, nullptr, 'l'},
+        {"bbox",         required_argument, nullptr, 'x'},
+        {"seed",         required_argument, nullptr, 's'},
+        {"queries",      required_argument, nullptr, 'q'},
+        {"distribution", required_argument, nullptr, 'd'},
+        {"queries-out",  required_argument, nullptr, 'Q'},
+        {nullptr,        0,                 nullptr, 0}
+    };
+
+    SyntheticOptions& syn = opts.synthetic;
+    syn.jitter = 0.15;
+    syn.bbox[0] = -125.0;
+    syn.bbox[1] = 24.0;
+    syn.bbox[2] = -66.0;
+    syn.bbox[3] = 50.0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (opt) {
+        case 'f': opts.features = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'v': opts.vertices = std::max(4ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'r': syn.roughness = std::min(std::max(std::atof(optarg), 0.0), 0.2); break;
+        case 'j': syn.jitter = std::atof(optarg); break;
+        case 'k': syn.skew = std::max(std::atof(optarg), 0.1); break;
+        case 'o': syn.holes = std::atof(optarg); break;
+        case 'm': syn.multipart = std::atof(optarg); break;
+        case 'l': syn.overlap = std::atof(optarg); break;
+        case 's': syn.seed = std::strtoull(optarg, nullptr, 10); break;
+        case 'q': opts.queries = std::strtoul(optarg, nullptr, 10); break;
+        case 'Q': opts.queriesOut = optarg; break;
+        case 'd':
+            if (!parse_distribution(optarg, opts.distribution)) {
+                std::cerr << "spatial_lookup_generate: unknown distribution '" << optarg << "'" << std::endl;
+                return false;
+            }
+            break;
+        case 'x':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &syn.bbox[0], &syn.bbox[1],
+                       &syn.bbox[2], &syn.bbox[3]) != 4) {
+                std::cerr << "spatial_lookup_generate: bad --bbox '" << optarg << "'" << std::endl;
+                return false;
+            }
+            break;
+        default:
+            usage();
+            return false;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return false;
+    }
+    opts.out = argv[optind];
+    if (opts.queries && opts.queriesOut.empty()) {
+        std::cerr << "spatial_lookup_generate: --queries needs --queries-out" << std::endl;
+        return false;
+    }
+
+    // As square a grid as gives the cells asked for, and edges
+    // split often enough to give the vertices asked for
+    syn.columns = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(opts.features))));
+    syn.rows = (opts.features + syn.columns - 1) / syn.columns;
+    syn.depth = static_cast<std::size_t>(std::lround(std::log2(opts.vertices / 4.0)));
+    return true;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
+
+    std::vector<SyntheticFeature> features = synthetic_features(opts.synthetic);
+    std::size_t vertices = 0;
+    for (const auto& f : features)
+        for (const auto& polygon : f.polygons)
+            for (const auto& ring : polygon)
+                vertices += ring.size();
+
+    std::ofstream out(opts.out);
+    if (!out) {
+        std::cerr << "spatial_lookup_generate: unable to write '" << opts.out << "'" << std::endl;
+        return 1;
+    }
+    write_geojson(out, features);
+    out.close();
+    std::cerr << "spatial_lookup_generate: wrote " << features.size() << " features, "
+              << vertices << " vertices, to " << opts.out << std::endl;
+
+    if (opts.queries) {
+        std::vector<Coordinate> points = make_queries(features, opts.distribution, opts.queries,
+                                                      opts.synthetic.seed);
+        std::ofstream qout(opts.queriesOut);
+        if (!qout) {
+            std::cerr << "spatial_lookup_generate: unable to write '" << opts.queriesOut << "'" << std::endl;
+            return 1;
+        }
+        char line[64];
+        for (const Coordinate& c : points) {
+            snprintf(line, sizeof(line), "%.10g,%.10g\n", c.x, c.y);
+            qout << line;
+        }
+        std::cerr << "spatial_lookup_generate: wrote " << points.size() << " "
+                  << distribution_name(opts.distribution) << " query points to "
+                  << opts.queriesOut << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,424 @@
+/*
+*  http_loadgen.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+/*
+ * Drives a running spatial_lookup over HTTP, from any number
+ * of connections, with or without keep-alive, pipelining and
+ * batching, and reports throughput and latency percentiles.
+ *
+ * Given a --rate, requests are sent on a fixed schedule, and
+ * latency is also measured from when each request should have
+ * been sent rather than when it was, so that time spent stuck
+ * behind a slow response is counted, not left out (correcting
+ * for "coordinated omission"). Without one, each connection
+ * sends as fast as responses come back.
+ */
+
+// System headers
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+// App headers
+#include "HttpConnection.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Clusters for the clustered distribution, and their spread
+// as a fraction of the bbox
+static const std::size_t kClusters = 8;
+static const double kClusterSpread = 0.01;
+
+// How long before a request is due to stop sleeping and spin
+static const std::chrono::microseconds kSpinAhead(200);
+
+struct Options {
+    std::string host = "localhost";
+    unsigned int port = 8080;
+    std::string unixPath;
+    std::size_t connections = 4;
+    std::size_t seconds = 10;
+    std::size_t pipeline = 1;
+    std::size_t batch = 1;
+    double rate = 0.0;
+    bool keepAlive = true;
+    std::string queries;
+    std::string distribution = "uniform";
+    double bbox[4] = {-180.0, -90.0, 180.0, 90.0};
+};
+
+/**
+ * What one connection measured: requests answered, points
+ * looked up, and the latency of each request in nanoseconds,
+ * from when it was sent and from when it was due to be sent.
+ */
+struct Tally {
+    std::size_t requests = 0;
+    std::size_t points = 0;
+    std::size_t errors = 0;
+    std::size_t unsent = 0;
+    Clock::time_point last;
+    std::vector<int64_t> service;
+    std::vector<int64_t> corrected;
+};
+
+
+static void
+usage()
+{
+    std::cerr << "Usage: spatial_lookup_loadgen [options]" << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --host ADDR                  server address (default localhost)" << std::endl
+              << "  --port N                     HTTP port (default 8080)" << std::endl
+              << "  --unix PATH                  connect to this Unix domain socket instead" << std::endl
+              << "  --connections N              concurrent connections (default 4)" << std::endl
+              << "  --seconds N                  duration of the run (default 10)" << std::endl
+              << "  --pipeline N                 requests in flight per connection (default 1)" << std::endl
+              << "  --batch N                    points per request, over /lookup/stream if more than 1" << std::endl
+              << "  --rate N                     requests per second over all connections, on a fixed" << std::endl
+              << "                               schedule (default as fast as possible)" << std::endl
+              << "  --no-keepalive               a new connection for every request" << std::endl
+              << "  --queries PATH               query points, one x,y per line, used in turn" << std::endl
+              << "  --distribution NAME          uniform or clustered random points (default uniform)" << std::endl
+              << "  --bbox MINX,MINY,MAXX,MAXY   area to draw random points from" << std::endl;
+}
+
+
+static bool
+parse_options(int argc, char* argv[], Options& opts)
+{
+    static const option longopts[] = {
+        {"host",          required_argument, nullptr, 'h'},
+        {"port",          required_argument, nullptr, 'p'},
+        {"unix",          required_argument, nullptr, 'u'},
+        {"connections",   required_argument, nullptr, 'c'},
+        {"seconds",       required_argument, nullptr, 's'},
+        {"pipeline",      required_argument, nullptr, 'P'},
+        {"batch",         required_argument, nullptr, 'b'},
+        {"rate",          required_argument, nullptr, 'r'},
+        {"no-keepalive",  no_argument,       nullptr, 'k'},
+        {"queries",       required_argument, nullptr, 'q'},
+        {"distribution",  required_argument, nullptr, 'd'},
+        {"bbox",          required_argument, nullptr, 'x'},
+        {nullptr,         0,                 nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (opt) {
+        case 'h': opts.host = optarg; break;
+        case 'p': opts.port = std::strtoul(optarg, nullptr, 10); break;
+        case 'u': opts.unixPath = optarg; break;
+        case 'c': opts.connections = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 's': opts.seconds = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'P': opts.pipeline = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'b': opts.batch = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'r': opts.rate = std::max(0.0, std::atof(optarg)); break;
+        case 'k': opts.keepAlive = false; break;
+        case 'q': opts.queries = optarg; break;
+        case 'd': opts.distribution = optarg; break;
+        case 'x':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &opts.bbox[0], &opts.bbox[1],
+                       &opts.bbox[2], &opts.bbox[3]) != 4) {
+                std::cerr << "spatial_lookup_loadgen: bad --bbox '" << optarg << "'" << std::endl;
+                return false;
+            }
+            break;
+        default:
+            usage();
+            return false;
+        }
+    }
+    if (opts.distribution != "uniform" && opts.distribution != "clustered") {
+        std::cerr << "spatial_lookup_loadgen: unknown distribution '" << opts.distribution
+                  << "', use --queries for others" << std::endl;
+        return false;
+    }
+    // Without keep-alive, the server closes after the first
+    // response, so anything pipelined behind it is lost
+    if (!opts.keepAlive)
+        opts.pipeline = 1;
+    return true;
+}
+
+
+/*************************************************************************
+ * Query points
+ */
+
+/**
+ * Where query points come from: a file, used in turn, each
+ * connection starting at a different place in it, or random
+ * points in the bbox.
+ */
+class Points {
+
+public:
+
+    bool
+    load(const Options& opts)
+    {
+        if (opts.queries.empty()) {
+            std::mt19937_64 rng(0);
+            std::uniform_real_distribution<double> dx(opts.bbox[0], opts.bbox[2]);
+            std::uniform_real_distribution<double> dy(opts.bbox[1], opts.bbox[3]);
+            if (opts.distribution == "clustered") {
+                for (std::size_t i = 0; i < kClusters; i++)
+                    m_centres.push_back({dx(rng), dy(rng)});
+            }
+            m_bbox = opts.bbox;
+            return true;
+        }
+
+        std::ifstream in(opts.queries);
+        if (!in) {
+            std::cerr << "spatial_lookup_loadgen: unable to read '" << opts.queries << "'" << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            double x, y;
+            if (sscanf(line.c_str(), " %lf%*[ ,]%lf", &x, &y) == 2)
+                m_file.push_back({x, y});
+        }
+        if (m_file.empty()) {
+            std::cerr << "spatial_lookup_loadgen: no points in '" << opts.queries << "'" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::size_t fileSize() const { return m_file.size(); }
+
+    /**
+     * The next point for a connection, from its own place
+     * in the file, or its own random numbers.
+     */
+    void
+    next(std::size_t& pos, std::mt19937_64& rng, double& x, double& y) const
+    {
+        if (!m_file.empty()) {
+            const auto& p = m_file[pos++ % m_file.size()];
+            x = p.first;
+            y = p.second;
+        }
+        else if (!m_centres.empty()) {
+            const auto& c = m_centres[std::uniform_int_distribution<std::size_t>(0, m_centres.size() - 1)(rng)];
+            x = c.first + std::normal_distribution<double>(0.0, (m_bbox[2] - m_bbox[0]) * kClusterSpread)(rng);
+            y = c.second + std::normal_distribution<double>(0.0, (m_bbox[3] - m_bbox[1]) * kClusterSpread)(rng);
+        }
+        else {
+            x = std::uniform_real_distribution<double>(m_bbox[0], m_bbox[2])(rng);
+            y = std::uniform_real_distribution<double>(m_bbox[1], m_bbox[3])(rng);
+        }
+    }
+
+private:
+
+    std::vector<std::pair<double, double>> m_file;
+    std::vector<std::pair<double, double>> m_centres;
+    const double* m_bbox = nullptr;
+
+};
+
+
+/*************************************************************************
+ * Load
+ */
+
+static void
+build_request(const Options& opts, const Points& points, std::size_t& pos,
+              std::mt19937_64& rng, std::string& request)
+{
+    char buf[128];
+    double x, y;
+    const char* connection = opts.keepAlive ? "" : "Connection: close\r\n";
+    if (opts.batch == 1) {
+        points.next(pos, rng, x, y);
+        snprintf(buf, sizeof(buf), "GET /lookup?x=%.9g&y=%.9g HTTP/1.1\r\n", x, y);
+        request = buf;
+        request += "Host: localhost\r\n";
+        request += connection;
+        request += "\r\n";
+        return;
+    }
+
+    std::string body;
+    for (std::size_t i = 0; i < opts.batch; i++) {
+        points.next(pos, rng, x, y);
+        snprintf(buf, sizeof(buf), "%.9g,%.9g\n", x, y);
+        body += buf;
+    }
+    request = "POST /lookup/stream HTTP/1.1\r\nHost: localhost\r\nContent-Type: text/plain\r\n";
+    request += connection;
+    request += "Content-Length: ";
+    request += std::to_string(body.size());
+    request += "\r\n\r\n";
+    request += body;
+}
+
+
+/**
+ * One connection's share of the load. With a rate, request k
+ * is due at start + k * interval, and is sent then if there is
+ * room in the pipeline, or as soon after as there is.
+ */
+static void
+run_connection(const Options& opts, const Points& points, std::size_t id,
+               Clock::time_point start, Clock::time_point deadline, Tally& tally)
+{
+    std::mt19937_64 rng(id + 1);
+    std::size_t pos = points.fileSize() * id / opts.connections;
+    HttpConnection conn(opts.host, opts.port, opts.unixPath);
+    std::string request;
+
+    bool paced = opts.rate > 0;
+    Clock::duration interval = paced
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.connections / opts.rate))
+        : Clock::duration::zero();
+    // Spread the connections' schedules over the interval
+    Clock::time_point due = start + interval * id / opts.connections;
+
+    struct Pending {
+        Clock::time_point due;
+        Clock::time_point sent;
+    };
+    std::deque<Pending> inflight;
+
+    for (;;) {
+        Clock::time_point now = Clock::now();
+        if (now >= deadline && inflight.empty())
+            break;
+
+        // Send whatever is due, while there is room
+        if (now < deadline && inflight.size() < opts.pipeline && (!paced || now >= due)) {
+            build_request(opts, points, pos, rng, request);
+            if (!conn.send(request)) {
+                // Whatever was out on the old connection is lost too
+                tally.errors += 1 + inflight.size();
+                inflight.clear();
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            inflight.push_back({paced ? due : now, now});
+            due += interval;
+            continue;
+        }
+
+        // Nothing out, so nothing to do but wait for the next,
+        // sleeping most of the way and spinning the rest, since
+        // waking late would count against the server
+        if (inflight.empty()) {
+            Clock::time_point wake = std::min(due, deadline) - kSpinAhead;
+            if (now < wake)
+                std::this_thread::sleep_until(wake);
+            continue;
+        }
+
+        // With room in the pipeline, only wait for a response
+        // until the next request is due
+        if (paced && inflight.size() < opts.pipeline && now < deadline &&
+            !conn.waitReadable(std::min(due, deadline)))
+            continue;
+
+        int status = conn.receive();
+        Clock::time_point end = Clock::now();
+        Pending p = inflight.front();
+        inflight.pop_front();
+        if (status == 200) {
+            tally.requests++;
+            tally.points += opts.batch;
+            tally.service.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - p.sent).count());
+            tally.corrected.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - p.due).count());
+            tally.last = end;
+        }
+        else {
+            tally.errors++;
+        }
+
+        // Requests queued behind a close go unanswered
+        if (!conn.connected()) {
+            tally.errors += inflight.size();
+            inflight.clear();
+        }
+    }
+
+    // Requests that fell so far behind they were never sent
+    if (paced && due < deadline)
+        tally.unsent += (deadline - due) / interval;
+}
+
+
+static void
+print_latency(const char* name, std::vector<int64_t>& all)
+{
+    std::sort(all.begin(), all.end());
+    auto pct = [&all](double p) {
+        return all[static_cast<std::size_t>(p * (all.size() - 1))] / 1000.0;
+    };
+    printf("  %-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+           pct(0.50), pct(0.90), pct(0.99), pct(0.999), all.back() / 1000.0);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
+    Points points;
+    if (!points.load(opts))
+        return 1;
+
+    std::vector<Tally> tallies(opts.connections);
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::seconds(opts.seconds);
+    for (std::size_t i = 0; i < opts.connections; i++)
+        threads.emplace_back(run_connection, std::cref(opts), std::cref(points), i,
+                             start, deadline, std::ref(tallies[i]));
+    for (auto& t : threads)
+        t.join();
+
+    Tally total;
+    total.last = start;
+    for (auto& t : tallies) {
+        total.requests += t.requests;
+        total.points += t.points;
+        total.errors += t.errors;
+        total.unsent += t.unsent;
+        total.last = std::max(total.last, t.last);
+        total.service.insert(total.service.end(), t.service.begin(), t.service.end());
+        total.corrected.insert(total.corrected.end(), t.corrected.begin(), t.corrected.end());
+    }
+    double elapsed = std::chrono::duration<double>(std::max(total.last, deadline) - start).count();
+    printf("requests %zu (%.0f/s)  points %zu (%.0f/s)  errors %zu",
+           total.requests, total.requests / elapsed, total.points, total.points / elapsed, total.errors);
+    if (opts.rate > 0)
+        printf("  unsent %zu", total.unsent);
+    printf("\n");
+    if (total.service.empty())
+        return 1;
+
+    printf("  latency us        p50        p90        p99      p99.9        max\n");
+    print_latency("service", total.service);
+    if (opts.rate > 0)
+        print_latency("corrected", total.corrected);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+*  publish_dataset.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+/*
+ * Loads a GeoJSON file once and publishes it to POSIX shared
+ * memory, for any number of servers started with --shared to
+ * attach to, instead of each loading a copy of its own.
+ *
+ * Publishing again under the same name swaps the new data set
+ * in for servers started afterwards; those already running
+ * keep the one they attached to. As a check on the layout,
+ * the published data set is attached and compared with the
+ * loaded one over a spread of random points.
+ */
+
+// System headers
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+// App headers
+#include "SharedDataset.h"
+#include "SpatialLookup.h"
+
+struct Options {
+    std::size_t check = 100000;
+    bool remove = false;
+    std::string filename;
+    std::string property;
+    std::string name;
+};
+
+
+static void
+usage()
+{
+    std::cerr << "Usage: spatial_lookup_publish [options] geojson.json property NAME" << std::endl
+              << "       spatial_lookup_publish --remove NAME" << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --check N                    compare N random lookups once published (default 100000)" << std::endl
+              << "  --remove                     remove the data set published as NAME" << std::endl;
+}
+
+
+static bool
+parse_options(int argc, char* argv[], Options& opts)
+{
+    static const option longopts[] = {
+        {"check",    required_argument, nullptr, 'c'},
+        {"remove",   no_argument,       nullptr, 'r'},
+        {nullptr,    0,                 nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (opt) {
+        case 'c': opts.check = std::strtoul(optarg, nullptr, 10); break;
+        case 'r': opts.remove = true; break;
+        default:
+            usage();
+            return false;
+        }
+    }
+    int left = argc - optind;
+    if (opts.remove ? left != 1 : left != 3) {
+        usage();
+        return false;
+    }
+    if (opts.remove) {
+        opts.name = argv[optind];
+        return true;
+    }
+    opts.filename = argv[optind];
+    opts.property = argv[optind + 1];
+    opts.name = argv[optind + 2];
+    return true;
+}
+
+
+/**
+ * Look up count random points over the data in both, and
+ * return how many came back different.
+ */
+static std::size_t
+compare(const SpatialLookup& loaded, const SpatialLookup& shared, std::size_t count)
+{
+    Envelope bounds;
+    for (std::size_t i = 0; i < loaded.numFeatures(); i++)
+        bounds.expandToInclude(loaded.entry(static_cast<uint32_t>(i)).getEnvelopeInternal());
+
+    std::mt19937_64 rng(1);
+    std::uniform_real_distribution<double> x(bounds.getMinX(), bounds.getMaxX());
+    std::uniform_real_distribution<double> y(bounds.getMinY(), bounds.getMaxY());
+    std::vector<uint32_t> a, b;
+    std::size_t differ = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        Coordinate c(x(rng), y(rng));
+        a.clear();
+        b.clear();
+        loaded.lookupIds(c, a);
+        shared.lookupIds(c, b);
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        if (a != b)
+            differ++;
+    }
+    return differ;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
+    if (opts.remove)
+        return remove_shared_dataset(opts.name) ? 0 : 1;
+
+    SpatialLookup splu(opts.filename, opts.property);
+    if (!splu.ready()) {
+        std::cerr << "spatial_lookup_publish: data load failed" << std::endl;
+        return 1;
+    }
+    print_load_report(std::cerr, splu.loadReport());
+    if (!publish_shared_dataset(splu, opts.name))
+        return 1;
+
+    std::unique_ptr<SharedDataset> shared(new SharedDataset);
+    if (!shared->attach(opts.name))
+        return 1;
+    SpatialLookup published(std::move(shared));
+    const SharedDataset* ds = published.shared();
+    std::cerr << "spatial_lookup_publish: published " << published.numFeatures() << " features as "
+              << ds->name() << ", " << ds->bytes() << " bytes" << std::endl;
+    std::cerr << "spatial_lookup_publish: band index " << ds->bandIndexBytes() << " bytes, "
+              << ds->bandEntries() << " entries for " << ds->numVertices() << " vertices" << std::endl;
+
+    if (opts.check && splu.numFeatures()) {
+        std::size_t differ = compare(splu, published, opts.check);
+        std::cerr << "spatial_lookup_publish: " << differ << " of " << opts.check
+                  << " random lookups differ" << std::endl;
+        if (differ) {
+            remove_shared_dataset(opts.name);
+            std::cerr << "spatial_lookup_publish: removed " << opts.name << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
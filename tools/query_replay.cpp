@@ -0,0 +1,288 @@
+/*
+*  query_replay.cpp
+*
+*  Copyright (c) 2021 Paul Ramsey. All rights reserved.
+*  MIT License
+*/
+
+/*
+ * Replays a query capture written by spatial_lookup --capture,
+ * either in process, straight through SpatialLookup::lookup()
+ * on a data file loaded here, or over HTTP to a running server,
+ * and reports latency percentiles, so a change can be measured
+ * against the real mix of queries rather than a made up one.
+ *
+ * Queries go out at their captured pace, or --speed times
+ * faster, from a pool of threads (or connections). As with the
+ * load generator, latency is also measured from when each
+ * query was due, so a replay that falls behind shows it.
+ * --speed 0 replays as fast as the threads can go.
+ *
+ * In process, --pin spreads the threads over the cores of
+ * every NUMA node, all reading one copy of the data, in the
+ * memory of the node that loaded it, and --numa pins them and
+ * gives each node a copy of its own, so comparing the two at --speed 0 on a multi
+ * socket machine shows what replication is worth.
+ */
+
+// System headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <getopt.h>
+
+// App headers
+#include "HttpConnection.h"
+#include "Numa.h"
+#include "QueryCapture.h"
+#include "SpatialLookup.h"
+
+using Clock = std::chrono::steady_clock;
+
+// How long before a query is due to stop sleeping and spin
+static const std::chrono::microseconds kSpinAhead(200);
+
+struct Options {
+    std::string host = "localhost";
+    unsigned int port = 8080;
+    std::string unixPath;
+    std::size_t threads = 4;
+    double speed = 1.0;
+    std::string capture;
+    std::string filename;
+    std::string property;
+    bool pin = false;
+    bool numa = false;
+};
+
+/**
+ * What one thread measured: queries answered, hits found in
+ * process, and the latency of each in nanoseconds, from when
+ * it was sent and from when it was due.
+ */
+struct Tally {
+    std::size_t queries = 0;
+    std::size_t hits = 0;
+    std::size_t errors = 0;
+    std::vector<int64_t> service;
+    std::vector<int64_t> corrected;
+};
+
+
+static void
+usage()
+{
+    std::cerr << "Usage: spatial_lookup_replay [options] capture.bin [geojson.json property]" << std::endl
+              << std::endl
+              << "Given a data file and property, queries run in process, otherwise over HTTP." << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --speed F                    replay F times faster than captured, 0 for flat out (default 1)" << std::endl
+              << "  --threads N                  threads, and connections over HTTP (default 4)" << std::endl
+              << "  --host ADDR                  server address (default localhost)" << std::endl
+              << "  --port N                     HTTP port (default 8080)" << std::endl
+              << "  --unix PATH                  connect to this Unix domain socket instead" << std::endl
+              << "  --pin                        in process, pin threads to cores across NUMA nodes" << std::endl
+              << "  --numa                       in process, pin threads and copy the data to each node" << std::endl;
+}
+
+
+static bool
+parse_options(int argc, char* argv[], Options& opts)
+{
+    static const option longopts[] = {
+        {"speed",    required_argument, nullptr, 's'},
+        {"threads",  required_argument, nullptr, 't'},
+        {"host",     required_argument, nullptr, 'h'},
+        {"port",     required_argument, nullptr, 'p'},
+        {"unix",     required_argument, nullptr, 'u'},
+        {"pin",      no_argument,       nullptr, 'P'},
+        {"numa",     no_argument,       nullptr, 'n'},
+        {nullptr,    0,                 nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longopts, nullptr)) != -1) {
+        switch (opt) {
+        case 's': opts.speed = std::max(0.0, std::atof(optarg)); break;
+        case 't': opts.threads = std::max(1ul, std::strtoul(optarg, nullptr, 10)); break;
+        case 'h': opts.host = optarg; break;
+        case 'p': opts.port = std::strtoul(optarg, nullptr, 10); break;
+        case 'u': opts.unixPath = optarg; break;
+        case 'P': opts.pin = true; break;
+        case 'n': opts.numa = opts.pin = true; break;
+        default:
+            usage();
+            return false;
+        }
+    }
+    int left = argc - optind;
+    if (left != 1 && left != 3) {
+        usage();
+        return false;
+    }
+    opts.capture = argv[optind];
+    if (left == 3) {
+        opts.filename = argv[optind + 1];
+        opts.property = argv[optind + 2];
+    }
+    else if (opts.pin) {
+        std::cerr << "spatial_lookup_replay: --pin and --numa are for replays in process" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * Take queries off the shared list in turn, wait until each
+ * is due, and run it, in process if there is a splu, or over
+ * this thread's own connection if not.
+ */
+static void
+replay(const Options& opts, const std::vector<CapturedQuery>& queries, const SpatialLookup* splu,
+       std::atomic<std::size_t>& next, Clock::time_point start, Tally& tally)
+{
+    numa_pin_worker();
+    HttpConnection conn(opts.host, opts.port, opts.unixPath);
+    int64_t first = queries.front().micros;
+    char request[128];
+
+    for (;;) {
+        std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= queries.size())
+            return;
+        const CapturedQuery& q = queries[i];
+
+        // Sleep most of the way and spin the rest, since
+        // waking late would count against the lookup
+        Clock::time_point due = start;
+        if (opts.speed > 0) {
+            due += std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::micro>((q.micros - first) / opts.speed));
+            std::this_thread::sleep_until(due - kSpinAhead);
+            while (Clock::now() < due) {}
+        }
+
+        Clock::time_point sent = Clock::now();
+        bool ok = true;
+        if (splu) {
+            std::vector<std::string> hits = splu->lookup(Coordinate(q.x, q.y));
+            tally.hits += hits.size();
+        }
+        else {
+            snprintf(request, sizeof(request),
+                     "GET /lookup?x=%.17g&y=%.17g HTTP/1.1\r\nHost: localhost\r\n\r\n", q.x, q.y);
+            ok = conn.send(request) && conn.receive() == 200;
+        }
+        Clock::time_point end = Clock::now();
+
+        if (!ok) {
+            tally.errors++;
+            continue;
+        }
+        tally.queries++;
+        tally.service.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - sent).count());
+        if (opts.speed > 0)
+            tally.corrected.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - due).count());
+    }
+}
+
+
+static void
+print_latency(const char* name, std::vector<int64_t>& all)
+{
+    std::sort(all.begin(), all.end());
+    auto pct = [&all](double p) {
+        return all[static_cast<std::size_t>(p * (all.size() - 1))] / 1000.0;
+    };
+    printf("  %-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+           pct(0.50), pct(0.90), pct(0.99), pct(0.999), all.back() / 1000.0);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+    Options opts;
+    if (!parse_options(argc, argv, opts))
+        return 1;
+
+    std::vector<CapturedQuery> queries;
+    std::string err;
+    if (!read_capture(opts.capture, queries, err)) {
+        std::cerr << "spatial_lookup_replay: " << err << std::endl;
+        return 1;
+    }
+    if (queries.empty()) {
+        std::cerr << "spatial_lookup_replay: no queries in '" << opts.capture << "'" << std::endl;
+        return 1;
+    }
+    double captured = (queries.back().micros - queries.front().micros) / 1e6;
+    std::cerr << "spatial_lookup_replay: " << queries.size() << " queries over "
+              << captured << "s captured" << std::endl;
+
+    std::unique_ptr<SpatialLookup> splu;
+    if (!opts.filename.empty()) {
+        splu.reset(new SpatialLookup(opts.filename, opts.property));
+        if (!splu->ready()) {
+            std::cerr << "spatial_lookup_replay: data load failed" << std::endl;
+            return 1;
+        }
+        if (opts.pin) {
+            // Both lay the data out flat, as replicas are, so
+            // the only difference between them is where it is
+            std::unique_ptr<SharedDataset> flat(new SharedDataset);
+            if (!flat->build(*splu))
+                return 1;
+            splu.reset(new SpatialLookup(std::move(flat)));
+            if (opts.numa)
+                splu->replicate();
+            numa_enable_pinning();
+            std::cerr << "spatial_lookup_replay: threads pinned over "
+                      << NumaTopology::get().numNodes() << " NUMA nodes, "
+                      << (opts.numa ? "a copy of the data on each" : "one copy of the data") << std::endl;
+        }
+    }
+
+    std::vector<Tally> tallies(opts.threads);
+    std::vector<std::thread> threads;
+    std::atomic<std::size_t> next(0);
+    Clock::time_point start = Clock::now();
+    for (std::size_t i = 0; i < opts.threads; i++)
+        threads.emplace_back(replay, std::cref(opts), std::cref(queries), splu.get(),
+                             std::ref(next), start, std::ref(tallies[i]));
+    for (auto& t : threads)
+        t.join();
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Tally total;
+    for (auto& t : tallies) {
+        total.queries += t.queries;
+        total.hits += t.hits;
+        total.errors += t.errors;
+        total.service.insert(total.service.end(), t.service.begin(), t.service.end());
+        total.corrected.insert(total.corrected.end(), t.corrected.begin(), t.corrected.end());
+    }
+    printf("queries %zu in %.2fs (%.0f/s)  errors %zu", total.queries, elapsed,
+           total.queries / elapsed, total.errors);
+    if (splu)
+        printf("  hits %zu", total.hits);
+    printf("\n");
+    if (total.service.empty())
+        return 1;
+
+    printf("  latency us        p50        p90        p99      p99.9        max\n");
+    print_latency("service", total.service);
+    if (opts.speed > 0)
+        print_latency("corrected", total.corrected);
+    return 0;
+}